@@ -52,6 +52,14 @@ extern "C" {
 JNIEXPORT jbyteArray JNICALL Java_net_i2p_util_NativeBigInteger_nativeModPow
   (JNIEnv *, jclass, jbyteArray, jbyteArray, jbyteArray);
 
+/*
+ * Class:     net_i2p_util_NativeBigInteger
+ * Method:    nativeModPowBatch
+ * Signature: ([[B[[B[B)[[B
+ */
+JNIEXPORT jobjectArray JNICALL Java_net_i2p_util_NativeBigInteger_nativeModPowBatch
+  (JNIEnv *, jclass, jobjectArray, jobjectArray, jbyteArray);
+
 /*
  * Class:     net_i2p_util_NativeBigInteger
  * Method:    nativeDoubleValue
@@ -60,6 +68,118 @@ JNIEXPORT jbyteArray JNICALL Java_net_i2p_util_NativeBigInteger_nativeModPow
 JNIEXPORT jdouble JNICALL Java_net_i2p_util_NativeBigInteger_nativeDoubleValue
   (JNIEnv *, jclass, jbyteArray);
 
+/*
+ * Class:     net_i2p_util_NativeBigInteger
+ * Method:    nativeCreateFixedBase
+ * Signature: ([B[BI)J
+ */
+JNIEXPORT jlong JNICALL Java_net_i2p_util_NativeBigInteger_nativeCreateFixedBase
+  (JNIEnv *, jclass, jbyteArray, jbyteArray, jint);
+
+/*
+ * Class:     net_i2p_util_NativeBigInteger
+ * Method:    nativeModPowFixedBase
+ * Signature: (J[B)[B
+ */
+JNIEXPORT jbyteArray JNICALL Java_net_i2p_util_NativeBigInteger_nativeModPowFixedBase
+  (JNIEnv *, jclass, jlong, jbyteArray);
+
+/*
+ * Class:     net_i2p_util_NativeBigInteger
+ * Method:    nativeFreeFixedBase
+ * Signature: (J)V
+ */
+JNIEXPORT void JNICALL Java_net_i2p_util_NativeBigInteger_nativeFreeFixedBase
+  (JNIEnv *, jclass, jlong);
+
+/*
+ * Class:     net_i2p_util_NativeBigInteger
+ * Method:    nativeCreateSecretExponent
+ * Signature: ([B[B)J
+ */
+JNIEXPORT jlong JNICALL Java_net_i2p_util_NativeBigInteger_nativeCreateSecretExponent
+  (JNIEnv *, jclass, jbyteArray, jbyteArray);
+
+/*
+ * Class:     net_i2p_util_NativeBigInteger
+ * Method:    nativeModPowSecret
+ * Signature: (J[B)[B
+ */
+JNIEXPORT jbyteArray JNICALL Java_net_i2p_util_NativeBigInteger_nativeModPowSecret
+  (JNIEnv *, jclass, jlong, jbyteArray);
+
+/*
+ * Class:     net_i2p_util_NativeBigInteger
+ * Method:    nativeFreeSecretExponent
+ * Signature: (J)V
+ */
+JNIEXPORT void JNICALL Java_net_i2p_util_NativeBigInteger_nativeFreeSecretExponent
+  (JNIEnv *, jclass, jlong);
+
+/*
+ * Class:     net_i2p_util_NativeBigInteger
+ * Method:    nativeCreateValue
+ * Signature: ([B)J
+ */
+JNIEXPORT jlong JNICALL Java_net_i2p_util_NativeBigInteger_nativeCreateValue
+  (JNIEnv *, jclass, jbyteArray);
+
+/*
+ * Class:     net_i2p_util_NativeBigInteger
+ * Method:    nativeExportValue
+ * Signature: (J)[B
+ */
+JNIEXPORT jbyteArray JNICALL Java_net_i2p_util_NativeBigInteger_nativeExportValue
+  (JNIEnv *, jclass, jlong);
+
+/*
+ * Class:     net_i2p_util_NativeBigInteger
+ * Method:    nativeFreeValue
+ * Signature: (J)V
+ */
+JNIEXPORT void JNICALL Java_net_i2p_util_NativeBigInteger_nativeFreeValue
+  (JNIEnv *, jclass, jlong);
+
+/*
+ * Class:     net_i2p_util_NativeBigInteger
+ * Method:    nativeMulValues
+ * Signature: (JJJ)V
+ */
+JNIEXPORT void JNICALL Java_net_i2p_util_NativeBigInteger_nativeMulValues
+  (JNIEnv *, jclass, jlong, jlong, jlong);
+
+/*
+ * Class:     net_i2p_util_NativeBigInteger
+ * Method:    nativeModValue
+ * Signature: (JJJ)V
+ */
+JNIEXPORT void JNICALL Java_net_i2p_util_NativeBigInteger_nativeModValue
+  (JNIEnv *, jclass, jlong, jlong, jlong);
+
+/*
+ * Class:     net_i2p_util_NativeBigInteger
+ * Method:    nativeModPowValues
+ * Signature: (JJJJ)V
+ */
+JNIEXPORT void JNICALL Java_net_i2p_util_NativeBigInteger_nativeModPowValues
+  (JNIEnv *, jclass, jlong, jlong, jlong, jlong);
+
+/*
+ * Class:     net_i2p_util_NativeBigInteger
+ * Method:    nativeModInverseValue
+ * Signature: (JJJ)V
+ */
+JNIEXPORT void JNICALL Java_net_i2p_util_NativeBigInteger_nativeModInverseValue
+  (JNIEnv *, jclass, jlong, jlong, jlong);
+
+/*
+ * Class:     net_i2p_util_NativeBigInteger
+ * Method:    nativeMultiModPow
+ * Signature: ([[B[[B[B)[B
+ */
+JNIEXPORT jbyteArray JNICALL Java_net_i2p_util_NativeBigInteger_nativeMultiModPow
+  (JNIEnv *, jclass, jobjectArray, jobjectArray, jbyteArray);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,11 +1,15 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <gmp.h>
 #include "jbigi.h"
 
 /******** prototypes */
 
 void convert_j2mp(JNIEnv* env, jbyteArray jvalue, mpz_t* mvalue);
+void import_j2mp(JNIEnv* env, jbyteArray jvalue, mpz_t mvalue);
 void convert_mp2j(JNIEnv* env, mpz_t mvalue, jbyteArray* jvalue);
+static void throw_arithmetic(JNIEnv* env, const char* msg);
 
 
 /*****************************************
@@ -57,6 +61,91 @@ JNIEXPORT jbyteArray JNICALL Java_net_i2p_util_NativeBigInteger_nativeModPow
         return jresult;
 }
 
+/******** nativeModPowBatch() */
+/*
+ * Class:     net_i2p_util_NativeBigInteger
+ * Method:    nativeModPowBatch
+ * Signature: ([[B[[B[B)[[B
+ *
+ * From the javadoc:
+ *
+ * calculate (bases[i] ^ exponents[i]) % modulus for every i, in one call.
+ * @param bases big endian twos complement representations of the bases (but they must be positive)
+ * @param exponents big endian twos complement representations of the exponents, as many as bases
+ * @param modulus big endian twos complement representation of the modulus
+ * @return big endian twos complement representations of (bases[i] ^ exponents[i]) % modulus
+ * @throws ArithmeticException if the modulus is 0
+ */
+
+JNIEXPORT jobjectArray JNICALL Java_net_i2p_util_NativeBigInteger_nativeModPowBatch
+        (JNIEnv* env, jclass cls, jobjectArray jbases, jobjectArray jexps, jbyteArray jmod) {
+        /* Same as nativeModPow() for each pair, but the modulus is converted
+         * only once, and the same three scratch values are used for every
+         * pair, so that GMP reallocates them only when an operand is larger
+         * than any before it. The local references are dropped as we go, so
+         * that a batch of thousands does not overflow the local reference
+         * table.
+         */
+
+        mpz_t mbase;
+        mpz_t mexp;
+        mpz_t mmod;
+        mpz_t mresult;
+        jsize count;
+        jsize i;
+        jclass bytearray;
+        jobjectArray jresults;
+
+        count = (*env)->GetArrayLength(env, jbases);
+        if ((*env)->GetArrayLength(env, jexps) != count) {
+                (*env)->ThrowNew(env,
+                        (*env)->FindClass(env, "java/lang/IllegalArgumentException"),
+                        "bases and exponents differ in length");
+                return NULL;
+        }
+        bytearray = (*env)->FindClass(env, "[B");
+        jresults = (*env)->NewObjectArray(env, count, bytearray, NULL);
+        if (jresults == NULL)
+                return NULL; /* OutOfMemoryError pending */
+
+        convert_j2mp(env, jmod, &mmod);
+        if (mpz_sgn(mmod) <= 0) {
+                mpz_clear(mmod);
+                throw_arithmetic(env, "BigInteger: modulus not positive");
+                return NULL;
+        }
+        mpz_init2(mresult, mpz_size(mmod) * GMP_NUMB_BITS);
+        mpz_init(mbase);
+        mpz_init(mexp);
+
+        for (i = 0; i < count; i++) {
+                jbyteArray jbase = (*env)->GetObjectArrayElement(env, jbases, i);
+                jbyteArray jexp = (*env)->GetObjectArrayElement(env, jexps, i);
+                jbyteArray jresult;
+
+                import_j2mp(env, jbase, mbase);
+                import_j2mp(env, jexp, mexp);
+                mpz_powm(mresult, mbase, mexp, mmod);
+                convert_mp2j(env, mresult, &jresult);
+                (*env)->DeleteLocalRef(env, jbase);
+                (*env)->DeleteLocalRef(env, jexp);
+                if (jresult == NULL) {
+                        /* OutOfMemoryError pending, so no more JNI calls */
+                        jresults = NULL;
+                        break;
+                }
+                (*env)->SetObjectArrayElement(env, jresults, i, jresult);
+                (*env)->DeleteLocalRef(env, jresult);
+        }
+
+        mpz_clear(mbase);
+        mpz_clear(mexp);
+        mpz_clear(mmod);
+        mpz_clear(mresult);
+
+        return jresults;
+}
+
 /******** nativeDoubleValue() */
 /*
  * Class:     net_i2p_util_NativeBigInteger
@@ -84,6 +173,765 @@ JNIEXPORT jdouble JNICALL Java_net_i2p_util_NativeBigInteger_nativeDoubleValue
 		return retval;
 }
 
+/******** fixed base exponentiation */
+/*
+ * Precomputed tables for raising one base to many exponents modulo one
+ * modulus, with the fixed base comb method (Lim and Lee): the exponent
+ * is cut into TEETH rows of 'spacing' bits, and table[j] holds the product
+ * of base^(2^(r*spacing)) over the bits r that are set in j. A power then
+ * takes 'spacing' squarings and as many multiplications, against one
+ * squaring per exponent bit for mpz_powm(). The tables are only read after
+ * they are built, so that one context can be used by several threads.
+ */
+
+#define FIXED_BASE_TEETH 8
+
+struct fixed_base {
+        mpz_t base;
+        mpz_t mod;
+        size_t bits;    /* the longest exponent the table covers */
+        int teeth;
+        int spacing;
+        mpz_t *table;   /* 1 << teeth entries */
+};
+
+/* bits must not be negative, nor mod 0 */
+static struct fixed_base* fixed_base_new(mpz_t base, mpz_t mod, int bits)
+{
+        struct fixed_base* fb;
+        int r, s, j;
+
+        fb = malloc(sizeof(struct fixed_base));
+        if (fb == NULL)
+                return NULL;
+        fb->teeth = bits < FIXED_BASE_TEETH ? (bits > 0 ? bits : 1) : FIXED_BASE_TEETH;
+        fb->spacing = bits / fb->teeth + (bits % fb->teeth != 0);
+        fb->bits = (size_t)fb->teeth * fb->spacing;
+        fb->table = malloc(sizeof(mpz_t) << fb->teeth);
+        if (fb->table == NULL) {
+                free(fb);
+                return NULL;
+        }
+        mpz_init_set(fb->mod, mod);
+        mpz_init(fb->base);
+        mpz_mod(fb->base, base, mod);
+
+        /* table[1 << r] = base^(2^(r*spacing)) */
+        mpz_init_set_ui(fb->table[0], 1);
+        mpz_mod(fb->table[0], fb->table[0], mod);
+        mpz_init_set(fb->table[1], fb->base);
+        for (r = 1; r < fb->teeth; r++) {
+                mpz_init_set(fb->table[1 << r], fb->table[1 << (r - 1)]);
+                for (s = 0; s < fb->spacing; s++) {
+                        mpz_mul(fb->table[1 << r], fb->table[1 << r], fb->table[1 << r]);
+                        mpz_mod(fb->table[1 << r], fb->table[1 << r], mod);
+                }
+        }
+        /* and the products of those for the other entries */
+        for (j = 3; j < 1 << fb->teeth; j++) {
+                if ((j & (j - 1)) == 0)
+                        continue;
+                mpz_init(fb->table[j]);
+                mpz_mul(fb->table[j], fb->table[j & (j - 1)], fb->table[j & -j]);
+                mpz_mod(fb->table[j], fb->table[j], mod);
+        }
+        return fb;
+}
+
+static void fixed_base_free(struct fixed_base* fb)
+{
+        int j;
+
+        for (j = 0; j < 1 << fb->teeth; j++)
+                mpz_clear(fb->table[j]);
+        free(fb->table);
+        mpz_clear(fb->base);
+        mpz_clear(fb->mod);
+        free(fb);
+}
+
+/*
+ * result = base ^ exp % mod. Exponents longer than the table covers fall
+ * back to mpz_powm().
+ */
+static void fixed_base_powm(mpz_t result, struct fixed_base* fb, mpz_t exp)
+{
+        int col, r, j;
+
+        if (mpz_sgn(exp) < 0 || mpz_sizeinbase(exp, 2) > fb->bits) {
+                mpz_powm(result, fb->base, exp, fb->mod);
+                return;
+        }
+        mpz_set(result, fb->table[0]);
+        for (col = fb->spacing - 1; col >= 0; col--) {
+                mpz_mul(result, result, result);
+                mpz_mod(result, result, fb->mod);
+                j = 0;
+                for (r = 0; r < fb->teeth; r++)
+                        j |= mpz_tstbit(exp, r * fb->spacing + col) << r;
+                if (j != 0) {
+                        mpz_mul(result, result, fb->table[j]);
+                        mpz_mod(result, result, fb->mod);
+                }
+        }
+}
+
+/******** nativeCreateFixedBase() */
+/*
+ * Class:     net_i2p_util_NativeBigInteger
+ * Method:    nativeCreateFixedBase
+ * Signature: ([B[BI)J
+ *
+ * From the javadoc:
+ *
+ * Precompute the tables for raising base to exponents of up to expBits bits
+ * modulo modulus. The context must be released with nativeFreeFixedBase().
+ * @param base big endian twos complement representation of the base (but it must be positive)
+ * @param modulus big endian twos complement representation of the modulus
+ * @param expBits the length in bits of the longest exponent to be used
+ * @return a handle on the context, for nativeModPowFixedBase()
+ * @throws IllegalArgumentException if expBits is negative or modulus is not positive
+ */
+
+JNIEXPORT jlong JNICALL Java_net_i2p_util_NativeBigInteger_nativeCreateFixedBase
+        (JNIEnv* env, jclass cls, jbyteArray jbase, jbyteArray jmod, jint jbits) {
+
+        mpz_t mbase;
+        mpz_t mmod;
+        struct fixed_base* fb;
+
+        convert_j2mp(env, jbase, &mbase);
+        convert_j2mp(env, jmod,  &mmod);
+
+        if (jbits < 0 || mpz_sgn(mmod) <= 0) {
+                mpz_clear(mbase);
+                mpz_clear(mmod);
+                (*env)->ThrowNew(env,
+                        (*env)->FindClass(env, "java/lang/IllegalArgumentException"),
+                        "expBits must not be negative and modulus must be positive");
+                return 0;
+        }
+        fb = fixed_base_new(mbase, mmod, jbits);
+
+        mpz_clear(mbase);
+        mpz_clear(mmod);
+
+        if (fb == NULL) {
+                (*env)->ThrowNew(env,
+                        (*env)->FindClass(env, "java/lang/OutOfMemoryError"),
+                        "fixed base context");
+                return 0;
+        }
+        return (jlong)(size_t)fb;
+}
+
+/******** nativeModPowFixedBase() */
+/*
+ * Class:     net_i2p_util_NativeBigInteger
+ * Method:    nativeModPowFixedBase
+ * Signature: (J[B)[B
+ *
+ * From the javadoc:
+ *
+ * calculate (base ^ exponent) % modulus, for the base and modulus of a
+ * context from nativeCreateFixedBase().
+ * @param handle the context
+ * @param exponent big endian twos complement representation of the exponent
+ * @return big endian twos complement representation of (base ^ exponent) % modulus
+ */
+
+JNIEXPORT jbyteArray JNICALL Java_net_i2p_util_NativeBigInteger_nativeModPowFixedBase
+        (JNIEnv* env, jclass cls, jlong handle, jbyteArray jexp) {
+
+        struct fixed_base* fb = (struct fixed_base*)(size_t)handle;
+        mpz_t mexp;
+        mpz_t mresult;
+        jbyteArray jresult;
+
+        convert_j2mp(env, jexp, &mexp);
+        mpz_init2(mresult, 2 * mpz_size(fb->mod) * GMP_NUMB_BITS);
+
+        fixed_base_powm(mresult, fb, mexp);
+        convert_mp2j(env, mresult, &jresult);
+
+        mpz_clear(mexp);
+        mpz_clear(mresult);
+
+        return jresult;
+}
+
+/******** nativeFreeFixedBase() */
+/*
+ * Class:     net_i2p_util_NativeBigInteger
+ * Method:    nativeFreeFixedBase
+ * Signature: (J)V
+ *
+ * From the javadoc:
+ *
+ * Release a context from nativeCreateFixedBase(). The handle must not be
+ * used again.
+ * @param handle the context
+ */
+
+JNIEXPORT void JNICALL Java_net_i2p_util_NativeBigInteger_nativeFreeFixedBase
+        (JNIEnv* env, jclass cls, jlong handle) {
+
+        if (handle != 0)
+                fixed_base_free((struct fixed_base*)(size_t)handle);
+}
+
+/******** secret exponentiation */
+/*
+ * A private exponent and its modulus, imported once and kept on the native
+ * side, for exponentiations with mpz_powm_sec(): its running time and
+ * memory accesses do not depend on the exponent, unlike those of
+ * mpz_powm(), so that it can be used with private keys. GMP puts the base
+ * into Montgomery form itself on each call. mpz_powm_sec() needs an odd
+ * modulus and a positive exponent.
+ */
+
+struct secret_exp {
+        mpz_t exp;
+        mpz_t mod;
+};
+
+/*
+ * Overwrites the exponent before its memory is given back, so that it does
+ * not linger in the heap.
+ */
+static void secret_exp_free(struct secret_exp* se)
+{
+        memset(se->exp->_mp_d, 0, se->exp->_mp_alloc * sizeof(mp_limb_t));
+        mpz_clear(se->exp);
+        mpz_clear(se->mod);
+        free(se);
+}
+
+/******** nativeCreateSecretExponent() */
+/*
+ * Class:     net_i2p_util_NativeBigInteger
+ * Method:    nativeCreateSecretExponent
+ * Signature: ([B[B)J
+ *
+ * From the javadoc:
+ *
+ * Keep a private exponent and a modulus on the native side, for
+ * nativeModPowSecret(). The context must be released with
+ * nativeFreeSecretExponent(), which also erases the exponent.
+ * @param exponent big endian twos complement representation of the exponent (must be positive)
+ * @param modulus big endian twos complement representation of the modulus (must be odd)
+ * @return a handle on the context
+ */
+
+JNIEXPORT jlong JNICALL Java_net_i2p_util_NativeBigInteger_nativeCreateSecretExponent
+        (JNIEnv* env, jclass cls, jbyteArray jexp, jbyteArray jmod) {
+
+        struct secret_exp* se;
+
+        se = malloc(sizeof(struct secret_exp));
+        if (se == NULL) {
+                (*env)->ThrowNew(env,
+                        (*env)->FindClass(env, "java/lang/OutOfMemoryError"),
+                        "secret exponent context");
+                return 0;
+        }
+        /* straight into the context, so that no copy of the exponent is left behind */
+        convert_j2mp(env, jexp, &se->exp);
+        convert_j2mp(env, jmod, &se->mod);
+
+        if (mpz_sgn(se->exp) <= 0 || mpz_even_p(se->mod)) {
+                secret_exp_free(se);
+                (*env)->ThrowNew(env,
+                        (*env)->FindClass(env, "java/lang/IllegalArgumentException"),
+                        "exponent must be positive and modulus odd");
+                return 0;
+        }
+        return (jlong)(size_t)se;
+}
+
+/******** nativeModPowSecret() */
+/*
+ * Class:     net_i2p_util_NativeBigInteger
+ * Method:    nativeModPowSecret
+ * Signature: (J[B)[B
+ *
+ * From the javadoc:
+ *
+ * calculate (base ^ exponent) % modulus in constant time, for the exponent
+ * and modulus of a context from nativeCreateSecretExponent().
+ * @param handle the context
+ * @param base big endian twos complement representation of the base (but it must be positive)
+ * @return big endian twos complement representation of (base ^ exponent) % modulus
+ */
+
+JNIEXPORT jbyteArray JNICALL Java_net_i2p_util_NativeBigInteger_nativeModPowSecret
+        (JNIEnv* env, jclass cls, jlong handle, jbyteArray jbase) {
+
+        struct secret_exp* se = (struct secret_exp*)(size_t)handle;
+        mpz_t mbase;
+        mpz_t mresult;
+        jbyteArray jresult;
+
+        convert_j2mp(env, jbase, &mbase);
+        mpz_init2(mresult, mpz_size(se->mod) * GMP_NUMB_BITS);
+
+        mpz_powm_sec(mresult, mbase, se->exp, se->mod);
+        convert_mp2j(env, mresult, &jresult);
+
+        mpz_clear(mbase);
+        mpz_clear(mresult);
+
+        return jresult;
+}
+
+/******** nativeFreeSecretExponent() */
+/*
+ * Class:     net_i2p_util_NativeBigInteger
+ * Method:    nativeFreeSecretExponent
+ * Signature: (J)V
+ *
+ * From the javadoc:
+ *
+ * Erase and release a context from nativeCreateSecretExponent(). The handle
+ * must not be used again.
+ * @param handle the context
+ */
+
+JNIEXPORT void JNICALL Java_net_i2p_util_NativeBigInteger_nativeFreeSecretExponent
+        (JNIEnv* env, jclass cls, jlong handle) {
+
+        if (handle != 0)
+                secret_exp_free((struct secret_exp*)(size_t)handle);
+}
+
+/******** native values */
+/*
+ * Values that stay on the native side between operations, so that a chain
+ * such as a modPow whose result is multiplied and reduced again is only
+ * converted from and to the Java form at its ends. A handle is a pointer
+ * to an mpz_t of its own. The operations write their result into a
+ * destination handle, which may be one of the operands, as GMP does, so
+ * that a loop can reuse its values instead of allocating new ones.
+ * Values are never negative, as in the other methods here.
+ */
+
+#define VALUE(handle) (*(mpz_t*)(size_t)(handle))
+
+static void throw_arithmetic(JNIEnv* env, const char* msg)
+{
+        (*env)->ThrowNew(env,
+                (*env)->FindClass(env, "java/lang/ArithmeticException"), msg);
+}
+
+/******** nativeCreateValue() */
+/*
+ * Class:     net_i2p_util_NativeBigInteger
+ * Method:    nativeCreateValue
+ * Signature: ([B)J
+ *
+ * From the javadoc:
+ *
+ * Import a value to the native side. It must be released with
+ * nativeFreeValue().
+ * @param value big endian twos complement representation of the value (but it must be positive), or null for 0
+ * @return a handle on the value
+ */
+
+JNIEXPORT jlong JNICALL Java_net_i2p_util_NativeBigInteger_nativeCreateValue
+        (JNIEnv* env, jclass cls, jbyteArray jvalue) {
+
+        mpz_t* mvalue;
+
+        mvalue = malloc(sizeof(mpz_t));
+        if (mvalue == NULL) {
+                (*env)->ThrowNew(env,
+                        (*env)->FindClass(env, "java/lang/OutOfMemoryError"),
+                        "native value");
+                return 0;
+        }
+        if (jvalue != NULL)
+                convert_j2mp(env, jvalue, mvalue);
+        else
+                mpz_init(*mvalue);
+        return (jlong)(size_t)mvalue;
+}
+
+/******** nativeExportValue() */
+/*
+ * Class:     net_i2p_util_NativeBigInteger
+ * Method:    nativeExportValue
+ * Signature: (J)[B
+ *
+ * From the javadoc:
+ *
+ * @param handle a native value
+ * @return big endian twos complement representation of the value
+ */
+
+JNIEXPORT jbyteArray JNICALL Java_net_i2p_util_NativeBigInteger_nativeExportValue
+        (JNIEnv* env, jclass cls, jlong handle) {
+
+        jbyteArray jresult;
+
+        convert_mp2j(env, VALUE(handle), &jresult);
+        return jresult;
+}
+
+/******** nativeFreeValue() */
+/*
+ * Class:     net_i2p_util_NativeBigInteger
+ * Method:    nativeFreeValue
+ * Signature: (J)V
+ *
+ * From the javadoc:
+ *
+ * Release a value from nativeCreateValue(). The handle must not be used
+ * again.
+ * @param handle a native value
+ */
+
+JNIEXPORT void JNICALL Java_net_i2p_util_NativeBigInteger_nativeFreeValue
+        (JNIEnv* env, jclass cls, jlong handle) {
+
+        if (handle != 0) {
+                mpz_clear(VALUE(handle));
+                free((void*)(size_t)handle);
+        }
+}
+
+/******** nativeMulValues() */
+/*
+ * Class:     net_i2p_util_NativeBigInteger
+ * Method:    nativeMulValues
+ * Signature: (JJJ)V
+ *
+ * From the javadoc:
+ *
+ * dst = a * b
+ * @param dst the native value for the result, which may be a or b
+ */
+
+JNIEXPORT void JNICALL Java_net_i2p_util_NativeBigInteger_nativeMulValues
+        (JNIEnv* env, jclass cls, jlong dst, jlong a, jlong b) {
+
+        mpz_mul(VALUE(dst), VALUE(a), VALUE(b));
+}
+
+/******** nativeModValue() */
+/*
+ * Class:     net_i2p_util_NativeBigInteger
+ * Method:    nativeModValue
+ * Signature: (JJJ)V
+ *
+ * From the javadoc:
+ *
+ * dst = a % modulus
+ * @param dst the native value for the result, which may be a or modulus
+ * @throws ArithmeticException if the modulus is 0
+ */
+
+JNIEXPORT void JNICALL Java_net_i2p_util_NativeBigInteger_nativeModValue
+        (JNIEnv* env, jclass cls, jlong dst, jlong a, jlong mod) {
+
+        if (mpz_sgn(VALUE(mod)) == 0) {
+                throw_arithmetic(env, "BigInteger: modulus not positive");
+                return;
+        }
+        mpz_mod(VALUE(dst), VALUE(a), VALUE(mod));
+}
+
+/******** nativeModPowValues() */
+/*
+ * Class:     net_i2p_util_NativeBigInteger
+ * Method:    nativeModPowValues
+ * Signature: (JJJJ)V
+ *
+ * From the javadoc:
+ *
+ * dst = (base ^ exponent) % modulus
+ * @param dst the native value for the result, which may be any of the others
+ * @throws ArithmeticException if the modulus is 0
+ */
+
+JNIEXPORT void JNICALL Java_net_i2p_util_NativeBigInteger_nativeModPowValues
+        (JNIEnv* env, jclass cls, jlong dst, jlong base, jlong exp, jlong mod) {
+
+        if (mpz_sgn(VALUE(mod)) == 0) {
+                throw_arithmetic(env, "BigInteger: modulus not positive");
+                return;
+        }
+        mpz_powm(VALUE(dst), VALUE(base), VALUE(exp), VALUE(mod));
+}
+
+/******** nativeModInverseValue() */
+/*
+ * Class:     net_i2p_util_NativeBigInteger
+ * Method:    nativeModInverseValue
+ * Signature: (JJJ)V
+ *
+ * From the javadoc:
+ *
+ * dst = a^-1 % modulus
+ * @param dst the native value for the result, which may be a or modulus;
+ * it is left alone if this throws
+ * @throws ArithmeticException if the modulus is 0 or a has no inverse
+ */
+
+JNIEXPORT void JNICALL Java_net_i2p_util_NativeBigInteger_nativeModInverseValue
+        (JNIEnv* env, jclass cls, jlong dst, jlong a, jlong mod) {
+
+        mpz_t inv;
+
+        if (mpz_sgn(VALUE(mod)) == 0) {
+                throw_arithmetic(env, "BigInteger: modulus not positive");
+                return;
+        }
+        /* GMP leaves the result undefined when there is no inverse, so it
+         * is only moved to dst, which may be an operand, on success */
+        mpz_init(inv);
+        if (mpz_invert(inv, VALUE(a), VALUE(mod)))
+                mpz_swap(VALUE(dst), inv);
+        else
+                throw_arithmetic(env, "BigInteger not invertible.");
+        mpz_clear(inv);
+}
+
+/******** multi-exponentiation */
+/*
+ * Products of powers, (b[0]^e[0] * b[1]^e[1] * ...) % m, with Straus'
+ * method: the exponents are scanned together a window of bits at a time,
+ * so that the squarings are shared by all terms instead of done once for
+ * each. That alone leaves little to gain over separate mpz_powm() calls if
+ * each step is a mpz_mul() and a mpz_mod(), as GMP reduces with Montgomery
+ * (REDC) inside mpz_powm(), which costs about as much as a multiplication
+ * where mpz_mod() costs two. So for an odd modulus the values are kept in
+ * Montgomery form at the mpn level, as in mpz_powm(); an even one falls
+ * back to separate mpz_powm() calls.
+ */
+
+struct montgomery {
+        mp_size_t n;            /* limbs in the modulus */
+        mp_limb_t* m;           /* the modulus */
+        mp_limb_t minv;         /* -1/m mod 2^GMP_NUMB_BITS */
+        mp_limb_t* t;           /* 2n limbs of scratch */
+};
+
+/*
+ * r = t * 2^(-n*GMP_NUMB_BITS) mod m, for the 2n limbs t of mg, which are
+ * overwritten. r is less than 2^(n*GMP_NUMB_BITS) but not always less than m.
+ */
+static void mont_redc(struct montgomery* mg, mp_limb_t* r)
+{
+        mp_limb_t* up = mg->t;
+        mp_size_t j;
+
+        for (j = 0; j < mg->n; j++) {
+                /* clears up[0], and keeps the carry out of the top there */
+                up[0] = mpn_addmul_1(up, mg->m, mg->n, up[0] * mg->minv);
+                up++;
+        }
+        if (mpn_add_n(r, up, up - mg->n, mg->n))
+                mpn_sub_n(r, r, mg->m, mg->n);
+}
+
+/* r = a * b / 2^(n*GMP_NUMB_BITS) mod m; r may be a or b */
+static void mont_mul(struct montgomery* mg, mp_limb_t* r,
+        const mp_limb_t* a, const mp_limb_t* b)
+{
+        if (a == b)
+                mpn_sqr(mg->t, a, mg->n);
+        else
+                mpn_mul_n(mg->t, a, b, mg->n);
+        mont_redc(mg, r);
+}
+
+/* r = v * 2^(n*GMP_NUMB_BITS) mod m, in n limbs; x is scratch */
+static void mont_from_mpz(struct montgomery* mg, mp_limb_t* r, mpz_t v,
+        mpz_t m, mpz_t x)
+{
+        mp_size_t i;
+
+        mpz_mul_2exp(x, v, mg->n * GMP_NUMB_BITS);
+        mpz_mod(x, x, m);
+        for (i = 0; i < mg->n; i++)
+                r[i] = mpz_getlimbn(x, i);
+}
+
+/* 0, or -1 if out of memory; mod must be positive */
+static int multi_powm(mpz_t result, int count, mpz_t* bases, mpz_t* exps,
+        mpz_t mod)
+{
+        struct montgomery mg;
+        mp_limb_t* table;       /* b[i]^d in Montgomery form at (i*size + d)*n */
+        mp_limb_t* acc;
+        mp_limb_t inv;
+        mpz_t x;
+        size_t bits;
+        int size, window, windows, i, j, k, d;
+
+        if (mpz_even_p(mod)) {
+                mpz_set_ui(result, 1);
+                mpz_init(x);
+                for (i = 0; i < count; i++) {
+                        mpz_powm(x, bases[i], exps[i], mod);
+                        mpz_mul(result, result, x);
+                        mpz_mod(result, result, mod);
+                }
+                mpz_mod(result, result, mod);
+                mpz_clear(x);
+                return 0;
+        }
+
+        bits = 0;
+        for (i = 0; i < count; i++)
+                if (mpz_sizeinbase(exps[i], 2) > bits)
+                        bits = mpz_sizeinbase(exps[i], 2);
+        window = bits > 512 ? 5 : 4;
+        size = 1 << window;
+        windows = (bits + window - 1) / window;
+
+        mg.n = mpz_size(mod);
+        mg.m = malloc(mg.n * sizeof(mp_limb_t));
+        mg.t = malloc(2 * mg.n * sizeof(mp_limb_t));
+        table = malloc((size_t)count * size * mg.n * sizeof(mp_limb_t));
+        acc = malloc(mg.n * sizeof(mp_limb_t));
+        if (mg.m == NULL || mg.t == NULL || table == NULL || acc == NULL) {
+                free(acc);
+                free(table);
+                free(mg.t);
+                free(mg.m);
+                return -1;
+        }
+        for (j = 0; j < mg.n; j++)
+                mg.m[j] = mpz_getlimbn(mod, j);
+        /* Newton's iteration doubles the bits of the inverse that are right,
+         * from the 3 of m itself */
+        inv = mg.m[0];
+        for (j = 3; j < GMP_NUMB_BITS; j *= 2)
+                inv *= 2 - mg.m[0] * inv;
+        mg.minv = -inv;
+
+        mpz_init_set_ui(x, 1);
+        mont_from_mpz(&mg, acc, x, mod, x);
+        for (i = 0; i < count; i++) {
+                mp_limb_t* row = table + (size_t)i * size * mg.n;
+
+                mpn_copyi(row, acc, mg.n);
+                mont_from_mpz(&mg, row + mg.n, bases[i], mod, x);
+                for (d = 2; d < size; d++)
+                        mont_mul(&mg, row + d * mg.n, row + (d - 1) * mg.n, row + mg.n);
+        }
+
+        for (k = windows - 1; k >= 0; k--) {
+                if (k != windows - 1)
+                        for (j = 0; j < window; j++)
+                                mont_mul(&mg, acc, acc, acc);
+                for (i = 0; i < count; i++) {
+                        d = 0;
+                        for (j = window - 1; j >= 0; j--)
+                                d = d << 1 | mpz_tstbit(exps[i], k * window + j);
+                        if (d != 0)
+                                mont_mul(&mg, acc, acc, table + ((size_t)i * size + d) * mg.n);
+                }
+        }
+
+        /* out of Montgomery form */
+        mpn_copyi(mg.t, acc, mg.n);
+        mpn_zero(mg.t + mg.n, mg.n);
+        mont_redc(&mg, acc);
+        mpz_import(result, mg.n, -1, sizeof(mp_limb_t), 0, 0, acc);
+        mpz_mod(result, result, mod);
+
+        mpz_clear(x);
+        free(acc);
+        free(table);
+        free(mg.t);
+        free(mg.m);
+        return 0;
+}
+
+/******** nativeMultiModPow() */
+/*
+ * Class:     net_i2p_util_NativeBigInteger
+ * Method:    nativeMultiModPow
+ * Signature: ([[B[[B[B)[B
+ *
+ * From the javadoc:
+ *
+ * calculate (bases[0] ^ exponents[0] * bases[1] ^ exponents[1] * ...) % modulus
+ * in one pass, which for two or three terms is about 1.5 to 2 times as fast
+ * as separate modPows.
+ * @param bases big endian twos complement representations of the bases (but they must be positive)
+ * @param exponents big endian twos complement representations of the exponents, as many as bases
+ * @param modulus big endian twos complement representation of the modulus
+ * @return big endian twos complement representation of the product
+ * @throws ArithmeticException if the modulus is 0
+ */
+
+JNIEXPORT jbyteArray JNICALL Java_net_i2p_util_NativeBigInteger_nativeMultiModPow
+        (JNIEnv* env, jclass cls, jobjectArray jbases, jobjectArray jexps, jbyteArray jmod) {
+
+        mpz_t* mbases;
+        mpz_t* mexps;
+        mpz_t mmod;
+        mpz_t mresult;
+        jsize count;
+        jsize i;
+        jbyteArray jresult;
+
+        count = (*env)->GetArrayLength(env, jbases);
+        if ((*env)->GetArrayLength(env, jexps) != count) {
+                (*env)->ThrowNew(env,
+                        (*env)->FindClass(env, "java/lang/IllegalArgumentException"),
+                        "bases and exponents differ in length");
+                return NULL;
+        }
+        mbases = malloc((count + 1) * sizeof(mpz_t));
+        mexps = malloc((count + 1) * sizeof(mpz_t));
+        if (mbases == NULL || mexps == NULL) {
+                free(mbases);
+                free(mexps);
+                (*env)->ThrowNew(env,
+                        (*env)->FindClass(env, "java/lang/OutOfMemoryError"),
+                        "multi-exponentiation");
+                return NULL;
+        }
+
+        for (i = 0; i < count; i++) {
+                jbyteArray jbase = (*env)->GetObjectArrayElement(env, jbases, i);
+                jbyteArray jexp = (*env)->GetObjectArrayElement(env, jexps, i);
+
+                convert_j2mp(env, jbase, &mbases[i]);
+                convert_j2mp(env, jexp, &mexps[i]);
+                (*env)->DeleteLocalRef(env, jbase);
+                (*env)->DeleteLocalRef(env, jexp);
+        }
+        convert_j2mp(env, jmod, &mmod);
+        mpz_init2(mresult, mpz_size(mmod) * GMP_NUMB_BITS);
+
+        if (mpz_sgn(mmod) <= 0) {
+                throw_arithmetic(env, "BigInteger: modulus not positive");
+                jresult = NULL;
+        } else if (multi_powm(mresult, count, mbases, mexps, mmod) != 0) {
+                (*env)->ThrowNew(env,
+                        (*env)->FindClass(env, "java/lang/OutOfMemoryError"),
+                        "multi-exponentiation");
+                jresult = NULL;
+        } else
+                convert_mp2j(env, mresult, &jresult);
+
+        for (i = 0; i < count; i++) {
+                mpz_clear(mbases[i]);
+                mpz_clear(mexps[i]);
+        }
+        free(mbases);
+        free(mexps);
+        mpz_clear(mmod);
+        mpz_clear(mresult);
+
+        return jresult;
+}
+
 /******************************
  *****Conversion methods*******
  ******************************/
@@ -100,15 +948,30 @@ JNIEXPORT jdouble JNICALL Java_net_i2p_util_NativeBigInteger_nativeDoubleValue
  */
 
 void convert_j2mp(JNIEnv* env, jbyteArray jvalue, mpz_t* mvalue)
+{
+        jsize size;
+
+        size = (*env)->GetArrayLength(env, jvalue);
+        mpz_init2(*mvalue, sizeof(jbyte) * 8 * size); //preallocate the size
+        import_j2mp(env, jvalue, *mvalue);
+}
+
+/******** import_j2mp() */
+/*
+ * Converts the Java value into the GMP value, which must already be
+ * initialized; it is grown if it is too small. The array is accessed with
+ * GetPrimitiveArrayCritical(), as mpz_import() makes no JNI calls, so that
+ * the VM can hand us its own copy rather than making another one.
+ */
+
+void import_j2mp(JNIEnv* env, jbyteArray jvalue, mpz_t mvalue)
 {
         jsize size;
         jbyte* jbuffer;
 		//int sign;
 
         size = (*env)->GetArrayLength(env, jvalue);
-        jbuffer = (*env)->GetByteArrayElements(env, jvalue, NULL);
-
-        mpz_init2(*mvalue, sizeof(jbyte) * 8 * size); //preallocate the size
+        jbuffer = (*env)->GetPrimitiveArrayCritical(env, jvalue, NULL);
 
         /* void mpz_import(
          *   mpz_t rop, size_t count, int order, int size, int endian,
@@ -124,21 +987,22 @@ void convert_j2mp(JNIEnv* env, jbyteArray jvalue, mpz_t* mvalue)
          *   The most significant nails bits of each word are skipped, this can
          *   be 0 to use the full words.
          */
-        mpz_import(*mvalue, size, 1, sizeof(jbyte), 1, 0, (void*)jbuffer);
+        mpz_import(mvalue, size, 1, sizeof(jbyte), 1, 0, (void*)jbuffer);
 		/*Uncomment this to support negative integer values,
 		not tested though..
 		sign = jbuffer[0] < 0?-1:1;
 		if(sign == -1)
-			mpz_neg(*mvalue,*mvalue);
+			mpz_neg(mvalue,mvalue);
 		*/
-        (*env)->ReleaseByteArrayElements(env, jvalue, jbuffer, JNI_ABORT);
+        (*env)->ReleasePrimitiveArrayCritical(env, jvalue, jbuffer, JNI_ABORT);
 }
 
 /******** convert_mp2j() */
 /*
  * Converts the GMP value into the Java value; Doesn't do anything else.
  * Pads the resulting jbyte array with 0, so the twos complement value is always
- * positive.
+ * positive. The new array is filled through GetPrimitiveArrayCritical(), as
+ * mpz_export() makes no JNI calls, so that it is not copied twice.
  */
 
 void convert_mp2j(JNIEnv* env, mpz_t mvalue, jbyteArray* jvalue)
@@ -147,16 +1011,15 @@ void convert_mp2j(JNIEnv* env, mpz_t mvalue, jbyteArray* jvalue)
         // elsewhere, and/or adjust memory alloc sizes?)
         size_t size; 
         jbyte* buffer;
-        jboolean copy;
 		//int i;
 
-        copy = JNI_FALSE;
-
         /* sizeinbase() + 7 => Ceil division */
         size = (mpz_sizeinbase(mvalue, 2) + 7) / 8 + sizeof(jbyte);
         *jvalue = (*env)->NewByteArray(env, size);
+        if (*jvalue == NULL)
+                return; /* OutOfMemoryError pending */
 
-        buffer = (*env)->GetByteArrayElements(env, *jvalue, &copy);
+        buffer = (*env)->GetPrimitiveArrayCritical(env, *jvalue, NULL);
         buffer[0] = 0x00;
 		//Uncomment the comments below to support negative integer values,
 		//not very well-tested though..
@@ -170,11 +1033,7 @@ void convert_mp2j(JNIEnv* env, mpz_t mvalue, jbyteArray* jvalue)
 		//	}
 		//}
 
-		/* mode has (supposedly) no effect if elems is not a copy of the
-         * elements in array
-         */
-        (*env)->ReleaseByteArrayElements(env, *jvalue, buffer, 0);
-        //mode has (supposedly) no effect if elems is not a copy of the elements in array
+        (*env)->ReleasePrimitiveArrayCritical(env, *jvalue, buffer, 0);
 }
 
 /******** eof */
@@ -0,0 +1,423 @@
+/*
+ * jbigibench.c -- times the modPow paths of jbigi against each other
+ *
+ * For each modulus size, with a full length private exponent, compares
+ *
+ *   modpow   what nativeModPow() does: convert base, exponent and modulus
+ *            from the Java byte array form, mpz_powm(), convert back
+ *   secret   what nativeModPowSecret() does: the exponent and modulus are
+ *            already native, convert the base, mpz_powm_sec(), convert back
+ *   powm     mpz_powm() alone, on native operands
+ *   powm_sec mpz_powm_sec() alone, on native operands
+ *
+ * so that the cost of the conversions and that of the constant time
+ * exponentiation can be told apart. Each result of the secret path is
+ * checked against mpz_powm() before anything is timed. The JNI glue is not
+ * run, as there is no VM; the conversions are done the way convert_j2mp()
+ * and convert_mp2j() do them.
+ *
+ * A second table compares mpz_powm() with fixed_base_powm(), the comb of
+ * nativeModPowFixedBase(), for a short exponent, a full length one and
+ * one longer than the comb covers (which falls back to mpz_powm()).
+ * Before that, fixed_base_powm() is checked against mpz_powm() for every
+ * exponent length around the ends of a few comb lengths, from a zero
+ * exponent to one 70 bits too long.
+ *
+ * A third table compares multi_powm(), the simultaneous exponentiation of
+ * nativeMultiModPow(), with as many mpz_powm() calls and products, for 2
+ * to MAX_TERMS full length exponents. Before that, multi_powm() is
+ * checked against those for odd and even moduli of many lengths, from 0
+ * to MAX_TERMS terms, with zero bases and exponents among them.
+ *
+ * Build from a GMP build directory, like build_jbigi.sh does, with
+ *
+ *   gcc -O2 -I../../jbigi/include -I$JAVA_HOME/include \
+ *       -I$JAVA_HOME/include/linux -o jbigibench \
+ *       ../../jbigi/src/jbigibench.c .libs/libgmp.a
+ *
+ * usage: jbigibench [ms]   where ms is how long to run each case for
+ * (default 500).
+ */
+
+#include <sys/time.h>
+#include "jbigi.c"
+
+static const int mod_bits[] = { 1024, 2048, 3072, 0 };
+
+/* the exponent of a short exponent case, such as a DSA or ElGamal key */
+#define SHORT_EXP_BITS 160
+
+#define MAX_TERMS 4
+
+static double now(void)
+{
+        struct timeval tv;
+
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* A value in the form BigInteger.toByteArray() gives, with its leading 0. */
+struct jvalue {
+        size_t size;
+        unsigned char* bytes;
+};
+
+static void to_java(struct jvalue* j, mpz_t v)
+{
+        size_t size;
+
+        size = (mpz_sizeinbase(v, 2) + 7) / 8 + 1;
+        j->bytes = malloc(size);
+        j->bytes[0] = 0;
+        mpz_export(&j->bytes[1], &j->size, 1, 1, 1, 0, v);
+        j->size++;
+}
+
+static void from_java(mpz_t v, struct jvalue* j)
+{
+        mpz_init2(v, 8 * j->size);
+        mpz_import(v, j->size, 1, 1, 1, 0, j->bytes);
+}
+
+/* The byte array round trip of a result, as convert_mp2j() does it. */
+static void round_trip(mpz_t v)
+{
+        struct jvalue j;
+
+        to_java(&j, v);
+        free(j.bytes);
+}
+
+/* The operands of a case of the second or third table. */
+struct bench_case {
+        mpz_t result, base, exp, mod;
+        struct fixed_base* fb;
+        int count;
+        mpz_t bases[MAX_TERMS];
+        mpz_t exps[MAX_TERMS];
+};
+
+static void run_powm(struct bench_case* c)
+{
+        mpz_powm(c->result, c->base, c->exp, c->mod);
+}
+
+static void run_fixed_base(struct bench_case* c)
+{
+        fixed_base_powm(c->result, c->fb, c->exp);
+}
+
+/* what nativeMultiModPow() saves: a power at a time, and their product */
+static void run_powms(struct bench_case* c)
+{
+        int i;
+
+        mpz_set_ui(c->result, 1);
+        for (i = 0; i < c->count; i++) {
+                mpz_powm(c->exp, c->bases[i], c->exps[i], c->mod);
+                mpz_mul(c->result, c->result, c->exp);
+                mpz_mod(c->result, c->result, c->mod);
+        }
+        mpz_mod(c->result, c->result, c->mod);
+}
+
+static void run_multi(struct bench_case* c)
+{
+        if (multi_powm(c->result, c->count, c->bases, c->exps, c->mod) != 0) {
+                fprintf(stderr, "jbigibench: out of memory\n");
+                exit(1);
+        }
+}
+
+/* Microseconds per run(), once to warm up, then for real. */
+static double time_us(void (*run)(struct bench_case*), struct bench_case* c,
+                      double ms)
+{
+        double start, end, t;
+        long n;
+        int pass;
+
+        for (pass = 0; pass < 2; pass++) {
+                start = now();
+                end = start + (pass == 0 ? ms / 5 : ms) / 1000;
+                n = 0;
+                do {
+                        run(c);
+                        n++;
+                } while ((t = now()) < end);
+        }
+        return (t - start) * 1e6 / n;
+}
+
+/*
+ * Checks fixed_base_powm() with a comb of the given length against
+ * mpz_powm(), for exponents of every length near 0 and near the end of the
+ * comb and of some lengths between. Returns the number of differences.
+ */
+static int check_fixed_base(gmp_randstate_t rand, mpz_t base, mpz_t mod,
+                            int bits)
+{
+        struct fixed_base* fb;
+        mpz_t exp, result, check;
+        int len, bad = 0;
+
+        fb = fixed_base_new(base, mod, bits);
+        if (fb == NULL) {
+                fprintf(stderr, "jbigibench: out of memory\n");
+                exit(1);
+        }
+        mpz_init(exp);
+        mpz_init(result);
+        mpz_init(check);
+        for (len = 0; len <= bits + 70; len += len < 16 || len >= bits - 16 ? 1 : 37) {
+                mpz_urandomb(exp, rand, len);
+                if (len > 0)
+                        mpz_setbit(exp, len - 1);
+                fixed_base_powm(result, fb, exp);
+                mpz_powm(check, base, exp, mod);
+                if (mpz_cmp(result, check) != 0) {
+                        fprintf(stderr, "jbigibench: fixed_base_powm() differs for a %d bit "
+                                "exponent and a %d bit comb\n", len, bits);
+                        bad++;
+                }
+        }
+        mpz_clear(exp);
+        mpz_clear(result);
+        mpz_clear(check);
+        fixed_base_free(fb);
+        return bad;
+}
+
+/*
+ * Checks multi_powm() against run_powms() for 300 sets of operands, with
+ * moduli of 1 to 3000 bits, odd and even, 0 to MAX_TERMS terms, bases
+ * longer than the modulus, and zero bases and exponents. Returns the
+ * number of differences.
+ */
+static int check_multi_powm(gmp_randstate_t rand)
+{
+        struct bench_case c;
+        mpz_t check;
+        int t, i, bits, bad = 0;
+
+        mpz_init(c.mod);
+        mpz_init(c.exp);
+        mpz_init(c.result);
+        mpz_init(check);
+        for (i = 0; i < MAX_TERMS; i++) {
+                mpz_init(c.bases[i]);
+                mpz_init(c.exps[i]);
+        }
+        for (t = 0; t < 300; t++) {
+                bits = 1 + t * 10;
+                mpz_urandomb(c.mod, rand, bits);
+                mpz_setbit(c.mod, bits - 1);
+                if (t % 3 != 0)
+                        mpz_setbit(c.mod, 0);
+                c.count = t % (MAX_TERMS + 1);
+                for (i = 0; i < c.count; i++) {
+                        mpz_urandomb(c.bases[i], rand, bits + (i * 17) % 70);
+                        mpz_urandomb(c.exps[i], rand, (t * 31 + i) % 1500);
+                        if (t % 11 == 0 && i == 0)
+                                mpz_set_ui(c.bases[i], 0);
+                        if (t % 13 == 0)
+                                mpz_set_ui(c.exps[i], 0);
+                }
+                run_powms(&c);
+                mpz_set(check, c.result);
+                run_multi(&c);
+                if (mpz_cmp(c.result, check) != 0) {
+                        fprintf(stderr, "jbigibench: multi_powm() differs for %d terms "
+                                "modulo %d bits\n", c.count, bits);
+                        bad++;
+                }
+        }
+        for (i = 0; i < MAX_TERMS; i++) {
+                mpz_clear(c.bases[i]);
+                mpz_clear(c.exps[i]);
+        }
+        mpz_clear(c.mod);
+        mpz_clear(c.exp);
+        mpz_clear(c.result);
+        mpz_clear(check);
+        return bad;
+}
+
+int main(int argc, char* argv[])
+{
+        gmp_randstate_t rand;
+        double ms = argc > 1 ? atof(argv[1]) : 500;
+        int m, path;
+
+        gmp_randinit_default(rand);
+        printf("mod_bits,modpow_us,secret_us,powm_us,powm_sec_us\n");
+        for (m = 0; mod_bits[m] != 0; m++) {
+                struct secret_exp se;
+                struct jvalue jbase, jexp, jmod;
+                mpz_t base, result, check;
+                double us[4];
+
+                mpz_init(se.mod);
+                mpz_init(se.exp);
+                mpz_urandomb(se.mod, rand, mod_bits[m]);
+                mpz_setbit(se.mod, mod_bits[m] - 1);
+                mpz_setbit(se.mod, 0);
+                mpz_urandomb(se.exp, rand, mod_bits[m]);
+                mpz_setbit(se.exp, mod_bits[m] - 1);
+                mpz_init(base);
+                mpz_urandomb(base, rand, mod_bits[m] - 1);
+                mpz_init(result);
+                mpz_init(check);
+                to_java(&jbase, base);
+                to_java(&jexp, se.exp);
+                to_java(&jmod, se.mod);
+
+                mpz_powm_sec(result, base, se.exp, se.mod);
+                mpz_powm(check, base, se.exp, se.mod);
+                if (mpz_cmp(result, check) != 0) {
+                        fprintf(stderr, "jbigibench: mpz_powm_sec() differs at %d bits\n",
+                                mod_bits[m]);
+                        return 1;
+                }
+
+                /* once to warm up, then for real */
+                for (path = 0; path < 8; path++) {
+                        double start = now(), t;
+                        double end = start + (path < 4 ? ms / 5 : ms) / 1000;
+                        long n = 0;
+
+                        do {
+                                mpz_t b, e, mod;
+
+                                switch (path % 4) {
+                                case 0:
+                                        from_java(b, &jbase);
+                                        from_java(e, &jexp);
+                                        from_java(mod, &jmod);
+                                        mpz_powm(result, b, e, mod);
+                                        round_trip(result);
+                                        mpz_clear(b);
+                                        mpz_clear(e);
+                                        mpz_clear(mod);
+                                        break;
+                                case 1:
+                                        from_java(b, &jbase);
+                                        mpz_powm_sec(result, b, se.exp, se.mod);
+                                        round_trip(result);
+                                        mpz_clear(b);
+                                        break;
+                                case 2:
+                                        mpz_powm(result, base, se.exp, se.mod);
+                                        break;
+                                case 3:
+                                        mpz_powm_sec(result, base, se.exp, se.mod);
+                                        break;
+                                }
+                                n++;
+                        } while ((t = now()) < end);
+                        us[path % 4] = (t - start) * 1e6 / n;
+                }
+                printf("%d,%.1f,%.1f,%.1f,%.1f\n", mod_bits[m],
+                       us[0], us[1], us[2], us[3]);
+
+                free(jbase.bytes);
+                free(jexp.bytes);
+                free(jmod.bytes);
+                mpz_clear(base);
+                mpz_clear(result);
+                mpz_clear(check);
+                mpz_clear(se.exp);
+                mpz_clear(se.mod);
+        }
+
+        printf("\nmod_bits,exp_bits,comb_bits,powm_us,fixed_us\n");
+        for (m = 0; mod_bits[m] != 0; m++) {
+                /* exponent and comb lengths: short, full length, too long */
+                int cases[3][2] = {
+                        { SHORT_EXP_BITS, SHORT_EXP_BITS },
+                        { mod_bits[m], mod_bits[m] },
+                        { mod_bits[m], SHORT_EXP_BITS },
+                };
+                struct bench_case c;
+                int i, bad = 0;
+
+                mpz_init(c.mod);
+                mpz_urandomb(c.mod, rand, mod_bits[m]);
+                mpz_setbit(c.mod, mod_bits[m] - 1);
+                mpz_setbit(c.mod, 0);
+                mpz_init(c.base);
+                mpz_urandomb(c.base, rand, mod_bits[m] - 1);
+                mpz_init(c.exp);
+                mpz_init(c.result);
+
+                bad += check_fixed_base(rand, c.base, c.mod, 0);
+                bad += check_fixed_base(rand, c.base, c.mod, 7);
+                bad += check_fixed_base(rand, c.base, c.mod, SHORT_EXP_BITS);
+                bad += check_fixed_base(rand, c.base, c.mod, mod_bits[m]);
+                if (bad != 0)
+                        return 1;
+
+                for (i = 0; i < 3; i++) {
+                        double powm_us, fixed_us;
+
+                        c.fb = fixed_base_new(c.base, c.mod, cases[i][1]);
+                        if (c.fb == NULL) {
+                                fprintf(stderr, "jbigibench: out of memory\n");
+                                return 1;
+                        }
+                        mpz_urandomb(c.exp, rand, cases[i][0]);
+                        mpz_setbit(c.exp, cases[i][0] - 1);
+                        powm_us = time_us(run_powm, &c, ms);
+                        fixed_us = time_us(run_fixed_base, &c, ms);
+                        printf("%d,%d,%d,%.1f,%.1f\n", mod_bits[m],
+                               cases[i][0], cases[i][1], powm_us, fixed_us);
+                        fixed_base_free(c.fb);
+                }
+
+                mpz_clear(c.mod);
+                mpz_clear(c.base);
+                mpz_clear(c.exp);
+                mpz_clear(c.result);
+        }
+
+        if (check_multi_powm(rand) != 0)
+                return 1;
+        printf("\nmod_bits,terms,powms_us,multi_us\n");
+        for (m = 0; mod_bits[m] != 0; m++) {
+                struct bench_case c;
+                int i;
+
+                mpz_init(c.mod);
+                mpz_urandomb(c.mod, rand, mod_bits[m]);
+                mpz_setbit(c.mod, mod_bits[m] - 1);
+                mpz_setbit(c.mod, 0);
+                mpz_init(c.exp);
+                mpz_init(c.result);
+                for (i = 0; i < MAX_TERMS; i++) {
+                        mpz_init(c.bases[i]);
+                        mpz_urandomb(c.bases[i], rand, mod_bits[m] - 1);
+                        mpz_init(c.exps[i]);
+                        mpz_urandomb(c.exps[i], rand, mod_bits[m]);
+                        mpz_setbit(c.exps[i], mod_bits[m] - 1);
+                }
+
+                for (c.count = 2; c.count <= MAX_TERMS; c.count++) {
+                        double powms_us = time_us(run_powms, &c, ms);
+                        double multi_us = time_us(run_multi, &c, ms);
+
+                        printf("%d,%d,%.1f,%.1f\n", mod_bits[m], c.count,
+                               powms_us, multi_us);
+                }
+
+                for (i = 0; i < MAX_TERMS; i++) {
+                        mpz_clear(c.bases[i]);
+                        mpz_clear(c.exps[i]);
+                }
+                mpz_clear(c.mod);
+                mpz_clear(c.exp);
+                mpz_clear(c.result);
+        }
+        gmp_randclear(rand);
+        return 0;
+}
@@ -0,0 +1,81 @@
+package com.onionnetworks.fec;
+
+import java.nio.ByteBuffer;
+
+/**
+ * A native 16 bit code built on a Cauchy matrix, which encodes and
+ * decodes with XORs only.  Every packet is cut into 16 slices, and each
+ * slice of a repair packet is the XOR of some of the slices of the
+ * source packets, so packets must be a multiple of 16 bytes long.
+ *
+ * The repair packets are NOT the same as those of Native16Code (or any
+ * other Vandermonde code), so both ends must agree on the code.  It can be
+ * selected by listing "cauchy16" in the com.onionnetworks.fec.keys
+ * property, see DefaultFECCodeFactory.
+ *
+ * Cauchy codes are not split over threads; wrapping one in a
+ * ParallelFECCode just delegates to it.
+ */
+public class Cauchy16Code extends Native16Code {
+
+    public Cauchy16Code(int k, int n) {
+        super(k,n,1,true);
+    }
+
+    protected void encode(byte[][] src, int[] srcOff, byte[][] repair,
+                          int[] repairOff, int[] index, int packetLength) {
+        checkLength(packetLength);
+        super.encode(src,srcOff,repair,repairOff,index,packetLength);
+    }
+
+    protected void decode(byte[][] pkts, int[] pktsOff,
+                          int[] index, int packetLength, boolean inOrder) {
+        checkLength(packetLength);
+        super.decode(pkts,pktsOff,index,packetLength,inOrder);
+    }
+
+    protected void decodeSubset(byte[][] pkts, int[] pktsOff, int[] index,
+                                int[] want, int packetLength,
+                                boolean shuffled) {
+        checkLength(packetLength);
+        super.decodeSubset(pkts,pktsOff,index,want,packetLength,shuffled);
+    }
+
+    public void encode(ByteBuffer[] src, ByteBuffer[] repair, int[] index) {
+        checkLength(checkEncode(src,repair,index));
+        super.encode(src,repair,index);
+    }
+
+    public void decode(ByteBuffer[] pkts, int[] index) {
+        checkLength(checkDecode(pkts,index));
+        super.decode(pkts,index);
+    }
+
+    protected void decodeChunks(ByteBuffer[][] chunks, int[] index) {
+        if (chunks.length > 0) {
+            checkLength(chunks[0][0].remaining());
+        }
+        super.decodeChunks(chunks,index);
+    }
+
+    /**
+     * The native incremental decoder only handles Vandermonde codes, so
+     * this one buffers the packets.
+     */
+    public IncrementalDecoder createIncrementalDecoder(int packetLength) {
+        checkLength(packetLength);
+        return new IncrementalDecoder.Buffered(this,packetLength);
+    }
+
+    private static void checkLength(int packetLength) {
+        if (packetLength % 16 != 0) {
+            throw new IllegalArgumentException("For 16 bit Cauchy codes, "+
+                                               "packets must be a multiple "+
+                                               "of 16 bytes.");
+        }
+    }
+
+    public String toString() {
+        return new String("Cauchy16Code[k="+k+",n="+n+"]");
+    }
+}
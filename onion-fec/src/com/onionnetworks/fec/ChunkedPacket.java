@@ -0,0 +1,103 @@
+package com.onionnetworks.fec;
+
+import java.nio.ByteBuffer;
+
+/**
+ * A packet that is not in one piece of memory: a list of chunks of the
+ * same length, such as the pages of a file mapped in several
+ * MappedByteBuffers, or every k-th chunk of one large buffer.  This lets a
+ * single segment span a file of several gigabytes without staging it into
+ * heap arrays.
+ *
+ * FECCode.encode(ChunkedPacket[],...) and decode(ChunkedPacket[],...) code
+ * the chunks at the same position in all packets together, as packets of
+ * their own, so every packet of a call must have the same chunk length
+ * and count.  With direct buffers the native codes read and write the
+ * chunks in place.  A Vandermonde code gives the same repair packets as
+ * it would for the packets in one piece; a Cauchy code slices each chunk
+ * on its own, so both ends must use the same chunk length.
+ *
+ * For example, packet i of a block stored chunk by chunk, k packets of
+ * count chunks interleaved in one buffer:
+ * <code>
+ *   new ChunkedPacket(block,i*chunkLength,k*chunkLength,chunkLength,count);
+ * </code>
+ */
+public class ChunkedPacket {
+
+    protected final ByteBuffer[] chunks;
+    protected final int chunkLength;
+
+    /**
+     * @param chunks The chunks, each starting at its position().  They are
+     * sliced, so their positions and limits are left alone.
+     * @param chunkLength The length of each chunk.
+     */
+    public ChunkedPacket(ByteBuffer[] chunks, int chunkLength) {
+        if (chunkLength < 0) {
+            throw new IllegalArgumentException("chunkLength="+chunkLength);
+        }
+        this.chunks = new ByteBuffer[chunks.length];
+        this.chunkLength = chunkLength;
+        for (int i=0;i<chunks.length;i++) {
+            this.chunks[i] = slice(chunks[i],chunks[i].position());
+        }
+    }
+
+    /**
+     * The chunks of <code>buf</code> at offsets off, off+stride,
+     * off+2*stride...
+     *
+     * @param buf The buffer the packet lives in.
+     * @param off The offset of the first chunk within buf.
+     * @param stride The distance in bytes from one chunk to the next, at
+     * least chunkLength so that the chunks do not overlap.
+     * @param chunkLength The length of each chunk.
+     * @param count The number of chunks.
+     */
+    public ChunkedPacket(ByteBuffer buf, int off, int stride,
+                         int chunkLength, int count) {
+        if (chunkLength < 0 || count < 0 || off < 0 ||
+            (count > 1 && stride < chunkLength)) {
+            throw new IllegalArgumentException("off="+off+",stride="+stride+
+                                               ",chunkLength="+chunkLength+
+                                               ",count="+count);
+        }
+        this.chunks = new ByteBuffer[count];
+        this.chunkLength = chunkLength;
+        for (int i=0;i<count;i++) {
+            chunks[i] = slice(buf,off + (long) i*stride);
+        }
+    }
+
+    private ByteBuffer slice(ByteBuffer buf, long off) {
+        if (off < 0 || off + chunkLength > buf.limit()) {
+            throw new IndexOutOfBoundsException
+                ("off="+off+",chunkLength="+chunkLength+",limit="+
+                 buf.limit());
+        }
+        ByteBuffer b = buf.duplicate();
+        b.limit((int) off + chunkLength);
+        b.position((int) off);
+        return b.slice();
+    }
+
+    public int getChunkCount() {
+        return chunks.length;
+    }
+
+    public int getChunkLength() {
+        return chunkLength;
+    }
+
+    /**
+     * @return The whole of chunk <code>i</code>, from position 0.
+     */
+    public ByteBuffer getChunk(int i) {
+        return chunks[i];
+    }
+
+    public long getLength() {
+        return (long) chunks.length * chunkLength;
+    }
+}
@@ -3,8 +3,6 @@ package com.onionnetworks.fec;
 import java.util.*;
 import java.io.IOException;
 import java.lang.reflect.*;
-import com.onionnetworks.util.Tuple;
-import com.onionnetworks.util.TimedSoftHashMap;
 
 /**
  * This is the default FECCodeFactory that wraps all of the FECCode 
@@ -20,6 +18,11 @@ import com.onionnetworks.util.TimedSoftHashMap;
  * let me know because I worked my ass of to provide this for you, so do me
  * a favor and at least let me know what you're using this for.
  *
+ * Codes are cached in an FECCodeCache, so that callers asking for the same
+ * (k,n) share one code instead of each building their own.  The size and
+ * ttl of the cache are set with the "com.onionnetworks.fec.cache.size" and
+ * "com.onionnetworks.fec.cache.ttl" properties.
+ *
  * (c) Copyright 2001 Onion Networks
  * (c) Copyright 2000 OpenCola
  *
@@ -28,8 +31,9 @@ import com.onionnetworks.util.TimedSoftHashMap;
 public class DefaultFECCodeFactory extends FECCodeFactory {
 
     public static final int DEFAULT_CACHE_TIME = 2*60*1000;
+    public static final int DEFAULT_CACHE_SIZE = 64;
 
-    //protected TimedSoftHashMap codeCache = new HashMap();
+    protected FECCodeCache codeCache;
     protected ArrayList eightBitCodes = new ArrayList();
     protected ArrayList sixteenBitCodes = new ArrayList();
     protected Properties fecProperties;
@@ -74,6 +78,12 @@ public class DefaultFECCodeFactory extends FECCodeFactory {
                 System.out.println(t.getMessage());
             }
         }
+
+        codeCache = new FECCodeCache
+            (getIntProperty("com.onionnetworks.fec.cache.size",
+                            DEFAULT_CACHE_SIZE),
+             getIntProperty("com.onionnetworks.fec.cache.ttl",
+                            DEFAULT_CACHE_TIME));
     }
 
     /**
@@ -88,26 +98,50 @@ public class DefaultFECCodeFactory extends FECCodeFactory {
         return result;
     }
 
+    protected int getIntProperty(String key, int def) {
+        String value = getProperty(key);
+        if (value == null) {
+            return def;
+        }
+        try {
+            return Integer.parseInt(value.trim());
+        } catch (NumberFormatException e) {
+            System.out.println("Bad value for "+key+": "+value);
+            return def;
+        }
+    }
+
+    /**
+     * @return The cache of the codes handed out by this factory.
+     */
+    public FECCodeCache getCodeCache() {
+        return codeCache;
+    }
+
     /**
      * If you're only asking for an 8 bit code we will NOT give you a 16 bit
      * one.
+     *
+     * This method is not synchronized; concurrent callers only meet in the
+     * code cache.
      */
-    public synchronized FECCode createFECCode(int k, int n) {
-        Integer K = new Integer(k);
-        Integer N = new Integer(n);
-        Tuple t = new Tuple(K,N);
+    public FECCode createFECCode(int k, int n) {
+        if (k < 1 || k > 65536 || n < k || n > 65536) {
+            throw new IllegalArgumentException
+                ("k and n must be between 1 and 65536 and n must not be "+
+                 "smaller than k: k="+k+",n="+n);
+        }
+        boolean eightBit = n <= 256 && !eightBitCodes.isEmpty();
+        int bits = eightBit ? 8 : 16;
 
         // See if there is a cached code.
-        FECCode result = null; //(FECCode) codeCache.get(t);
+        FECCode result = codeCache.get(k,n,bits);
         if (result == null) {
-            if (k < 1 || k > 65536 || n < k || n > 65536) {
-                throw new IllegalArgumentException
-                    ("k and n must be between 1 and 65536 and n must not be "+
-                     "smaller than k: k="+k+",n="+n);
-            }
+            Integer K = new Integer(k);
+            Integer N = new Integer(n);
 
             Iterator it;
-            if (n <= 256 && !eightBitCodes.isEmpty()) {
+            if (eightBit) {
                 it = eightBitCodes.iterator();
             } else {
                 it = sixteenBitCodes.iterator();
@@ -121,10 +155,10 @@ public class DefaultFECCodeFactory extends FECCodeFactory {
                     doh.printStackTrace();
                 }
             }
-                        
-            //if (result != null) {
-            //    codeCache.put(t,result,DEFAULT_CACHE_TIME);
-            // }
+
+            if (result != null) {
+                result = codeCache.put(k,n,bits,result);
+            }
         } 
         return result;
     }
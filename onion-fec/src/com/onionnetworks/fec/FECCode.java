@@ -1,5 +1,7 @@
 package com.onionnetworks.fec;
 
+import java.nio.ByteBuffer;
+
 import com.onionnetworks.util.Util;
 import com.onionnetworks.util.Buffer;
 
@@ -110,6 +112,23 @@ public abstract class FECCode {
                                    int[] index, int packetLength, 
                                    boolean shuffled);
 
+    /**
+     * Like decode(byte[][],int[],int[],int,boolean), but only the source
+     * packets listed in <code>want</code> need to be reconstructed.  Each
+     * of them ends up in its own slot with index[i] == i; the other
+     * missing packets may be left as the repair packets they were, in
+     * which case their index is left as it was too.  This default
+     * implementation decodes the whole block.
+     *
+     * @param want The indexes (between 0..k) of the source packets
+     * needed.
+     */
+    protected void decodeSubset(byte[][] pkts, int[] pktsOff, int[] index,
+                                int[] want, int packetLength,
+                                boolean shuffled) {
+        decode(pkts,pktsOff,index,packetLength,shuffled);
+    }
+
     /**
      * This method takes an array of source packets and generates a number
      * of repair packets from them.  This method could have taken in only
@@ -195,6 +214,9 @@ public abstract class FECCode {
         // therefore we can have the Buffer[]'s wrapping one large byte[]
         // that will be decoded with all of the data in order in that block.
         copyShuffle(pkts,index,k);
+        if (nothingMissing(index,k)) {
+            return;
+        }
 
         byte[][] bufs = new byte[pkts.length][];
         int[] offs = new int[pkts.length];
@@ -205,6 +227,344 @@ public abstract class FECCode {
         decode(bufs,offs,index,pkts[0].len,true);
     }
 
+    /**
+     * Buffer version of decodeSubset(), for readers that need only some
+     * of the source packets, such as one range of a file: only the
+     * missing packets listed in <code>want</code> are reconstructed, so
+     * the work is proportional to the packets wanted rather than to all
+     * those missing.  The packets are put in order by copying, as
+     * decode(Buffer[],int[]) does.  Afterwards pkts[i] holds source packet
+     * i for every i in <code>want</code>; for the others index[i] tells
+     * what pkts[i] holds.
+     *
+     * @param want The indexes (between 0..k) of the source packets
+     * needed.
+     */
+    public void decodeSubset(Buffer[] pkts, int[] index, int[] want) {
+        copyShuffle(pkts,index,k);
+        if (nothingMissing(index,k)) {
+            return;
+        }
+
+        byte[][] bufs = new byte[pkts.length][];
+        int[] offs = new int[pkts.length];
+        for (int i=0;i<bufs.length;i++) {
+            bufs[i] = pkts[i].b;
+            offs[i] = pkts[i].off;
+        }
+        decodeSubset(bufs,offs,index,want,pkts[0].len,true);
+    }
+
+    /**
+     * ByteBuffer version of encode(Buffer[],Buffer[],int[]).  Each packet
+     * starts at the position() of its buffer and is src[0].remaining()
+     * bytes long.  Positions and limits are left untouched.
+     *
+     * Native codes override this to work directly on direct (and memory
+     * mapped) buffers without copying or pinning any Java arrays.  This
+     * default implementation accepts any ByteBuffer, using the backing
+     * array when there is one and copying otherwise.
+     */
+    public void encode(ByteBuffer[] src, ByteBuffer[] repair, int[] index) {
+        int packetLength = checkEncode(src,repair,index);
+        Buffer[] srcBufs = new Buffer[src.length];
+        Buffer[] repairBufs = new Buffer[repair.length];
+        for (int i=0;i<srcBufs.length;i++) {
+            srcBufs[i] = toBuffer(src[i],packetLength,true);
+        }
+        for (int i=0;i<repairBufs.length;i++) {
+            repairBufs[i] = toBuffer(repair[i],packetLength,false);
+        }
+
+        encode(srcBufs,repairBufs,index);
+
+        for (int i=0;i<repairBufs.length;i++) {
+            if (!repair[i].hasArray()) {
+                repair[i].duplicate().put(repairBufs[i].b,0,packetLength);
+            }
+        }
+    }
+
+    /**
+     * ByteBuffer version of decode(Buffer[],int[]).  Like that method the
+     * packets are put in order by copying data, never by reordering the
+     * ByteBuffer[], so buffers that slice one large block (such as a
+     * MappedByteBuffer over a file) end up with the block in order.
+     * Positions and limits are left untouched.
+     */
+    public void decode(ByteBuffer[] pkts, int[] index) {
+        int packetLength = checkDecode(pkts,index);
+        // before copyShuffle, which would leave the packets half shuffled
+        positions(pkts,packetLength);
+        copyShuffle(pkts,index,k);
+        if (nothingMissing(index,k)) {
+            return;
+        }
+
+        Buffer[] bufs = new Buffer[pkts.length];
+        boolean[] missing = new boolean[pkts.length];
+        for (int i=0;i<bufs.length;i++) {
+            bufs[i] = toBuffer(pkts[i],packetLength,true);
+            missing[i] = i < k && index[i] != i;
+        }
+
+        decode(bufs,index);
+
+        for (int i=0;i<bufs.length;i++) {
+            if (missing[i] && !pkts[i].hasArray()) {
+                pkts[i].duplicate().put(bufs[i].b,0,packetLength);
+            }
+        }
+    }
+
+    /**
+     * ChunkedPacket version of encode(ByteBuffer[],ByteBuffer[],int[]):
+     * the chunks at each position are encoded as packets of their own,
+     * so no packet needs to be in one piece.
+     */
+    public void encode(ChunkedPacket[] src, ChunkedPacket[] repair,
+                       int[] index) {
+        int count = checkEncode(src,repair,index);
+        ByteBuffer[] s = new ByteBuffer[src.length];
+        ByteBuffer[] r = new ByteBuffer[repair.length];
+        for (int c=0;c<count;c++) {
+            for (int i=0;i<s.length;i++) {
+                s[i] = src[i].getChunk(c);
+            }
+            for (int i=0;i<r.length;i++) {
+                r[i] = repair[i].getChunk(c);
+            }
+            encode(s,r,index);
+        }
+    }
+
+    /**
+     * ChunkedPacket version of decode(ByteBuffer[],int[]).  Like that
+     * method the data is put in order by copying, so the ChunkedPacket[]
+     * is not reordered.  The packets are shuffled once and every chunk is
+     * decoded with the same missing rows, see decodeChunks().
+     */
+    public void decode(ChunkedPacket[] pkts, int[] index) {
+        int count = checkDecode(pkts,index);
+        ByteBuffer[][] chunks = new ByteBuffer[count][pkts.length];
+        for (int c=0;c<count;c++) {
+            for (int i=0;i<pkts.length;i++) {
+                chunks[c][i] = pkts[i].getChunk(c);
+            }
+        }
+        copyShuffle(chunks,index,k);
+        if (nothingMissing(index,k)) {
+            return;
+        }
+        decodeChunks(chunks,index);
+    }
+
+    /**
+     * Reconstruct the missing packets of decode(ChunkedPacket[],int[]),
+     * chunks[c] holding chunk c of every packet, all shuffled as index
+     * is.  Afterwards index[i] == i for every i < k.  This implementation
+     * decodes each chunk position with decode(ByteBuffer[],int[]); codes
+     * that can set up the decoding once for all of them override it.
+     */
+    protected void decodeChunks(ByteBuffer[][] chunks, int[] index) {
+        for (int c=0;c<chunks.length;c++) {
+            decode(chunks[c],(int[]) index.clone());
+        }
+        for (int i=0;i<k;i++) {
+            index[i] = i;
+        }
+    }
+
+    /**
+     * Check the arrays of encode(ChunkedPacket[],ChunkedPacket[],int[])
+     * as checkEncode(ByteBuffer[],...) does, and that all the packets are
+     * cut the same way.
+     *
+     * @return The chunk count.
+     */
+    protected final int checkEncode(ChunkedPacket[] src,
+                                    ChunkedPacket[] repair, int[] index) {
+        if (src.length == 0 || src.length < k ||
+            repair.length != index.length) {
+            throw new IllegalArgumentException("Need k source packets and "+
+                                               "one index per repair packet");
+        }
+        return checkChunks(src,repair);
+    }
+
+    /**
+     * Check the arrays of decode(ChunkedPacket[],int[]) as
+     * checkDecode(ByteBuffer[],int[]) does, and that all the packets are
+     * cut the same way.
+     *
+     * @return The chunk count.
+     */
+    protected final int checkDecode(ChunkedPacket[] pkts, int[] index) {
+        if (pkts.length == 0 || pkts.length < k || index.length < k) {
+            throw new IllegalArgumentException("Must be k packets and "+
+                                               "index entries.");
+        }
+        return checkChunks(pkts,pkts);
+    }
+
+    /**
+     * @return the chunk count, checking that all the packets are cut the
+     * same way.  a must not be empty.
+     */
+    private static int checkChunks(ChunkedPacket[] a, ChunkedPacket[] b) {
+        ChunkedPacket first = a[0];
+        for (int i=0;i<a.length+b.length;i++) {
+            ChunkedPacket p = i < a.length ? a[i] : b[i-a.length];
+            if (p.getChunkCount() != first.getChunkCount() ||
+                p.getChunkLength() != first.getChunkLength()) {
+                throw new IllegalArgumentException
+                    ("Packets cut into different chunks: "+
+                     p.getChunkCount()+"x"+p.getChunkLength()+" and "+
+                     first.getChunkCount()+"x"+first.getChunkLength());
+            }
+        }
+        return first.getChunkCount();
+    }
+
+    /**
+     * @return A decoder that takes the packets of a block one at a time,
+     * see IncrementalDecoder.  This implementation buffers the packets
+     * and decodes them when there are k.
+     */
+    public IncrementalDecoder createIncrementalDecoder(int packetLength) {
+        return new IncrementalDecoder.Buffered(this,packetLength);
+    }
+
+    /**
+     * Check the arrays of encode(ByteBuffer[],ByteBuffer[],int[]) before
+     * anything is read from them.
+     *
+     * @return The packet length, src[0].remaining().
+     */
+    protected final int checkEncode(ByteBuffer[] src, ByteBuffer[] repair,
+                                    int[] index) {
+        if (src.length < k || repair.length != index.length) {
+            throw new IllegalArgumentException("Need k source packets and "+
+                                               "one index per repair packet");
+        }
+        return src.length == 0 ? 0 : src[0].remaining();
+    }
+
+    /**
+     * Check the arrays of decode(ByteBuffer[],int[]) before anything is
+     * read from them.
+     *
+     * @return The packet length, pkts[0].remaining().
+     */
+    protected final int checkDecode(ByteBuffer[] pkts, int[] index) {
+        if (pkts.length < k || index.length < k) {
+            throw new IllegalArgumentException("Must be k packets and "+
+                                               "index entries.");
+        }
+        return pkts.length == 0 ? 0 : pkts[0].remaining();
+    }
+
+    /**
+     * Wrap a ByteBuffer's backing array in a Buffer, or copy the packet
+     * into a new one if the ByteBuffer has no accessible array.
+     */
+    protected static final Buffer toBuffer(ByteBuffer bb, int len,
+                                           boolean copyIn) {
+        if (bb.remaining() < len) {
+            throw new IllegalArgumentException
+                ("Buffer too short: remaining="+bb.remaining()+",len="+len);
+        }
+        if (bb.hasArray()) {
+            return new Buffer(bb.array(),bb.arrayOffset()+bb.position(),len);
+        }
+        Buffer buf = new Buffer(len);
+        if (copyIn) {
+            bb.duplicate().get(buf.b,0,len);
+        }
+        return buf;
+    }
+
+    /**
+     * @return true if every buffer is direct (and writable, if
+     * <code>writable</code> is set), so that the native code can address
+     * it with GetDirectBufferAddress.
+     */
+    protected static final boolean isDirect(ByteBuffer[] bufs, 
+                                            boolean writable) {
+        for (int i=0;i<bufs.length;i++) {
+            if (!bufs[i].isDirect() || (writable && bufs[i].isReadOnly())) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @return the position() of each buffer, checking that every one has
+     * at least <code>len</code> bytes remaining.
+     */
+    protected static final int[] positions(ByteBuffer[] bufs, int len) {
+        int[] offs = new int[bufs.length];
+        for (int i=0;i<bufs.length;i++) {
+            if (bufs[i].remaining() < len) {
+                throw new IllegalArgumentException
+                    ("Buffer "+i+" too short: remaining="+
+                     bufs[i].remaining()+",len="+len);
+            }
+            offs[i] = bufs[i].position();
+        }
+        return offs;
+    }
+
+    /**
+     * ByteBuffer version of copyShuffle(Buffer[],int[],int).  The data is
+     * swapped through absolute views so positions are not changed.
+     */
+    protected static final void copyShuffle(ByteBuffer[] pkts, int index[],
+                                            int k) {
+        copyShuffle(new ByteBuffer[][] {pkts},index,k);
+    }
+
+    /**
+     * copyShuffle(ByteBuffer[],int[],int) over several sets of packets
+     * at once, such as the chunks of ChunkedPackets: every set is
+     * shuffled the same way, as index is.
+     */
+    protected static final void copyShuffle(ByteBuffer[][] sets,
+                                            int index[], int k) {
+        byte[] a = null, b = null;
+        for (int i = 0;i < k ;) {
+            if (index[i] >= k || index[i] == i) {
+                i++;
+            } else {
+                // put pkts in the right position (first check for conflicts).
+                int c = index[i];
+                
+                if (index[c] == c) {
+                    throw new IllegalArgumentException
+                        ("Shuffle Error: Duplicate indexes at "+i);
+                }
+                // swap(index[c],index[i])
+                int tmp = index[i];
+                index[i] = index[c];
+                index[c] = tmp;
+
+                // swap(pkts[c],pkts[i]) in every set
+                for (int s=0;s<sets.length;s++) {
+                    ByteBuffer[] pkts = sets[s];
+                    if (a == null) {
+                        a = new byte[pkts[0].remaining()];
+                        b = new byte[a.length];
+                    }
+                    pkts[i].duplicate().get(a);
+                    pkts[c].duplicate().get(b);
+                    pkts[i].duplicate().put(b);
+                    pkts[c].duplicate().put(a);
+                }
+            }
+        }
+    }
+
     /**
      * Move packets with index < k into their position.  This method
      * copies the data using System.arraycopy rather than modifying the
@@ -240,6 +600,37 @@ public abstract class FECCode {
         }
     }
 
+    /**
+     * @return true if the shuffled index holds every source packet in its
+     * own slot, so that there is nothing left to decode.
+     */
+    protected static final boolean nothingMissing(int[] index, int k) {
+        for (int i=0;i<k;i++) {
+            if (index[i] != i) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @return which rows of the shuffled index are both missing and
+     * wanted, checking that every wanted index is a source packet.
+     */
+    protected static final boolean[] wantedRows(int[] index, int[] want,
+                                                int k) {
+        boolean[] rows = new boolean[k];
+        for (int i=0;i<want.length;i++) {
+            if (want[i] < 0 || want[i] >= k) {
+                throw new IllegalArgumentException("Invalid wanted index "+
+                                                   want[i]+" (max "+(k-1)+
+                                                   ")");
+            }
+            rows[want[i]] = index[want[i]] >= k;
+        }
+        return rows;
+    }
+
     /**
      * shuffle move src packets in their position
      */
@@ -0,0 +1,212 @@
+package com.onionnetworks.fec;
+
+import java.util.Iterator;
+import java.util.Map;
+import java.util.concurrent.ConcurrentHashMap;
+import java.util.concurrent.atomic.AtomicLong;
+
+/**
+ * A bounded cache of FECCodes keyed by (k, n, bits).  FECCodes do not
+ * change once they are constructed, so a single instance can be shared by
+ * any number of threads, and building one (especially a native one, which
+ * inverts a Vandermonde matrix) is far more expensive than looking it up.
+ *
+ * Lookups do not take any lock.  Entries that have not been used for
+ * <code>ttl</code> milliseconds are dropped, and when more than
+ * <code>maxSize</code> codes are cached the least recently used ones are
+ * evicted.  If two threads miss on the same key at the same time both
+ * will build a code, but only the first one to be put in the cache is
+ * returned to either of them.
+ *
+ * @see DefaultFECCodeFactory
+ */
+public class FECCodeCache {
+
+    protected final ConcurrentHashMap map = new ConcurrentHashMap();
+    protected final int maxSize;
+    protected final long ttl;
+
+    protected final AtomicLong hits = new AtomicLong();
+    protected final AtomicLong misses = new AtomicLong();
+    protected final AtomicLong evictions = new AtomicLong();
+    protected final AtomicLong expirations = new AtomicLong();
+
+    /**
+     * @param maxSize The maximum number of codes to keep, 0 disables the
+     * cache.
+     * @param ttl The time in milliseconds after which an unused code is
+     * dropped, 0 means never.
+     */
+    public FECCodeCache(int maxSize, long ttl) {
+        this.maxSize = maxSize;
+        this.ttl = ttl;
+    }
+
+    /**
+     * @return The cached code for these parameters, or null if there is
+     * none.
+     */
+    public FECCode get(int k, int n, int bits) {
+        Key key = new Key(k,n,bits);
+        Entry e = (Entry) map.get(key);
+        long now = System.currentTimeMillis();
+        if (e != null) {
+            if (isExpired(e,now)) {
+                if (map.remove(key,e)) {
+                    expirations.incrementAndGet();
+                }
+            } else {
+                e.lastUsed = now;
+                hits.incrementAndGet();
+                return e.code;
+            }
+        }
+        misses.incrementAndGet();
+        return null;
+    }
+
+    /**
+     * Add a code to the cache.
+     *
+     * @return The code that should be used for these parameters, which is
+     * <code>code</code> unless another thread got there first.
+     */
+    public FECCode put(int k, int n, int bits, FECCode code) {
+        if (maxSize <= 0) {
+            return code;
+        }
+        long now = System.currentTimeMillis();
+        Key key = new Key(k,n,bits);
+        Entry e = new Entry(code,now);
+        // Until e is in the map or a live entry is found there: the
+        // expired entry may be replaced or removed by another thread
+        // between the two calls.
+        while (true) {
+            Entry old = (Entry) map.putIfAbsent(key,e);
+            if (old == null) {
+                break;
+            }
+            if (!isExpired(old,now)) {
+                old.lastUsed = now;
+                return old.code;
+            }
+            if (map.replace(key,old,e)) {
+                expirations.incrementAndGet();
+                break;
+            }
+        }
+        if (map.size() > maxSize) {
+            evict(now);
+        }
+        return code;
+    }
+
+    /**
+     * Drop the expired entries and then, while the cache is still too
+     * large, the least recently used ones.
+     */
+    protected void evict(long now) {
+        while (map.size() > maxSize) {
+            Map.Entry lru = null;
+            for (Iterator it = map.entrySet().iterator(); it.hasNext();) {
+                Map.Entry me = (Map.Entry) it.next();
+                Entry e = (Entry) me.getValue();
+                if (isExpired(e,now)) {
+                    if (map.remove(me.getKey(),e)) {
+                        expirations.incrementAndGet();
+                    }
+                } else if (lru == null ||
+                           e.lastUsed < ((Entry) lru.getValue()).lastUsed) {
+                    lru = me;
+                }
+            }
+            if (map.size() <= maxSize || lru == null) {
+                return;
+            }
+            if (map.remove(lru.getKey(),lru.getValue())) {
+                evictions.incrementAndGet();
+            }
+        }
+    }
+
+    protected boolean isExpired(Entry e, long now) {
+        return ttl > 0 && now - e.lastUsed > ttl;
+    }
+
+    public void clear() {
+        map.clear();
+    }
+
+    public int size() {
+        return map.size();
+    }
+
+    public int getMaxSize() {
+        return maxSize;
+    }
+
+    public long getTTL() {
+        return ttl;
+    }
+
+    public long getHits() {
+        return hits.get();
+    }
+
+    public long getMisses() {
+        return misses.get();
+    }
+
+    /**
+     * @return The number of codes dropped because the cache was full.
+     */
+    public long getEvictions() {
+        return evictions.get();
+    }
+
+    /**
+     * @return The number of codes dropped because they were not used for
+     * longer than the ttl.
+     */
+    public long getExpirations() {
+        return expirations.get();
+    }
+
+    public String toString() {
+        return "FECCodeCache[size="+size()+",maxSize="+maxSize+",ttl="+ttl+
+            ",hits="+getHits()+",misses="+getMisses()+",evictions="+
+            getEvictions()+",expirations="+getExpirations()+"]";
+    }
+
+    protected static final class Key {
+        final int k, n, bits;
+
+        Key(int k, int n, int bits) {
+            this.k = k;
+            this.n = n;
+            this.bits = bits;
+        }
+
+        public boolean equals(Object obj) {
+            if (!(obj instanceof Key)) {
+                return false;
+            }
+            Key key = (Key) obj;
+            return key.k == k && key.n == n && key.bits == bits;
+        }
+
+        public int hashCode() {
+            return (k * 65537 + n) * 31 + bits;
+        }
+    }
+
+    protected static final class Entry {
+        final FECCode code;
+        volatile long lastUsed;
+
+        Entry(FECCode code, long lastUsed) {
+            this.code = code;
+            this.lastUsed = lastUsed;
+        }
+    }
+}
@@ -91,6 +91,38 @@ public class FECMath {
      */
     public char[][] gf_mul_table;
 
+    /**
+     * addMul() on chars in GF(2^16) looks up the products in two 256 entry
+     * tables, built for its constant, rather than through gf_log and
+     * gf_exp, when there are at least this many chars.  That is about
+     * where the two loops break even once the tables are in splitCache;
+     * "ant bench" times both on either side of it.
+     */
+    public static final int SPLIT_TABLE_MIN = 256;
+
+    /**
+     * The number of tables from mulSplit() kept, about 1 KB each.  They
+     * are found by the low bits of their constant, so a code whose
+     * matrices have fewer constants than this mostly builds each table
+     * once.
+     */
+    public static final int SPLIT_CACHE_SIZE = 1024;
+
+    // A table from mulSplit() and the constant it is for.  The fields are
+    // final so that a Split put in splitCache by one thread is seen whole
+    // by the others, without locking.
+    private static final class Split {
+        final char c;
+        final char[] t;
+
+        Split(char c, char[] t) {
+            this.c = c;
+            this.t = t;
+        }
+    }
+
+    private final Split[] splitCache;
+
     public FECMath() {
         this(8);
     }
@@ -110,6 +142,7 @@ public class FECMath {
         if (gfBits <= 8) {
             initMulTable();
         }
+        splitCache = gfBits == 16 ? new Split[SPLIT_CACHE_SIZE] : null;
     }
 
     public final void generateGF() {
@@ -286,7 +319,8 @@ public class FECMath {
                 dst[i] ^= gf_mulc[src[j]];
             }
 
-        } else { // gfBits > 8, no multiplication table
+        } else if (len < SPLIT_TABLE_MIN || gfBits != 16) {
+            // no multiplication table
             int mulcPos = gf_log[c];
 
             // unroll your own damn loop.
@@ -296,9 +330,92 @@ public class FECMath {
                     dst[i] ^= gf_exp[mulcPos+gf_log[y]];
                 }
             }
+        } else {
+            // c * y = c * (y & 0xff) ^ c * (y & 0xff00), so two lookups in
+            // 512 chars that stay in the L1 cache replace the lookups in
+            // gf_log and gf_exp (half a megabyte between them) and the test
+            // for 0.
+            char[] t = mulSplit(c);
+            int y;
+            for (;i < lim; i++, j++) {
+                y = src[j];
+                dst[i] ^= t[y & 0xff] ^ t[256 + (y >>> 8)];
+            }
         }
     }
 
+    /**
+     * addMul() in GF(2^16) on symbols kept in byte[]'s, two bytes each
+     * with the high byte first (the order of Util.arraycopy()), so that
+     * packets need not be copied to and from char[]'s.  len is in bytes
+     * and must be even.
+     */
+    public final void addMul16(byte[] dst, int dstPos, byte[] src, 
+                               int srcPos, char c, int len) {
+        if (c == 0) {
+            return;
+        }
+        int lim = dstPos + len;
+        int i = dstPos;
+        int j = srcPos;
+        int y;
+        if (len < 2*SPLIT_TABLE_MIN) {
+            int mulcPos = gf_log[c];
+            for (;i < lim; i += 2, j += 2) {
+                if ((y = ((src[j] & 0xff) << 8) | (src[j+1] & 0xff)) != 0) {
+                    y = gf_exp[mulcPos+gf_log[y]];
+                    dst[i] ^= (byte) (y >>> 8);
+                    dst[i+1] ^= (byte) y;
+                }
+            }
+        } else {
+            char[] t = mulSplit(c);
+            for (;i < lim; i += 2, j += 2) {
+                y = t[256 + (src[j] & 0xff)] ^ t[src[j+1] & 0xff];
+                dst[i] ^= (byte) (y >>> 8);
+                dst[i+1] ^= (byte) y;
+            }
+        }
+    }
+
+    /**
+     * @return The products of c with 0..255 followed by those of c with
+     * (0..255) << 8, from splitCache if they are there.  The table must
+     * not be written to.
+     */
+    private final char[] mulSplit(char c) {
+        int slot = c & (SPLIT_CACHE_SIZE - 1);
+        Split s = splitCache[slot];
+        if (s == null || s.c != c) {
+            s = new Split(c, buildSplit(c));
+            splitCache[slot] = s;
+        }
+        return s.t;
+    }
+
+    /**
+     * @return A new table of the products of c, as mulSplit() returns.
+     * Package private for the tests.
+     */
+    final char[] buildSplit(char c) {
+        char[] t = new char[512];
+        int mulcPos = gf_log[c];
+        for (int b=0;b<8;b++) {
+            t[1 << b] = gf_exp[mulcPos+gf_log[1 << b]];
+            t[256 + (1 << b)] = gf_exp[mulcPos+gf_log[1 << (b+8)]];
+        }
+        // The product is linear in x, so c*x = c*(x & -x) ^ c*(x & (x-1)),
+        // and the second one is already in the table.
+        for (int x=3;x<256;x++) {
+            int low = x & -x;
+            if (low != x) {
+                t[x] = (char) (t[low] ^ t[x ^ low]);
+                t[256+x] = (char) (t[256+low] ^ t[256 + (x ^ low)]);
+            }
+        }
+        return t;
+    }
+
     /*
      * addMul() computes dst[] = dst[] + c * src[]
      * This is used often, so better optimize it! Currently the loop is
@@ -647,19 +764,51 @@ public class FECMath {
     }
 
     /**
-     * createDecodeMatrix constructs the encoding matrix given the
-     * indexes.
+     * createDecodeMatrix constructs the decoding matrix given the
+     * indexes, which must be shuffled.  The rows of the source packets
+     * that were received are those of the identity, so only the m*m
+     * submatrix of encMatrix that the repair packets received have in
+     * the columns of the missing source packets is inverted, and the
+     * missing rows are built from its inverse, as fec.c does.  That is
+     * O(m^3) rather than O(k^3) when few packets are missing.
      */
     protected final char[] createDecodeMatrix(char[] encMatrix, int[] index,
                                               int k, int n) {
         
         char[] matrix = createGFMatrix(k, k);
-        for (int i = 0, pos = 0; i < k ; i++, pos += k) {
-            System.arraycopy(encMatrix,index[i]*k,matrix,pos,k);
+        int[] miss = new int[k];
+        int m = 0;
+        for (int i = 0; i < k ; i++) {
+            if (index[i] < k) {
+                matrix[i*k + i] = 1;
+            } else if (index[i] < n) {
+                miss[m++] = i;
+            } else {
+                throw new IllegalArgumentException
+                    ("Invalid index "+index[i]+" (max "+(n-1)+")");
+            }
+        }
+        if (m == 0) {
+            return matrix;
+        }
+
+        char[] b = createGFMatrix(m, m);
+        for (int a = 0; a < m; a++) {
+            for (int c = 0; c < m; c++) {
+                b[a*m + c] = encMatrix[index[miss[a]]*k + miss[c]];
+            }
+        }
+        invertMatrix(b, m);
+
+        for (int a = 0; a < m; a++) {
+            int pos = miss[a]*k;
+            for (int c = 0; c < m; c++) {
+                addMul(matrix,pos,encMatrix,index[miss[c]]*k,b[a*m + c],k);
+            }
+            for (int c = 0; c < m; c++) {
+                matrix[pos + miss[c]] = b[a*m + c];
+            }
         }
-        
-        invertMatrix(matrix, k);
-        
         return matrix;
     }
 }
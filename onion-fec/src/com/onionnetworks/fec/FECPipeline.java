@@ -0,0 +1,294 @@
+package com.onionnetworks.fec;
+
+import java.io.IOException;
+import java.io.InterruptedIOException;
+import java.util.concurrent.ArrayBlockingQueue;
+import java.util.concurrent.BlockingQueue;
+
+import com.onionnetworks.io.RAF;
+import com.onionnetworks.util.Buffer;
+import com.onionnetworks.util.Util;
+
+/**
+ * Encodes or decodes a file segment by segment with the disk I/O and the
+ * coding overlapped: a reader thread fills segments from one RAF, the
+ * calling thread codes them, and a writer thread writes the results to
+ * another, so that the disk is kept busy while the CPU works instead of
+ * the two taking turns.
+ *
+ * The stages hand segments to each other through bounded queues, and
+ * there are only <code>depth</code> segment buffers (two by default, one
+ * being coded while the next one is read and the previous one written),
+ * so a stage that gets ahead blocks until a buffer comes back: memory
+ * use is fixed however large the file.
+ *
+ * For example, to write 16 repair packets of every segment of a file:
+ * <code>
+ *   FECPipeline p = new FECPipeline(code,k,packetLength);
+ *   p.encode(in,0,in.length(),out,0,repairIndexes);
+ * </code>
+ */
+public class FECPipeline {
+
+    public static final int DEFAULT_DEPTH = 2;
+
+    protected final FECCode code;
+    protected final int k;
+    protected final int packetLength;
+    protected final int depth;
+
+    public FECPipeline(FECCode code, int k, int packetLength) {
+        this(code,k,packetLength,DEFAULT_DEPTH);
+    }
+
+    /**
+     * @param depth The number of segments in flight, at least 1.
+     */
+    public FECPipeline(FECCode code, int k, int packetLength, int depth) {
+        if (k <= 0 || packetLength <= 0 || depth <= 0) {
+            throw new IllegalArgumentException("k="+k+",packetLength="+
+                                               packetLength+",depth="+depth);
+        }
+        this.code = code;
+        this.k = k;
+        this.packetLength = packetLength;
+        this.depth = depth;
+    }
+
+    /**
+     * Encode <code>len</code> bytes of <code>in</code> from
+     * <code>off</code>, k*packetLength bytes per segment (the last one
+     * padded with zeros).  The repair packets <code>index</code> of
+     * segment s are written to <code>out</code> one after the other,
+     * from outOff + s*index.length*packetLength.
+     *
+     * @return The number of segments.
+     */
+    public long encode(final RAF in, final long off, final long len,
+                       final RAF out, final long outOff, final int[] index)
+        throws IOException {
+
+        if (index.length == 0) {
+            throw new IllegalArgumentException("No repair packets to encode");
+        }
+        final int segLen = k*packetLength;
+        final int repLen = index.length*packetLength;
+        final long segs = (len + segLen - 1) / segLen;
+        run(segs,index.length,new Stages() {
+                public void read(Segment s) throws IOException {
+                    int n = (int) Math.min(segLen,len-s.num*segLen);
+                    in.seekAndReadFully(off+s.num*segLen,s.data,0,n);
+                    Util.bzero(s.data,n,segLen-n);
+                }
+                public void code(Segment s) {
+                    code.encode(s.pkts,s.repair,index);
+                }
+                public void write(Segment s) throws IOException {
+                    out.seekAndWrite(outOff+s.num*repLen,s.repair[0].b,0,
+                                     repLen);
+                }
+            });
+        return segs;
+    }
+
+    /**
+     * Decode the segments of a file.  Segment s is k received packets
+     * stored one after the other in <code>in</code> from inOff +
+     * s*k*packetLength, with indexes[s] their indexes; its source data
+     * is written to <code>out</code> from outOff + s*k*packetLength, up
+     * to <code>len</code> bytes in all.
+     *
+     * @return The number of segments.
+     */
+    public long decode(final RAF in, final long inOff, final int[][] indexes,
+                       final RAF out, final long outOff, final long len)
+        throws IOException {
+
+        final int segLen = k*packetLength;
+        final long segs = (len + segLen - 1) / segLen;
+        if (indexes.length < segs) {
+            throw new IllegalArgumentException("Need "+segs+" indexes, not "+
+                                               indexes.length);
+        }
+        run(segs,0,new Stages() {
+                public void read(Segment s) throws IOException {
+                    in.seekAndReadFully(inOff+s.num*segLen,s.data,0,segLen);
+                }
+                public void code(Segment s) {
+                    code.decode(s.pkts,(int[]) indexes[(int) s.num].clone());
+                }
+                public void write(Segment s) throws IOException {
+                    int n = (int) Math.min(segLen,len-s.num*segLen);
+                    out.seekAndWrite(outOff+s.num*segLen,s.data,0,n);
+                }
+            });
+        return segs;
+    }
+
+    /**
+     * One segment buffer: k packets in data, and room for the repair
+     * packets being encoded.
+     */
+    protected class Segment {
+        long num;
+        final byte[] data;
+        final Buffer[] pkts;
+        final Buffer[] repair;
+
+        Segment(int repairs) {
+            data = new byte[k*packetLength];
+            pkts = new Buffer[k];
+            for (int i=0;i<k;i++) {
+                pkts[i] = new Buffer(data,i*packetLength,packetLength);
+            }
+            byte[] r = new byte[repairs*packetLength];
+            repair = new Buffer[repairs];
+            for (int i=0;i<repairs;i++) {
+                repair[i] = new Buffer(r,i*packetLength,packetLength);
+            }
+        }
+    }
+
+    protected interface Stages {
+        void read(Segment s) throws IOException;
+        void code(Segment s);
+        void write(Segment s) throws IOException;
+    }
+
+    // Handed down the queues after the last segment.
+    private static final Object END = new Object();
+
+    /**
+     * Run segments 0..segs-1 through the stages: read on one thread, code
+     * on this one, write on another.  The first exception of any stage
+     * stops the others and is thrown from here, once the reader and the
+     * writer have both finished.
+     */
+    protected void run(final long segs, int repairs, final Stages stages)
+        throws IOException {
+
+        final BlockingQueue free = new ArrayBlockingQueue(depth);
+        final BlockingQueue toCode = new ArrayBlockingQueue(depth+1);
+        final BlockingQueue toWrite = new ArrayBlockingQueue(depth+1);
+        final Throwable[] failure = new Throwable[1];
+        for (int i=0;i<depth;i++) {
+            free.add(new Segment(repairs));
+        }
+        final Thread caller = Thread.currentThread();
+
+        Thread reader = new Thread("FEC reader") {
+                public void run() {
+                    try {
+                        for (long i=0;i<segs;i++) {
+                            Segment s = (Segment) free.take();
+                            s.num = i;
+                            stages.read(s);
+                            toCode.put(s);
+                        }
+                        toCode.put(END);
+                    } catch (Throwable t) {
+                        fail(failure,t,caller);
+                    }
+                }
+            };
+        Thread writer = new Thread("FEC writer") {
+                public void run() {
+                    try {
+                        Object o;
+                        while ((o = toWrite.take()) != END) {
+                            stages.write((Segment) o);
+                            free.put(o);
+                        }
+                    } catch (Throwable t) {
+                        fail(failure,t,caller);
+                    }
+                }
+            };
+        reader.setDaemon(true);
+        writer.setDaemon(true);
+        reader.start();
+        writer.start();
+
+        try {
+            Object o;
+            while ((o = toCode.take()) != END) {
+                stages.code((Segment) o);
+                toWrite.put(o);
+            }
+            toWrite.put(o);
+            writer.join();
+        } catch (InterruptedException e) {
+            if (failure(failure) == null) {
+                // Interrupted from outside, keep the news for the caller.
+                fail(failure,e,null);
+                caller.interrupt();
+            }
+        } catch (RuntimeException e) {
+            fail(failure,e,null);
+        } finally {
+            reader.interrupt();
+            writer.interrupt();
+            // A stage may still be inside a read or write that does not
+            // notice interrupts; wait for it, so that the caller can close
+            // the RAFs once this returns.
+            join(reader);
+            join(writer);
+        }
+
+        Throwable t = failure(failure);
+        if (t instanceof IOException) {
+            throw (IOException) t;
+        } else if (t instanceof RuntimeException) {
+            throw (RuntimeException) t;
+        } else if (t instanceof Error) {
+            throw (Error) t;
+        } else if (t != null) {
+            IOException e = new InterruptedIOException("FEC pipeline "+
+                                                       "interrupted");
+            e.initCause(t);
+            throw e;
+        }
+    }
+
+    /**
+     * Record the first failure, and wake up the coding thread.  Later
+     * ones are the other stages being stopped, and are dropped.
+     */
+    private static void fail(Throwable[] failure, Throwable t,
+                             Thread caller) {
+        synchronized (failure) {
+            if (failure[0] != null) {
+                return;
+            }
+            failure[0] = t;
+        }
+        if (caller != null) {
+            caller.interrupt();
+        }
+    }
+
+    /**
+     * Wait for t to die, even if this thread is interrupted meanwhile.
+     * The interrupt is kept for the caller.
+     */
+    private static void join(Thread t) {
+        boolean interrupted = false;
+        while (true) {
+            try {
+                t.join();
+                break;
+            } catch (InterruptedException e) {
+                interrupted = true;
+            }
+        }
+        if (interrupted) {
+            Thread.currentThread().interrupt();
+        }
+    }
+
+    private static Throwable failure(Throwable[] failure) {
+        synchronized (failure) {
+            return failure[0];
+        }
+    }
+}
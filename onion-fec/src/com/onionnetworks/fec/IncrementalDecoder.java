@@ -0,0 +1,168 @@
+package com.onionnetworks.fec;
+
+import java.util.BitSet;
+
+/**
+ * Decodes one block as its packets arrive, rather than all at once when k
+ * of them are there.  Get one from FECCode.createIncrementalDecoder(), feed
+ * it packets with add() until isComplete(), and read the source packets
+ * back with getPacket().  Source packets that were received as such can be
+ * read back right away.
+ *
+ * The native codes do the work as the packets come in: each packet is
+ * eliminated against the ones before it, so that the last one completes
+ * the block in time proportional to k * packetLength, instead of a whole
+ * decode.  Other codes just keep the packets and decode them once there
+ * are k.
+ *
+ * An IncrementalDecoder is not thread safe, and decodes one block at a
+ * time; reset() starts the next one.
+ *
+ * For example:
+ * <code>
+ *   IncrementalDecoder dec = code.createIncrementalDecoder(packetLength);
+ *   while (!dec.isComplete()) {
+ *       ... receive a packet ...
+ *       dec.add(buf,off,index);
+ *   }
+ *   for (int i=0;i<k;i++) {
+ *       dec.getPacket(i,block,i*packetLength);
+ *   }
+ * </code>
+ */
+public abstract class IncrementalDecoder {
+
+    protected final FECCode code;
+    protected final int packetLength;
+    protected int rank;
+
+    protected IncrementalDecoder(FECCode code, int packetLength) {
+        if (packetLength < 0) {
+            throw new IllegalArgumentException("packetLength="+packetLength);
+        }
+        this.code = code;
+        this.packetLength = packetLength;
+    }
+
+    /**
+     * Absorb one packet.
+     *
+     * @param pkt The buffer holding the packet.
+     * @param off The offset of the packet within <code>pkt</code>.
+     * @param index The index of the packet, between 0 and n.
+     * @return true if the packet was useful, false if it adds nothing to
+     * the packets that were added before (a duplicate, say) or the block
+     * is already complete.
+     */
+    public abstract boolean add(byte[] pkt, int off, int index);
+
+    /**
+     * Copy source packet <code>i</code> to <code>dst</code>, if it is known.
+     *
+     * @return false if the packet can not be recovered yet.
+     */
+    public abstract boolean getPacket(int i, byte[] dst, int off);
+
+    /**
+     * Forget all packets, to start on a new block.
+     */
+    public abstract void reset();
+
+    /**
+     * @return The number of useful packets added so far.
+     */
+    public int getRank() {
+        return rank;
+    }
+
+    public boolean isComplete() {
+        return rank == code.k;
+    }
+
+    public FECCode getCode() {
+        return code;
+    }
+
+    public int getPacketLength() {
+        return packetLength;
+    }
+
+    protected void checkAdd(byte[] pkt, int off, int index) {
+        if (index < 0 || index >= code.n) {
+            throw new IllegalArgumentException("index="+index+" must be "+
+                                               "between 0 and "+code.n);
+        }
+        checkBounds(pkt,off);
+    }
+
+    protected void checkGet(int i, byte[] dst, int off) {
+        if (i < 0 || i >= code.k) {
+            throw new IllegalArgumentException("i="+i+" must be between 0 "+
+                                               "and "+code.k);
+        }
+        checkBounds(dst,off);
+    }
+
+    private void checkBounds(byte[] b, int off) {
+        if (off < 0 || off + packetLength > b.length) {
+            throw new ArrayIndexOutOfBoundsException
+                ("off="+off+",packetLength="+packetLength+",length="+
+                 b.length);
+        }
+    }
+
+    /**
+     * Collects the packets and decodes them with the code's decode() once
+     * there are k of them.  Used for codes without native support.
+     */
+    protected static class Buffered extends IncrementalDecoder {
+
+        private final byte[][] pkts;
+        private final int[] index;
+        private final BitSet seen = new BitSet();
+        private boolean decoded;
+
+        public Buffered(FECCode code, int packetLength) {
+            super(code,packetLength);
+            pkts = new byte[code.k][packetLength];
+            index = new int[code.k];
+        }
+
+        public boolean add(byte[] pkt, int off, int index) {
+            checkAdd(pkt,off,index);
+            if (isComplete() || seen.get(index)) {
+                return false;
+            }
+            seen.set(index);
+            System.arraycopy(pkt,off,pkts[rank],0,packetLength);
+            this.index[rank++] = index;
+            if (isComplete()) {
+                code.decode(pkts,new int[code.k],this.index,packetLength,
+                            false);
+                decoded = true;
+            }
+            return true;
+        }
+
+        public boolean getPacket(int i, byte[] dst, int off) {
+            checkGet(i,dst,off);
+            if (decoded) {
+                System.arraycopy(pkts[i],0,dst,off,packetLength);
+                return true;
+            }
+            for (int j=0;j<rank;j++) {
+                if (index[j] == i) {
+                    System.arraycopy(pkts[j],0,dst,off,packetLength);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        public void reset() {
+            rank = 0;
+            seen.clear();
+            decoded = false;
+        }
+    }
+}
@@ -2,6 +2,8 @@ package com.onionnetworks.fec;
 
 //import java.security.AccessController;
 //import sun.security.action.*;
+import java.nio.ByteBuffer;
+
 import com.onionnetworks.util.*;
 
 /**
@@ -20,6 +22,10 @@ public class Native16Code extends FECCode {
     // attacker the ability to point to anything in memory.
     final private long code;
 
+    // Likewise the address of the fec_pool that spreads each encode/decode
+    // over several threads, or 0 for a single threaded code.
+    final private long pool;
+
     static {
         String path = NativeDeployer.getLibraryPath
             (Native8Code.class.getClassLoader(),"fec16");
@@ -33,8 +39,25 @@ public class Native16Code extends FECCode {
     }
 
     public Native16Code(int k, int n) {
+        this(k,n,1);
+    }
+
+    /**
+     * @param threads The number of threads each encode/decode is spread
+     * over, or 0 for one per CPU.  See ParallelFECCode.
+     */
+    public Native16Code(int k, int n, int threads) {
+        this(k,n,threads,false);
+    }
+
+    /**
+     * @param cauchy Build a Cauchy code rather than a Vandermonde one.
+     * See Cauchy16Code.
+     */
+    protected Native16Code(int k, int n, int threads, boolean cauchy) {
         super(k,n);
-        code = nativeNewFEC(k,n);
+        code = cauchy ? nativeNewCauchyFEC(k,n) : nativeNewFEC(k,n);
+        pool = threads == 1 ? 0 : nativeNewPool(threads);
     }
 
     protected void encode(byte[][] src, int[] srcOff, byte[][] repair,
@@ -56,9 +79,161 @@ public class Native16Code extends FECCode {
         if (!inOrder) {
             shuffle(pkts,pktsOff,index,k);
         }
+        if (nothingMissing(index,k)) {
+            return;
+        }
         nativeDecode(pkts,pktsOff,index,k,packetLength);
     }
 
+    /**
+     * Reconstructs only the wanted packets, see fec_decode_subset().
+     */
+    protected void decodeSubset(byte[][] pkts, int[] pktsOff, int[] index,
+                                int[] want, int packetLength,
+                                boolean shuffled) {
+        if (packetLength % 2 != 0) {
+            throw new IllegalArgumentException("For 16 bit codes, buffers "+
+                                               "must be 16 bit aligned.");
+        }
+        if (!shuffled) {
+            shuffle(pkts,pktsOff,index,k);
+        }
+        if (nothingMissing(index,k)) {
+            return;
+        }
+        nativeDecodeSubset(pkts,pktsOff,index,want,k,packetLength);
+    }
+
+    /**
+     * Encodes straight out of direct buffers, falling back to the copying
+     * FECCode implementation if any of the buffers is not direct.
+     */
+    public void encode(ByteBuffer[] src, ByteBuffer[] repair, int[] index) {
+        int packetLength = checkEncode(src,repair,index);
+        if (!isDirect(src,false) || !isDirect(repair,true)) {
+            super.encode(src,repair,index);
+            return;
+        }
+        if (packetLength % 2 != 0) {
+            throw new IllegalArgumentException("For 16 bit codes, buffers "+
+                                               "must be 16 bit aligned.");
+        }
+        nativeEncodeDirect(src,positions(src,packetLength),index,repair,
+                           positions(repair,packetLength),k,packetLength);
+    }
+
+    /**
+     * Decodes in place in direct buffers, falling back to the copying
+     * FECCode implementation if any of the buffers is not direct.
+     */
+    public void decode(ByteBuffer[] pkts, int[] index) {
+        int packetLength = checkDecode(pkts,index);
+        if (!isDirect(pkts,true)) {
+            super.decode(pkts,index);
+            return;
+        }
+        if (packetLength % 2 != 0) {
+            throw new IllegalArgumentException("For 16 bit codes, buffers "+
+                                               "must be 16 bit aligned.");
+        }
+        int[] pktsOff = positions(pkts,packetLength);
+        copyShuffle(pkts,index,k);
+        if (nothingMissing(index,k)) {
+            return;
+        }
+        nativeDecodeDirect(pkts,pktsOff,index,k,packetLength);
+    }
+
+    /**
+     * Decodes direct chunks in place with fec_decode_sg(), which sets up
+     * the decoding once for all of them.  Threaded codes, and chunks that
+     * are not all direct, decode each chunk position in turn as FECCode
+     * does.
+     */
+    protected void decodeChunks(ByteBuffer[][] chunks, int[] index) {
+        if (pool != 0 || chunks.length == 0) {
+            super.decodeChunks(chunks,index);
+            return;
+        }
+        int count = chunks.length;
+        int len = chunks[0][0].remaining();
+        // chunk c of packet i at i*count+c, as fec_decode_sg() wants them
+        ByteBuffer[] flat = new ByteBuffer[k*count];
+        for (int i=0;i<k;i++) {
+            for (int c=0;c<count;c++) {
+                flat[i*count+c] = chunks[c][i];
+            }
+        }
+        if (!isDirect(flat,true)) {
+            super.decodeChunks(chunks,index);
+            return;
+        }
+        if (len % 2 != 0) {
+            throw new IllegalArgumentException("For 16 bit codes, buffers "+
+                                               "must be 16 bit aligned.");
+        }
+        nativeDecodeChunksDirect(flat,positions(flat,len),index,k,len,count);
+    }
+
+    /**
+     * Eliminates each packet as it is added, see fec_inc_add().
+     */
+    public IncrementalDecoder createIncrementalDecoder(int packetLength) {
+        if (packetLength % 2 != 0) {
+            throw new IllegalArgumentException("For 16 bit codes, buffers "+
+                                               "must be 16 bit aligned.");
+        }
+        return new Incremental(packetLength);
+    }
+
+    /**
+     * The counters the native library keeps for the (k, n) of this code, if
+     * it was built with them; see Native8Code.getStats().
+     *
+     * @return A new array of counters, or null if the library does not
+     * keep them.
+     */
+    public long[] getStats() {
+        return nativeGetStats();
+    }
+
+    private final class Incremental extends IncrementalDecoder {
+
+        // The address of a struct fec_inc, only ever read by the native
+        // code (the natives are handed this object, not the address).
+        final private long inc;
+
+        Incremental(int packetLength) {
+            super(Native16Code.this,packetLength);
+            inc = nativeNewIncremental(packetLength);
+        }
+
+        public boolean add(byte[] pkt, int off, int index) {
+            checkAdd(pkt,off,index);
+            if (nativeIncrementalAdd(this,pkt,off,index) != 1) {
+                return false;
+            }
+            rank++;
+            return true;
+        }
+
+        public boolean getPacket(int i, byte[] dst, int off) {
+            checkGet(i,dst,off);
+            return nativeIncrementalPacket(this,i,dst,off,packetLength);
+        }
+
+        public void reset() {
+            nativeIncrementalReset(this);
+            rank = 0;
+        }
+
+        // fec_inc_free() does not touch the fec_parms, so this may run
+        // before or after the code's own finalize().
+        protected void finalize() throws Throwable {
+            nativeFreeIncremental(this);
+        }
+    }
+
     protected native void nativeEncode
         (byte[][] src, int[] srcOff, int[] index, byte[][] repair,
          int[] repairOff, int k, int packetLength);
@@ -66,13 +241,55 @@ public class Native16Code extends FECCode {
     protected native void nativeDecode(byte[][] pkts, int[] pktsOff,
                                        int[] index, int k, int packetLength);
 
-    protected synchronized native long nativeNewFEC(int k, int n);
+    protected native void nativeDecodeSubset(byte[][] pkts, int[] pktsOff,
+                                             int[] index, int[] want, int k,
+                                             int packetLength);
+
+    protected native void nativeEncodeDirect
+        (ByteBuffer[] src, int[] srcOff, int[] index, ByteBuffer[] repair,
+         int[] repairOff, int k, int packetLength);
+
+    protected native void nativeDecodeDirect(ByteBuffer[] pkts, int[] pktsOff,
+                                             int[] index, int k, 
+                                             int packetLength);
+
+    protected native void nativeDecodeChunksDirect(ByteBuffer[] chunks,
+                                                   int[] chunksOff,
+                                                   int[] index, int k,
+                                                   int chunkLength,
+                                                   int count);
+
+    // The C library is thread safe (see fec.h), so none of the natives
+    // need to be synchronized.
+    protected native long nativeNewFEC(int k, int n);
+
+    protected native long nativeNewCauchyFEC(int k, int n);
+
+    protected native void nativeFreeFEC();
+
+    protected native long nativeNewPool(int threads);
+
+    protected native void nativeFreePool();
+
+    protected native long nativeNewIncremental(int packetLength);
+
+    private native int nativeIncrementalAdd(Incremental dec, byte[] pkt,
+                                            int off, int index);
+
+    private native boolean nativeIncrementalPacket(Incremental dec, int i,
+                                                   byte[] dst, int off,
+                                                   int packetLength);
+
+    private native void nativeIncrementalReset(Incremental dec);
+
+    private native void nativeFreeIncremental(Incremental dec);
 
-    protected synchronized native void nativeFreeFEC();
+    protected native long[] nativeGetStats();
 
-    protected static synchronized native void initFEC();
+    protected static native void initFEC();
 
     protected void finalize() throws Throwable {
+        nativeFreePool();
         nativeFreeFEC();
     }
 
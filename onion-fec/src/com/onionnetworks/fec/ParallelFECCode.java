@@ -0,0 +1,215 @@
+package com.onionnetworks.fec;
+
+import java.nio.ByteBuffer;
+import java.util.ArrayList;
+import java.util.Iterator;
+import java.util.List;
+import java.util.concurrent.Callable;
+import java.util.concurrent.ExecutionException;
+import java.util.concurrent.ExecutorService;
+import java.util.concurrent.Executors;
+import java.util.concurrent.Future;
+import java.util.concurrent.ThreadFactory;
+
+/**
+ * An FECCode that spreads each single encode or decode over several
+ * threads, for when the latency of one large block matters more than the
+ * aggregate throughput of many.
+ *
+ * The packets are cut into stripes of bytes, and the stripes are coded
+ * concurrently.  A native code is replaced by a native code of the same
+ * kind that owns a work-stealing thread pool in C (the decoding matrix is
+ * inverted once and shared by all stripes).  Any other code is striped in
+ * Java on a fixed thread pool; there each stripe of a decode builds its
+ * own decoding matrix, so this only pays off for large packets.  Cauchy
+ * codes are used as they are, on the calling thread.
+ *
+ * For example:
+ * <code>
+ *   FECCode code = new ParallelFECCode
+ *       (FECCodeFactory.getDefault().createFECCode(k,n), 0);
+ * </code>
+ */
+public class ParallelFECCode extends FECCode {
+
+    // Stripes are a multiple of this many bytes (and so 16 bit aligned).
+    protected static final int STRIPE_ALIGN = 64;
+
+    protected final FECCode code;
+    protected final int threads;
+    protected final ExecutorService executor;
+
+    /**
+     * @param code The code to parallelize.
+     * @param threads The number of threads to use, 0 for one per CPU.
+     */
+    public ParallelFECCode(FECCode code, int threads) {
+        super(code.k,code.n);
+        if (threads <= 0) {
+            threads = Runtime.getRuntime().availableProcessors();
+        }
+        this.threads = threads;
+        if (code instanceof Cauchy8Code || code instanceof Cauchy16Code) {
+            // Striping would change the layout of the XOR slices.
+            this.code = code;
+            this.executor = null;
+        } else if (code.getClass() == Native8Code.class) {
+            this.code = new Native8Code(k,n,threads);
+            this.executor = null;
+        } else if (code.getClass() == Native16Code.class) {
+            this.code = new Native16Code(k,n,threads);
+            this.executor = null;
+        } else {
+            this.code = code;
+            this.executor = Executors.newFixedThreadPool
+                (threads, new ThreadFactory() {
+                        public Thread newThread(Runnable r) {
+                            Thread t = new Thread(r,"ParallelFECCode");
+                            t.setDaemon(true);
+                            return t;
+                        }
+                    });
+        }
+    }
+
+    protected void encode(final byte[][] src, int[] srcOff,
+                          final byte[][] repair, int[] repairOff,
+                          final int[] index, int packetLength) {
+        if (executor == null) {
+            code.encode(src,srcOff,repair,repairOff,index,packetLength);
+            return;
+        }
+        int stripe = stripeLength(packetLength);
+        List tasks = new ArrayList();
+        for (int off=0;off<packetLength;off+=stripe) {
+            final int[] so = shift(srcOff,off);
+            final int[] ro = shift(repairOff,off);
+            final int len = Math.min(stripe,packetLength-off);
+            tasks.add(new Callable() {
+                    public Object call() {
+                        code.encode(src,so,repair,ro,index,len);
+                        return null;
+                    }
+                });
+        }
+        invokeAll(tasks);
+    }
+
+    protected void decode(final byte[][] pkts, int[] pktsOff, int[] index,
+                          int packetLength, boolean shuffled) {
+        if (executor == null) {
+            code.decode(pkts,pktsOff,index,packetLength,shuffled);
+            return;
+        }
+        // Shuffle once up front, every stripe then sees the same order.
+        if (!shuffled) {
+            shuffle(pkts,pktsOff,index,k);
+        }
+        if (nothingMissing(index,k)) {
+            return;
+        }
+        int stripe = stripeLength(packetLength);
+        List tasks = new ArrayList();
+        int[] idx = null;
+        for (int off=0;off<packetLength;off+=stripe) {
+            final int[] po = shift(pktsOff,off);
+            final int[] ix = idx = (int[]) index.clone();
+            final int len = Math.min(stripe,packetLength-off);
+            tasks.add(new Callable() {
+                    public Object call() {
+                        code.decode(pkts,po,ix,len,true);
+                        return null;
+                    }
+                });
+        }
+        invokeAll(tasks);
+        System.arraycopy(idx,0,index,0,index.length);
+    }
+
+    /**
+     * Only the wanted rows are decoded, on the calling thread: a subset is
+     * meant to be small.
+     */
+    protected void decodeSubset(byte[][] pkts, int[] pktsOff, int[] index,
+                                int[] want, int packetLength,
+                                boolean shuffled) {
+        code.decodeSubset(pkts,pktsOff,index,want,packetLength,shuffled);
+    }
+
+    public void encode(ByteBuffer[] src, ByteBuffer[] repair, int[] index) {
+        if (executor == null) {
+            code.encode(src,repair,index); // zero-copy for direct buffers
+        } else {
+            super.encode(src,repair,index);
+        }
+    }
+
+    public void decode(ByteBuffer[] pkts, int[] index) {
+        if (executor == null) {
+            code.decode(pkts,index);
+        } else {
+            super.decode(pkts,index);
+        }
+    }
+
+    public IncrementalDecoder createIncrementalDecoder(int packetLength) {
+        return code.createIncrementalDecoder(packetLength);
+    }
+
+    /**
+     * Enough stripes for every thread, rounded up to STRIPE_ALIGN bytes.
+     */
+    protected int stripeLength(int packetLength) {
+        int stripe = (packetLength + threads - 1) / threads;
+        return (stripe + STRIPE_ALIGN - 1) / STRIPE_ALIGN * STRIPE_ALIGN;
+    }
+
+    private static int[] shift(int[] offs, int off) {
+        int[] retval = new int[offs.length];
+        for (int i=0;i<offs.length;i++) {
+            retval[i] = offs[i] + off;
+        }
+        return retval;
+    }
+
+    private void invokeAll(List tasks) {
+        try {
+            List futures = executor.invokeAll(tasks);
+            for (Iterator it = futures.iterator(); it.hasNext();) {
+                ((Future) it.next()).get();
+            }
+        } catch (InterruptedException e) {
+            Thread.currentThread().interrupt();
+            throw new IllegalStateException("Interrupted while coding");
+        } catch (ExecutionException e) {
+            Throwable t = e.getCause();
+            if (t instanceof RuntimeException) {
+                throw (RuntimeException) t;
+            } else if (t instanceof Error) {
+                throw (Error) t;
+            }
+            throw new IllegalStateException(t.toString());
+        }
+    }
+
+    /**
+     * @return the code that does the actual work.
+     */
+    public FECCode getCode() {
+        return code;
+    }
+
+    public int getThreads() {
+        return threads;
+    }
+
+    protected void finalize() throws Throwable {
+        if (executor != null) {
+            executor.shutdown();
+        }
+    }
+
+    public String toString() {
+        return new String("ParallelFECCode[threads="+threads+","+code+"]");
+    }
+}
@@ -1,7 +1,7 @@
 package com.onionnetworks.fec;
 
-import com.onionnetworks.util.Util;
-import com.onionnetworks.util.Buffer;
+import java.nio.ByteBuffer;
+
 /**
  * This class, along with FECMath, provides the implementation of the pure
  * Java 16 bit FEC codes.  This is heavily dervied from Luigi Rizzos original
@@ -28,104 +28,43 @@ public class Pure16Code extends PureCode {
     */
 
     public Pure16Code(int k, int n) {
-        super(k,n,fecMath.createEncodeMatrix(k,n));
+        super(k,n,fecMath.createEncodeMatrix(k,n),fecMath);
     }
 
-    /**
-     * encode accepts as input pointers to n data packets of size sz,
-     * and produces as output a packet pointed to by fec, computed
-     * with index "index".
-     */
+    // PureCode works on the byte[]'s in place, two bytes per symbol (see
+    // FECMath.addMul16()), so all that is left here is checking lengths.
+
     protected void encode(byte[][] src, int[] srcOff, byte[][] repair, 
                           int[] repairOff, int[] index, int packetLength) {
-        if (packetLength % 2 != 0) {
-            throw new IllegalArgumentException("For 16 bit codes, buffers "+
-                                               "must be 16 bit aligned.");
-        }
-        char[][] srcChars = new char[src.length][];
-        int[] srcCharsOff = new int[src.length];
-        int numChars = packetLength/2;
-        char[] repairChars = new char[numChars];
-        for (int i=0;i<srcChars.length;i++) {
-            srcChars[i] = new char[numChars];
-            Util.arraycopy(src[i], srcOff[i], srcChars[i], 0, packetLength);
-            srcCharsOff[i] = 0;
-        }
-
-        for (int i=0;i<repair.length;i++) {
-            if (index[i] < k) { // < k, systematic so direct copy.
-                System.arraycopy(src[index[i]],srcOff[index[i]],repair[i],
-                                 repairOff[i], packetLength);
-            } else {
-                encode(srcChars,srcCharsOff,repairChars,0,index[i],numChars);
-                Util.arraycopy(repairChars,0,repair[i],repairOff[i],
-                               packetLength);
-            }
-        }
+        checkLength(packetLength);
+        super.encode(src,srcOff,repair,repairOff,index,packetLength);
     }
 
-    /**
-     * ASSERT: index >= k && index < n
-     */
-    protected void encode(char[][] src, int[] srcOff, char[] repair, 
-                          int repairOff, int index, int numChars) {
-        int pos = index*k;
-        Util.bzero(repair,repairOff,numChars);
-        for (int i=0; i<k ; i++) {
-            fecMath.addMul(repair,repairOff,src[i],srcOff[i],
-                           encMatrix[pos+i],numChars);
-        }
-    }
-    
     protected void decode(byte[][] pkts, int[] pktsOff, int[] index, 
                           int packetLength, boolean inOrder) {          
-        if (packetLength % 2 != 0) {
-            throw new IllegalArgumentException("For 16 bit codes, buffers "+
-                                               "must be 16 bit aligned.");
-        }
-
-        if (!inOrder) {
-            shuffle(pkts, pktsOff, index, k);
-        }
-
-        char[][] pktsChars = new char[pkts.length][];
-        int[] pktsCharsOff = new int[pkts.length];
-        int numChars = packetLength/2;
-        for (int i=0;i<pktsChars.length;i++) {
-            pktsChars[i] = new char[numChars];
-            Util.arraycopy(pkts[i], pktsOff[i], pktsChars[i], 0, packetLength);
-            pktsCharsOff[i] = 0;
-        }
+        checkLength(packetLength);
+        super.decode(pkts,pktsOff,index,packetLength,inOrder);
+    }
 
-        char[][] result = decode(pktsChars, pktsCharsOff, index, numChars);
+    protected void decodeSubset(byte[][] pkts, int[] pktsOff, int[] index,
+                                int[] want, int packetLength,
+                                boolean shuffled) {
+        checkLength(packetLength);
+        super.decodeSubset(pkts,pktsOff,index,want,packetLength,shuffled);
+    }
 
-        for (int i=0;i<result.length;i++) {
-            if (result[i] != null) {
-                Util.arraycopy(result[i], 0, pkts[i], pktsOff[i], 
-                               packetLength);
-                index[i] = i;
-            }
+    protected void decodeChunks(ByteBuffer[][] chunks, int[] index) {
+        if (chunks.length > 0) {
+            checkLength(chunks[0][0].remaining());
         }
+        super.decodeChunks(chunks,index);
     }
 
-    protected char[][] decode(char[][] pkts, int[] pktsOff, int[] index, 
-                          int numChars) {
-
-        char[] decMatrix = fecMath.createDecodeMatrix(encMatrix,index,k,n);
-        
-        // do the actual decoding
-        char[][] tmpPkts = new char[k][];
-        for (int row=0; row<k; row++) {
-            if (index[row] >= k) {
-                tmpPkts[row] = new char[numChars];
-                for (int col=0 ; col<k ; col++) {
-                    fecMath.addMul(tmpPkts[row],0,pkts[col],pktsOff[col], 
-                                   decMatrix[row*k + col], numChars);
-                }
-            }
+    private static void checkLength(int packetLength) {
+        if (packetLength % 2 != 0) {
+            throw new IllegalArgumentException("For 16 bit codes, buffers "+
+                                               "must be 16 bit aligned.");
         }
-
-        return tmpPkts;
     }
     
     public String toString() {
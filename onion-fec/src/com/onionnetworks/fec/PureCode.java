@@ -1,5 +1,6 @@
 package com.onionnetworks.fec;
 
+import java.nio.ByteBuffer;
 import com.onionnetworks.util.Util;
 import com.onionnetworks.util.Buffer;
 /**
@@ -19,6 +20,8 @@ public class PureCode extends FECCode {
     public static final int FEC_MAGIC = 0xFECC0DEC;
     protected static final FECMath fecMath = new FECMath(8);
     protected char[] encMatrix;
+    // The field of encMatrix, fecMath unless a subclass says otherwise.
+    protected final FECMath math;
     
     //create a new encoder. This contains n,k and the encoding matrix.
     public PureCode(int k, int n) {
@@ -26,8 +29,13 @@ public class PureCode extends FECCode {
     }
 
     public PureCode(int k, int n, char[] encMatrix) {
+        this(k,n,encMatrix,fecMath);
+    }
+
+    protected PureCode(int k, int n, char[] encMatrix, FECMath math) {
         super(k,n);
         this.encMatrix = encMatrix;
+        this.math = math;
     }
 
     /**
@@ -52,8 +60,8 @@ public class PureCode extends FECCode {
             int pos = index*k;
             Util.bzero(repair,repairOff,packetLength);
             for (int i=0; i<k ; i++) {
-                fecMath.addMul(repair,repairOff,src[i],srcOff[i],
-                                   (byte) encMatrix[pos+i],packetLength);
+                addMul(repair,repairOff,src[i],srcOff[i],encMatrix[pos+i],
+                       packetLength);
             }
         } 
     }
@@ -67,32 +75,109 @@ public class PureCode extends FECCode {
         if (!shuffled) {
             shuffle(pkts, pktsOff, index, k);
         }
+        if (nothingMissing(index,k)) {
+            return;
+        }
+
+        decodeRows(pkts,pktsOff,index,packetLength,null);
+    }
+
+    protected void decodeSubset(byte[][] pkts, int[] pktsOff, int[] index,
+                                int[] want, int packetLength,
+                                boolean shuffled) {
+        if (!shuffled) {
+            shuffle(pkts, pktsOff, index, k);
+        }
+        if (nothingMissing(index,k)) {
+            return;
+        }
+        decodeRows(pkts,pktsOff,index,packetLength,wantedRows(index,want,k));
+    }
 
-        char[] decMatrix = fecMath.createDecodeMatrix(encMatrix,index,k,n);
-        
+    /**
+     * Builds the decoding matrix once for all the chunks, rather than once
+     * per chunk as decode(ByteBuffer[],int[]) would.
+     */
+    protected void decodeChunks(ByteBuffer[][] chunks, int[] index) {
+        if (chunks.length > 0) {
+            int len = chunks[0][0].remaining();
+            char[] decMatrix = math.createDecodeMatrix(encMatrix,index,k,n);
+            byte[][] bufs = new byte[k][];
+            int[] offs = new int[k];
+            for (int c=0;c<chunks.length;c++) {
+                for (int i=0;i<k;i++) {
+                    Buffer b = toBuffer(chunks[c][i],len,true);
+                    bufs[i] = b.b;
+                    offs[i] = b.off;
+                }
+                decodeRows(decMatrix,bufs,offs,index,len,null);
+                for (int row=0;row<k;row++) {
+                    if (index[row] >= k && !chunks[c][row].hasArray()) {
+                        chunks[c][row].duplicate().put(bufs[row],offs[row],
+                                                       len);
+                    }
+                }
+            }
+        }
+        for (int row=0;row<k;row++) {
+            index[row] = row;
+        }
+    }
+
+    /**
+     * Reconstruct the missing packets of the shuffled pkts, or only the
+     * rows set in <code>rows</code> if it is not null.
+     */
+    private void decodeRows(byte[][] pkts, int[] pktsOff, int[] index,
+                            int packetLength, boolean[] rows) {
+        char[] decMatrix = math.createDecodeMatrix(encMatrix,index,k,n);
+        decodeRows(decMatrix,pkts,pktsOff,index,packetLength,rows);
+        for (int row=0;row<k;row++) {
+            if (index[row] >= k && (rows == null || rows[row])) {
+                index[row] = row;
+            }
+        }
+    }
+
+    /**
+     * The work of decodeRows(byte[][],int[],int[],int,boolean[]) with a
+     * decoding matrix already built for index, which is left alone.
+     */
+    private void decodeRows(char[] decMatrix, byte[][] pkts, int[] pktsOff,
+                            int[] index, int packetLength, boolean[] rows) {
         // do the actual decoding..
         byte[][] tmpPkts = new byte[k][];
         for (int row=0; row<k; row++) {
-            if (index[row] >= k) {
+            if (index[row] >= k && (rows == null || rows[row])) {
                 tmpPkts[row] = new byte[packetLength];
                 for (int col=0 ; col<k ; col++) {
-                    fecMath.addMul(tmpPkts[row],0,pkts[col],pktsOff[col], 
-                                   (byte) decMatrix[row*k + col],
-                                   packetLength);
+                    addMul(tmpPkts[row],0,pkts[col],pktsOff[col], 
+                           decMatrix[row*k + col],packetLength);
                 }
             }
         }
 
         // move pkts to their final destination
         for (int row=0;row < k;row++) {
-            if (index[row] >= k) { // only copy those actually decoded.
+            if (tmpPkts[row] != null) { // only copy those actually decoded.
                 System.arraycopy(tmpPkts[row],0, pkts[row],pktsOff[row],
                                  packetLength);
-                index[row] = row;
             }
         }
     }
     
+    /**
+     * dst += c * src over len bytes, in the field of the code.
+     */
+    private void addMul(byte[] dst, int dstPos, byte[] src, int srcPos,
+                        char c, int len) {
+        if (math.gfBits == 16) {
+            math.addMul16(dst,dstPos,src,srcPos,c,len);
+        } else {
+            math.addMul(dst,dstPos,src,srcPos,(byte) c,len);
+        }
+    }
+
     public String toString() {
         return new String("PureCode[k="+k+",n="+n+"]");
     }
@@ -0,0 +1,325 @@
+/*
+ * bench.c -- benchmark for the FEC library
+ *
+ * Sweeps k, n, packet size, number of erasures and addmul kernel, and
+ * prints one CSV line (or one JSON object per line) per configuration:
+ *
+ *   bits      GF_BITS of this build
+ *   code      vandermonde, or cauchy with -c (see fec_new_cauchy())
+ *   kernel    addmul kernel (see fec_kernel_name())
+ *   k, n      code parameters
+ *   size      packet size in bytes
+ *   erasures  repair packets encoded, and source packets lost on decode
+ *   repeats   timed runs (after the warmup runs) per measurement
+ *   enc_mbps  source bytes (k * size) per microsecond for fec_encode_multi
+ *   enc_cpb   TSC cycles per source byte (0 where there is no TSC)
+ *   dec_mbps  the same for fec_decode, with the decoding matrix cached
+ *   dec_cpb
+ *   matrix_us time to build and invert the decoding matrix
+ *   last_us   time the incremental decoder (fec_inc_add()) takes for the
+ *             k-th packet, 0 for Cauchy codes which it does not support
+ *
+ * Every figure is the median of the timed runs. The data is a fixed
+ * pattern and each decode is checked, so runs are reproducible; the
+ * exit status is non-zero if any decode was wrong.
+ *
+ * usage: fec8bench [-k list] [-n list] [-s list] [-e list] [-K list]
+ *                  [-w warmup] [-r repeats] [-f csv|json] [-H] [-c]
+ *
+ * Lists are comma separated. n defaults to 2k, and erasure counts that
+ * exceed min(k, n - k) are skipped. -K all (the default) runs every
+ * kernel the CPU supports. -H leaves out the CSV header, so that the
+ * output of fec8bench and fec16bench can be concatenated. -c benchmarks
+ * Cauchy codes instead, skipping sizes that are not a multiple of
+ * GF_BITS bytes; they use no multiply kernel, only its XOR routine.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "fec.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define rdtsc()	__rdtsc()
+#else
+#define rdtsc()	0
+#endif
+
+#define MAX_LIST	32
+
+static int warmup = 2, repeats = 10, json = 0, header = 1, cauchy = 0 ;
+
+static void *
+my_malloc(int sz, char *s)
+{
+    void *p = malloc(sz) ;
+    if (p != NULL)
+	return p ;
+    fprintf(stderr, "bench: malloc failure for %d bytes in <%s>\n",
+	sz, s);
+    exit(1);
+}
+
+static double
+now(void)
+{
+    struct timespec ts ;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts) ;
+    return ts.tv_sec + ts.tv_nsec * 1e-9 ;
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b ;
+
+    return x < y ? -1 : x > y ;
+}
+
+static double
+median(double *v, int n)
+{
+    qsort(v, n, sizeof(*v), cmp_double) ;
+    return n & 1 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2 ;
+}
+
+static const char *
+code_name(void)
+{
+    return cauchy ? "cauchy" : "vandermonde" ;
+}
+
+static int
+parse_list(char *s, int *v)
+{
+    int n = 0 ;
+    char *tok ;
+
+    for (tok = strtok(s, ",") ; tok != NULL && n < MAX_LIST ;
+	    tok = strtok(NULL, ","))
+	v[n++] = atoi(tok) ;
+    return n ;
+}
+
+/*
+ * Runs one configuration with the current kernel. Returns the number
+ * of wrongly decoded packets.
+ */
+static int
+bench(int k, int n, int sz, int e)
+{
+    void *code = cauchy ? fec_new_cauchy(k, n) : fec_new(k, n) ;
+    gf **src, **rep, **saved, **pkt ;
+    int *ienc, *ix ;
+    double *t, *c, t0 ;
+    unsigned long long c0 ;
+    double enc_t, enc_c, dec_t, dec_c, mat_t, last_t = 0, bytes = (double)k * sz ;
+    void *inc ;
+    int i, j, run, errors = 0, runs = warmup + repeats ;
+
+    src = my_malloc(k * sizeof(gf *), "src") ;
+    pkt = my_malloc(k * sizeof(gf *), "pkt") ;
+    ix = my_malloc(k * sizeof(int), "ix") ;
+    rep = my_malloc(e * sizeof(gf *), "rep") ;
+    saved = my_malloc(e * sizeof(gf *), "saved") ;
+    ienc = my_malloc(e * sizeof(int), "ienc") ;
+    t = my_malloc(runs * sizeof(double), "times") ;
+    c = my_malloc(runs * sizeof(double), "cycles") ;
+    for (i = 0 ; i < k ; i++) {
+	src[i] = my_malloc(sz, "src data") ;
+	for (j = 0 ; j < sz ; j++)
+	    ((unsigned char *)src[i])[j] = (unsigned char)(j * 31 + i * 7 + 1) ;
+    }
+    for (i = 0 ; i < e ; i++) {
+	rep[i] = my_malloc(sz, "rep data") ;
+	saved[i] = my_malloc(sz, "saved data") ;
+	ienc[i] = k + (int)((long)i * (n - k) / e) ;	/* spread over n - k */
+    }
+
+    for (run = 0 ; run < runs ; run++) {
+	t0 = now() ;
+	c0 = rdtsc() ;
+	fec_encode_multi(code, src, rep, ienc, e, sz) ;
+	c[run] = (double)(rdtsc() - c0) ;
+	t[run] = now() - t0 ;
+    }
+    enc_t = median(t + warmup, repeats) ;
+    enc_c = median(c + warmup, repeats) ;
+    for (i = 0 ; i < e ; i++)
+	memcpy(saved[i], rep[i], sz) ;
+
+    /* lose the first e source packets, receive the e repair packets */
+    for (run = 0 ; run < runs ; run++) {
+	for (i = 0 ; i < k ; i++) {
+	    pkt[i] = i < e ? rep[i] : src[i] ;
+	    ix[i] = i < e ? ienc[i] : i ;
+	}
+	for (i = 0 ; i < e ; i++)
+	    memcpy(rep[i], saved[i], sz) ;
+	t0 = now() ;
+	c0 = rdtsc() ;
+	fec_decode(code, pkt, ix, sz) ;
+	c[run] = (double)(rdtsc() - c0) ;
+	t[run] = now() - t0 ;
+	if (run == 0)
+	    for (i = 0 ; i < e ; i++)
+		if (memcmp(pkt[i], src[i], sz)) {
+		    fprintf(stderr, "error: k %d n %d size %d: packet %d "
+			"decoded wrong\n", k, n, sz, i) ;
+		    errors++ ;
+		}
+    }
+    dec_t = median(t + warmup, repeats) ;
+    dec_c = median(c + warmup, repeats) ;
+
+    /* a decode of a single symbol with the cache off is all matrix */
+    fec_set_decode_cache_size(code, 0) ;
+    for (run = 0 ; run < runs ; run++) {
+	for (i = 0 ; i < k ; i++) {
+	    pkt[i] = i < e ? rep[i] : src[i] ;
+	    ix[i] = i < e ? ienc[i] : i ;
+	}
+	t0 = now() ;
+	fec_decode(code, pkt, ix, cauchy ? GF_BITS : sizeof(gf)) ;
+	t[run] = now() - t0 ;
+    }
+    mat_t = median(t + warmup, repeats) ;
+
+    /* the same packets through the incremental decoder */
+    if (!cauchy) {
+	inc = fec_inc_new(code, sz) ;
+	for (run = 0 ; run < runs ; run++) {
+	    fec_inc_reset(inc) ;
+	    for (i = 0 ; i < k - 1 ; i++)
+		fec_inc_add(inc, i < e ? saved[i] : src[i], i < e ? ienc[i] : i) ;
+	    t0 = now() ;
+	    fec_inc_add(inc, k - 1 < e ? saved[k - 1] : src[k - 1],
+		k - 1 < e ? ienc[k - 1] : k - 1) ;
+	    t[run] = now() - t0 ;
+	}
+	last_t = median(t + warmup, repeats) ;
+	fec_inc_free(inc) ;
+    }
+
+    if (json)
+	printf("{\"bits\":%d,\"code\":\"%s\",\"kernel\":\"%s\","
+	    "\"k\":%d,\"n\":%d,"
+	    "\"size\":%d,\"erasures\":%d,\"repeats\":%d,"
+	    "\"enc_mbps\":%.1f,\"enc_cpb\":%.3f,"
+	    "\"dec_mbps\":%.1f,\"dec_cpb\":%.3f,\"matrix_us\":%.1f,"
+	    "\"last_us\":%.1f}\n",
+	    GF_BITS, code_name(), fec_get_kernel(), k, n, sz, e, repeats,
+	    bytes / enc_t / 1e6, enc_c / bytes,
+	    bytes / dec_t / 1e6, dec_c / bytes, mat_t * 1e6, last_t * 1e6) ;
+    else
+	printf("%d,%s,%s,%d,%d,%d,%d,%d,%.1f,%.3f,%.1f,%.3f,%.1f,%.1f\n",
+	    GF_BITS, code_name(), fec_get_kernel(), k, n, sz, e, repeats,
+	    bytes / enc_t / 1e6, enc_c / bytes,
+	    bytes / dec_t / 1e6, dec_c / bytes, mat_t * 1e6, last_t * 1e6) ;
+    fflush(stdout) ;
+
+    for (i = 0 ; i < k ; i++)
+	free(src[i]) ;
+    for (i = 0 ; i < e ; i++) {
+	free(rep[i]) ;
+	free(saved[i]) ;
+    }
+    free(src) ; free(pkt) ; free(ix) ;
+    free(rep) ; free(saved) ; free(ienc) ;
+    free(t) ; free(c) ;
+    fec_free(code) ;
+    return errors ;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: fec%dbench [-k list] [-n list] [-s list] "
+	"[-e list] [-K list|all]\n"
+	"\t[-w warmup] [-r repeats] [-f csv|json] [-H] [-c]\n", GF_BITS) ;
+    exit(2) ;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int ks[MAX_LIST] = { 16, 32, 64, 128 }, nk = 4 ;
+    int ns[MAX_LIST] = { 0 }, nn = 1 ;
+    int sizes[MAX_LIST] = { 1024, 4096, 16384 }, nsizes = 3 ;
+    int es[MAX_LIST] = { 1, 4, 16 }, ne = 3 ;
+    char *kernels = "all" ;
+    const char *kname ;
+    int a, b, c, d, kern, n, ch, errors = 0 ;
+
+    while ((ch = getopt(argc, argv, "k:n:s:e:K:w:r:f:Hc")) != -1) {
+	switch (ch) {
+	case 'k': nk = parse_list(optarg, ks) ; break ;
+	case 'n': nn = parse_list(optarg, ns) ; break ;
+	case 's': nsizes = parse_list(optarg, sizes) ; break ;
+	case 'e': ne = parse_list(optarg, es) ; break ;
+	case 'K': kernels = optarg ; break ;
+	case 'w': warmup = atoi(optarg) ; break ;
+	case 'r': repeats = atoi(optarg) ; break ;
+	case 'f':
+	    if (strcmp(optarg, "json") == 0)
+		json = 1 ;
+	    else if (strcmp(optarg, "csv") != 0)
+		usage() ;
+	    break ;
+	case 'H': header = 0 ; break ;
+	case 'c': cauchy = 1 ; break ;
+	default: usage() ;
+	}
+    }
+    if (warmup < 0 || repeats < 1)
+	usage() ;
+
+    if (!json && header)
+	printf("bits,code,kernel,k,n,size,erasures,repeats,"
+	    "enc_mbps,enc_cpb,dec_mbps,dec_cpb,matrix_us,last_us\n") ;
+
+    for (kern = 0 ; (kname = fec_kernel_name(kern)) != NULL ; kern++) {
+	if (strcmp(kernels, "all") != 0) {
+	    char list[256], *tok ;
+	    int found = 0 ;
+
+	    strncpy(list, kernels, sizeof(list) - 1) ;
+	    list[sizeof(list) - 1] = '\0' ;
+	    for (tok = strtok(list, ",") ; tok != NULL ; tok = strtok(NULL, ","))
+		if (strcmp(tok, kname) == 0)
+		    found = 1 ;
+	    if (!found)
+		continue ;
+	}
+	if (fec_set_kernel(kname)) {
+	    fprintf(stderr, "kernel %s not supported by this CPU\n", kname) ;
+	    continue ;
+	}
+	for (a = 0 ; a < nk ; a++)
+	for (b = 0 ; b < nn ; b++) {
+	    int k = ks[a] ;
+
+	    n = ns[b] > 0 ? ns[b] : 2 * k ;
+	    if (n > GF_SIZE + 1)
+		n = GF_SIZE + 1 ;
+	    if (k < 1 || k >= n) {
+		fprintf(stderr, "skipping k %d n %d\n", k, n) ;
+		continue ;
+	    }
+	    for (c = 0 ; c < nsizes ; c++)
+	    for (d = 0 ; d < ne ; d++) {
+		if (sizes[c] < 1 || sizes[c] % sizeof(gf) != 0 ||
+			(cauchy && sizes[c] % GF_BITS != 0) ||
+			es[d] < 1 || es[d] > k || es[d] > n - k)
+		    continue ;
+		errors += bench(k, n, sizes[c], es[d]) ;
+	    }
+	}
+    }
+    fec_set_kernel(NULL) ;
+    return errors != 0 ;
+}
@@ -23,6 +23,38 @@ JNIEXPORT void JNICALL Java_com_onionnetworks_fec_Native8Code_nativeEncode
 JNIEXPORT void JNICALL Java_com_onionnetworks_fec_Native8Code_nativeDecode
   (JNIEnv *, jobject, jobjectArray, jintArray, jintArray, jint, jint);
 
+/*
+ * Class:     com_onionnetworks_fec_Native8Code
+ * Method:    nativeDecodeSubset
+ * Signature: ([[B[I[I[III)V
+ */
+JNIEXPORT void JNICALL Java_com_onionnetworks_fec_Native8Code_nativeDecodeSubset
+  (JNIEnv *, jobject, jobjectArray, jintArray, jintArray, jintArray, jint, jint);
+
+/*
+ * Class:     com_onionnetworks_fec_Native8Code
+ * Method:    nativeEncodeDirect
+ * Signature: ([Ljava/nio/ByteBuffer;[I[I[Ljava/nio/ByteBuffer;[III)V
+ */
+JNIEXPORT void JNICALL Java_com_onionnetworks_fec_Native8Code_nativeEncodeDirect
+  (JNIEnv *, jobject, jobjectArray, jintArray, jintArray, jobjectArray, jintArray, jint, jint);
+
+/*
+ * Class:     com_onionnetworks_fec_Native8Code
+ * Method:    nativeDecodeDirect
+ * Signature: ([Ljava/nio/ByteBuffer;[I[III)V
+ */
+JNIEXPORT void JNICALL Java_com_onionnetworks_fec_Native8Code_nativeDecodeDirect
+  (JNIEnv *, jobject, jobjectArray, jintArray, jintArray, jint, jint);
+
+/*
+ * Class:     com_onionnetworks_fec_Native8Code
+ * Method:    nativeDecodeChunksDirect
+ * Signature: ([Ljava/nio/ByteBuffer;[I[IIII)V
+ */
+JNIEXPORT void JNICALL Java_com_onionnetworks_fec_Native8Code_nativeDecodeChunksDirect
+  (JNIEnv *, jobject, jobjectArray, jintArray, jintArray, jint, jint, jint);
+
 /*
  * Class:     com_onionnetworks_fec_Native8Code
  * Method:    nativeNewFEC
@@ -31,6 +63,14 @@ JNIEXPORT void JNICALL Java_com_onionnetworks_fec_Native8Code_nativeDecode
 JNIEXPORT jlong JNICALL Java_com_onionnetworks_fec_Native8Code_nativeNewFEC
   (JNIEnv *, jobject, jint, jint);
 
+/*
+ * Class:     com_onionnetworks_fec_Native8Code
+ * Method:    nativeNewCauchyFEC
+ * Signature: (II)J
+ */
+JNIEXPORT jlong JNICALL Java_com_onionnetworks_fec_Native8Code_nativeNewCauchyFEC
+  (JNIEnv *, jobject, jint, jint);
+
 /*
  * Class:     com_onionnetworks_fec_Native8Code
  * Method:    nativeFreeFEC
@@ -39,6 +79,70 @@ JNIEXPORT jlong JNICALL Java_com_onionnetworks_fec_Native8Code_nativeNewFEC
 JNIEXPORT void JNICALL Java_com_onionnetworks_fec_Native8Code_nativeFreeFEC
   (JNIEnv *, jobject);
 
+/*
+ * Class:     com_onionnetworks_fec_Native8Code
+ * Method:    nativeNewPool
+ * Signature: (I)J
+ */
+JNIEXPORT jlong JNICALL Java_com_onionnetworks_fec_Native8Code_nativeNewPool
+  (JNIEnv *, jobject, jint);
+
+/*
+ * Class:     com_onionnetworks_fec_Native8Code
+ * Method:    nativeFreePool
+ * Signature: ()V
+ */
+JNIEXPORT void JNICALL Java_com_onionnetworks_fec_Native8Code_nativeFreePool
+  (JNIEnv *, jobject);
+
+/*
+ * Class:     com_onionnetworks_fec_Native8Code
+ * Method:    nativeNewIncremental
+ * Signature: (I)J
+ */
+JNIEXPORT jlong JNICALL Java_com_onionnetworks_fec_Native8Code_nativeNewIncremental
+  (JNIEnv *, jobject, jint);
+
+/*
+ * Class:     com_onionnetworks_fec_Native8Code
+ * Method:    nativeIncrementalAdd
+ * Signature: (Lcom/onionnetworks/fec/Native8Code$Incremental;[BII)I
+ */
+JNIEXPORT jint JNICALL Java_com_onionnetworks_fec_Native8Code_nativeIncrementalAdd
+  (JNIEnv *, jobject, jobject, jbyteArray, jint, jint);
+
+/*
+ * Class:     com_onionnetworks_fec_Native8Code
+ * Method:    nativeIncrementalPacket
+ * Signature: (Lcom/onionnetworks/fec/Native8Code$Incremental;I[BII)Z
+ */
+JNIEXPORT jboolean JNICALL Java_com_onionnetworks_fec_Native8Code_nativeIncrementalPacket
+  (JNIEnv *, jobject, jobject, jint, jbyteArray, jint, jint);
+
+/*
+ * Class:     com_onionnetworks_fec_Native8Code
+ * Method:    nativeIncrementalReset
+ * Signature: (Lcom/onionnetworks/fec/Native8Code$Incremental;)V
+ */
+JNIEXPORT void JNICALL Java_com_onionnetworks_fec_Native8Code_nativeIncrementalReset
+  (JNIEnv *, jobject, jobject);
+
+/*
+ * Class:     com_onionnetworks_fec_Native8Code
+ * Method:    nativeFreeIncremental
+ * Signature: (Lcom/onionnetworks/fec/Native8Code$Incremental;)V
+ */
+JNIEXPORT void JNICALL Java_com_onionnetworks_fec_Native8Code_nativeFreeIncremental
+  (JNIEnv *, jobject, jobject);
+
+/*
+ * Class:     com_onionnetworks_fec_Native8Code
+ * Method:    nativeGetStats
+ * Signature: ()[J
+ */
+JNIEXPORT jlongArray JNICALL Java_com_onionnetworks_fec_Native8Code_nativeGetStats
+  (JNIEnv *, jobject);
+
 /*
  * Class:     com_onionnetworks_fec_Native8Code
  * Method:    initFEC
@@ -16,9 +16,11 @@
 
 #if GF_BITS == 8
 #include "com_onionnetworks_fec_Native8Code.h"
+#define FEC_CLASS "com/onionnetworks/fec/Native8Code"
 #define FEC_METHOD(NAME) Java_com_onionnetworks_fec_Native8 ## Code_ ## NAME
 #elif GF_BITS == 16
 #include "com_onionnetworks_fec_Native16Code.h"
+#define FEC_CLASS "com/onionnetworks/fec/Native16Code"
 #define FEC_METHOD(NAME) Java_com_onionnetworks_fec_Native16 ## Code_ ## NAME
 #else
 #error Unsupported GF_BITS
@@ -38,7 +40,7 @@
 ** @param ENV: JNI environment for setting the pending exception
 */
 #define malloc_or_oom(CLEANUP, PTR, TYPE, NUM, ENV) \
-    PTR = (TYPE *) malloc(sizeof(TYPE) * NUM); \
+    PTR = (TYPE *) malloc(sizeof(TYPE) * (NUM)); \
     if (PTR == NULL) { \
         (*ENV)->ThrowNew(ENV, (*ENV)->FindClass(ENV, "java/lang/OutOfMemoryError"), "malloc failed"); \
         goto CLEANUP; \
@@ -58,9 +60,19 @@
     if (PTR == NULL) { goto CLEANUP; } \
 
 jfieldID codeField;
+jfieldID poolField;
+static jfieldID incField;
 JNIEXPORT void JNICALL FEC_METHOD(initFEC)
   (JNIEnv * env, jclass clz) {
+    jclass inc;
+
+    init_fec();
     codeField = (*env)->GetFieldID(env, clz, "code", "J");
+    poolField = (*env)->GetFieldID(env, clz, "pool", "J");
+    inc = (*env)->FindClass(env, FEC_CLASS "$Incremental");
+    if (inc != NULL) {
+        incField = (*env)->GetFieldID(env, inc, "inc", "J");
+    }
 }
 
 /*
@@ -81,14 +93,15 @@ JNIEXPORT void JNICALL FEC_METHOD(nativeEncode)
 
     int i, numRet;
     jlong code = (*env)->GetLongField(env, obj, codeField);
+    jlong pool = (*env)->GetLongField(env, obj, poolField);
+
+    numRet = (*env)->GetArrayLength(env, ret);
 
     /* allocate memory for the arrays */
     malloc_or_oom(nativeEncode_cleanup_inArr, inArr, jbyteArray, k, env);
-    malloc_or_oom(nativeEncode_cleanup_retArr, retArr, jbyteArray, k, env);
+    malloc_or_oom(nativeEncode_cleanup_retArr, retArr, jbyteArray, numRet, env);
     malloc_or_oom(nativeEncode_cleanup_inarr, inarr, jbyte *, k, env);
-    malloc_or_oom(nativeEncode_cleanup_retarr, retarr, jbyte *, k, env);
-
-    numRet = (*env)->GetArrayLength(env, ret);
+    malloc_or_oom(nativeEncode_cleanup_retarr, retarr, jbyte *, numRet, env);
 
     /* PushLocalFrame reserves enough space for local variable references
      *
@@ -132,10 +145,16 @@ JNIEXPORT void JNICALL FEC_METHOD(nativeEncode)
         retarr[i] += localRetOff[i];
     }
 
-    for (i=0; i<numRet; i++) {
-        fec_encode((void *)(uintptr_t)code, (gf **)(uintptr_t)inarr, (void *)(uintptr_t)retarr[i],
-                   (int)localIndex[i], (int)packetLength);
-    }
+    /* all repair packets in one pass over the source */
+    if (pool)
+        fec_encode_parallel((void *)(uintptr_t)pool, (void *)(uintptr_t)code,
+                            (gf **)(uintptr_t)inarr, (gf **)(uintptr_t)retarr,
+                            (int *)(uintptr_t)localIndex, numRet,
+                            (int)packetLength);
+    else
+        fec_encode_multi((void *)(uintptr_t)code, (gf **)(uintptr_t)inarr,
+                         (gf **)(uintptr_t)retarr, (int *)(uintptr_t)localIndex,
+                         numRet, (int)packetLength);
 
     for (i=0; i<k; i++) {
         inarr[i] -= localSrcOff[i];
@@ -169,17 +188,20 @@ JNIEXPORT void JNICALL FEC_METHOD(nativeEncode)
  * been shuffled in the encode() call, so we must pre-shuffle the data
  * so that encode doesn't move any pointers around.
  */
-JNIEXPORT void JNICALL FEC_METHOD(nativeDecode)
-    (JNIEnv *env, jobject obj, jobjectArray data, jintArray dataOff,
-     jintArray whichdata, jint k, jint packetLength) {
+static void
+decode_arrays(JNIEnv *env, jobject obj, jobjectArray data, jintArray dataOff,
+              jintArray whichdata, jintArray wanted, jint k,
+              jint packetLength) {
 
-    jint *localWhich, *localDataOff;
+    jint *localWhich, *localDataOff, *localWanted = NULL;
+    jsize nwanted = 0;
     jbyteArray *inArr;
     jbyte **inarr;
     jobject result = NULL;
 
     int i;
     jlong code = (*env)->GetLongField(env, obj, codeField);
+    jlong pool = (*env)->GetLongField(env, obj, poolField);
 
     /* allocate memory for the arrays */
     malloc_or_oom(nativeDecode_cleanup_inArr, inArr, jbyteArray, k, env);
@@ -187,7 +209,7 @@ JNIEXPORT void JNICALL FEC_METHOD(nativeDecode)
 
     /* PushLocalFrame reserves enough space for local variable references
      *
-     * - 2 calls to GetIntArrayElements
+     * - 3 calls to GetIntArrayElements
      * - k calls to GetPrimitiveArrayCritical
      *
      * TODO: the JNI documentation at
@@ -209,7 +231,7 @@ JNIEXPORT void JNICALL FEC_METHOD(nativeDecode)
      *
      * Leaving in for now because I'm not a JNI expert.
      */
-    if ((*env)->PushLocalFrame(env, 2+k) < 0) {
+    if ((*env)->PushLocalFrame(env, 3+k) < 0) {
         goto nativeDecode_cleanup; /* exception: OutOfMemoryError */
     }
 
@@ -219,6 +241,12 @@ JNIEXPORT void JNICALL FEC_METHOD(nativeDecode)
     localWhich = (*env)->GetIntArrayElements(env, whichdata, NULL);
     nonnull_or_oom(nativeDecode_cleanup, localWhich);
 
+    if (wanted != NULL) {
+        nwanted = (*env)->GetArrayLength(env, wanted);
+        localWanted = (*env)->GetIntArrayElements(env, wanted, NULL);
+        nonnull_or_oom(nativeDecode_cleanup, localWanted);
+    }
+
     for (i=0; i<k; i++) {
         inArr[i] = ((*env)->GetObjectArrayElement(env, data, i));
         nonnull_or_oom(nativeDecode_cleanup, inArr[i]);
@@ -229,7 +257,12 @@ JNIEXPORT void JNICALL FEC_METHOD(nativeDecode)
         inarr[i] += localDataOff[i];
     }
 
-    fec_decode((struct fec_parms *)(intptr_t)code, (gf **)(intptr_t)inarr, (int *)(intptr_t)localWhich, (int)packetLength);
+    if (localWanted != NULL)
+        fec_decode_subset((struct fec_parms *)(intptr_t)code, (gf **)(intptr_t)inarr, (int *)(intptr_t)localWhich, (int)packetLength, (int *)(intptr_t)localWanted, (int)nwanted);
+    else if (pool)
+        fec_decode_parallel((struct fec_pool *)(intptr_t)pool, (struct fec_parms *)(intptr_t)code, (gf **)(intptr_t)inarr, (int *)(intptr_t)localWhich, (int)packetLength);
+    else
+        fec_decode((struct fec_parms *)(intptr_t)code, (gf **)(intptr_t)inarr, (int *)(intptr_t)localWhich, (int)packetLength);
 
     for (i=0; i<k; i++) {
         inarr[i] -= localDataOff[i];
@@ -237,6 +270,8 @@ JNIEXPORT void JNICALL FEC_METHOD(nativeDecode)
         (*env)->ReleasePrimitiveArrayCritical(env, inArr[i], inarr[i], 0);
     }
 
+    if (localWanted != NULL)
+        (*env)->ReleaseIntArrayElements(env, wanted, localWanted, JNI_ABORT);
     (*env)->ReleaseIntArrayElements(env, whichdata, localWhich, 0);
     (*env)->ReleaseIntArrayElements(env, dataOff, localDataOff, 0);
 
@@ -250,14 +285,325 @@ JNIEXPORT void JNICALL FEC_METHOD(nativeDecode)
     return;
 }
 
+JNIEXPORT void JNICALL FEC_METHOD(nativeDecode)
+    (JNIEnv *env, jobject obj, jobjectArray data, jintArray dataOff,
+     jintArray whichdata, jint k, jint packetLength) {
+    decode_arrays(env, obj, data, dataOff, whichdata, NULL, k, packetLength);
+}
+
+/*
+ * nativeDecode reconstructing only the source packets listed in wanted,
+ * see fec_decode_subset().  Always serial: the pool only speeds up
+ * decoding whole blocks.
+ */
+JNIEXPORT void JNICALL FEC_METHOD(nativeDecodeSubset)
+    (JNIEnv *env, jobject obj, jobjectArray data, jintArray dataOff,
+     jintArray whichdata, jintArray wanted, jint k, jint packetLength) {
+    decode_arrays(env, obj, data, dataOff, whichdata, wanted, k,
+                  packetLength);
+}
+
+/*
+ * Direct ByteBuffer variants.  Packets are addressed through
+ * GetDirectBufferAddress, so nothing is pinned and the GC keeps running
+ * while we encode or decode.  Pointer and offset arrays for up to
+ * FEC_STACK_PKTS packets live on the stack; only 16 bit codes with more
+ * packets than that fall back to malloc.
+ */
+#define FEC_STACK_PKTS 256
+
+/*
+ * Store the address of bufs[i] plus off[i] in ptrs[i] for each of the num
+ * buffers.  Returns 0 with a pending exception if a buffer is null or not
+ * direct.  The local references are dropped as we go; the buffers stay
+ * reachable through the array.
+ */
+static int
+direct_addresses(JNIEnv *env, jobjectArray bufs, const jint *off, int num,
+                 gf **ptrs)
+{
+    jobject buf;
+    jbyte *addr;
+    int i;
+
+    for (i=0; i<num; i++) {
+        buf = (*env)->GetObjectArrayElement(env, bufs, i);
+        if (buf == NULL) {
+            if (!(*env)->ExceptionCheck(env)) {
+                (*env)->ThrowNew(env, (*env)->FindClass(env, "java/lang/NullPointerException"), "null buffer");
+            }
+            return 0;
+        }
+        addr = (*env)->GetDirectBufferAddress(env, buf);
+        (*env)->DeleteLocalRef(env, buf);
+        if (addr == NULL) {
+            (*env)->ThrowNew(env, (*env)->FindClass(env, "java/lang/IllegalArgumentException"), "not a direct buffer");
+            return 0;
+        }
+        ptrs[i] = (gf *)(addr + off[i]);
+    }
+    return 1;
+}
+
+JNIEXPORT void JNICALL FEC_METHOD(nativeEncodeDirect)
+  (JNIEnv *env, jobject obj, jobjectArray src, jintArray srcOff,
+    jintArray index, jobjectArray ret, jintArray retOff, jint k,
+    jint packetLength) {
+
+    gf *stackPtrs[2*FEC_STACK_PKTS];
+    jint stackInts[3*FEC_STACK_PKTS];
+    gf **ptrs = stackPtrs;
+    jint *ints = stackInts;
+
+    int numRet;
+    jlong code = (*env)->GetLongField(env, obj, codeField);
+    jlong pool = (*env)->GetLongField(env, obj, poolField);
+
+    numRet = (*env)->GetArrayLength(env, ret);
+
+    if (k > FEC_STACK_PKTS || numRet > FEC_STACK_PKTS) {
+        malloc_or_oom(nativeEncodeDirect_cleanup, ptrs, gf *, k+numRet, env);
+        malloc_or_oom(nativeEncodeDirect_cleanup, ints, jint, k+2*numRet, env);
+    }
+
+    /* ints holds srcOff, then index, then retOff */
+    (*env)->GetIntArrayRegion(env, srcOff, 0, k, ints);
+    (*env)->GetIntArrayRegion(env, index, 0, numRet, ints+k);
+    (*env)->GetIntArrayRegion(env, retOff, 0, numRet, ints+k+numRet);
+    if ((*env)->ExceptionCheck(env)) {
+        goto nativeEncodeDirect_cleanup;
+    }
+
+    if (!direct_addresses(env, src, ints, k, ptrs) ||
+        !direct_addresses(env, ret, ints+k+numRet, numRet, ptrs+k)) {
+        goto nativeEncodeDirect_cleanup;
+    }
+
+    if (pool)
+        fec_encode_parallel((void *)(uintptr_t)pool, (void *)(uintptr_t)code,
+                            ptrs, ptrs+k, (int *)(uintptr_t)(ints+k), numRet,
+                            (int)packetLength);
+    else
+        fec_encode_multi((void *)(uintptr_t)code, ptrs, ptrs+k,
+                         (int *)(uintptr_t)(ints+k), numRet, (int)packetLength);
+
+    nativeEncodeDirect_cleanup:
+    if (ints != stackInts) free(ints);
+    if (ptrs != stackPtrs) free(ptrs);
+    return;
+}
+
+/*
+ * Like nativeDecode, the packets MUST be preshuffled by the caller.
+ */
+JNIEXPORT void JNICALL FEC_METHOD(nativeDecodeDirect)
+    (JNIEnv *env, jobject obj, jobjectArray data, jintArray dataOff,
+     jintArray whichdata, jint k, jint packetLength) {
+
+    gf *stackPtrs[FEC_STACK_PKTS];
+    jint stackInts[2*FEC_STACK_PKTS];
+    gf **ptrs = stackPtrs;
+    jint *ints = stackInts;
+
+    jlong code = (*env)->GetLongField(env, obj, codeField);
+    jlong pool = (*env)->GetLongField(env, obj, poolField);
+
+    if (k > FEC_STACK_PKTS) {
+        malloc_or_oom(nativeDecodeDirect_cleanup, ptrs, gf *, k, env);
+        malloc_or_oom(nativeDecodeDirect_cleanup, ints, jint, 2*k, env);
+    }
+
+    /* ints holds dataOff, then whichdata */
+    (*env)->GetIntArrayRegion(env, dataOff, 0, k, ints);
+    (*env)->GetIntArrayRegion(env, whichdata, 0, k, ints+k);
+    if ((*env)->ExceptionCheck(env)) {
+        goto nativeDecodeDirect_cleanup;
+    }
+
+    if (!direct_addresses(env, data, ints, k, ptrs)) {
+        goto nativeDecodeDirect_cleanup;
+    }
+
+    if (pool)
+        fec_decode_parallel((struct fec_pool *)(intptr_t)pool,
+                            (struct fec_parms *)(intptr_t)code, ptrs,
+                            (int *)(intptr_t)(ints+k), (int)packetLength);
+    else
+        fec_decode((struct fec_parms *)(intptr_t)code, ptrs,
+                   (int *)(intptr_t)(ints+k), (int)packetLength);
+
+    (*env)->SetIntArrayRegion(env, whichdata, 0, k, ints+k);
+
+    nativeDecodeDirect_cleanup:
+    if (ints != stackInts) free(ints);
+    if (ptrs != stackPtrs) free(ptrs);
+    return;
+}
+
+/*
+ * The chunks of k preshuffled packets, chunk c of packet i at
+ * chunks[i*count + c], decoded in place by fec_decode_sg() so that the
+ * decoding matrix is set up once for all of them.
+ */
+JNIEXPORT void JNICALL FEC_METHOD(nativeDecodeChunksDirect)
+    (JNIEnv *env, jobject obj, jobjectArray chunks, jintArray chunksOff,
+     jintArray whichdata, jint k, jint chunkLength, jint count) {
+
+    gf **ptrs = NULL;
+    void **addrs = NULL;
+    jint *ints = NULL;
+    struct fec_sg *sg = NULL;
+    int i, num = k*count;
+
+    jlong code = (*env)->GetLongField(env, obj, codeField);
+
+    malloc_or_oom(nativeDecodeChunksDirect_cleanup, ptrs, gf *, num, env);
+    malloc_or_oom(nativeDecodeChunksDirect_cleanup, addrs, void *, num, env);
+    malloc_or_oom(nativeDecodeChunksDirect_cleanup, ints, jint, num+k, env);
+    malloc_or_oom(nativeDecodeChunksDirect_cleanup, sg, struct fec_sg, k, env);
+
+    /* ints holds chunksOff, then whichdata */
+    (*env)->GetIntArrayRegion(env, chunksOff, 0, num, ints);
+    (*env)->GetIntArrayRegion(env, whichdata, 0, k, ints+num);
+    if ((*env)->ExceptionCheck(env)) {
+        goto nativeDecodeChunksDirect_cleanup;
+    }
+
+    if (!direct_addresses(env, chunks, ints, num, ptrs)) {
+        goto nativeDecodeChunksDirect_cleanup;
+    }
+
+    for (i=0; i<num; i++) {
+        addrs[i] = ptrs[i];
+    }
+    for (i=0; i<k; i++) {
+        sg[i].base = NULL;
+        sg[i].stride = 0;
+        sg[i].chunks = addrs + i*count;
+    }
+
+    fec_decode_sg((struct fec_parms *)(intptr_t)code, sg,
+                  (int *)(intptr_t)(ints+num), (int)chunkLength, (int)count);
+
+    (*env)->SetIntArrayRegion(env, whichdata, 0, k, ints+num);
+
+    nativeDecodeChunksDirect_cleanup:
+    free(sg);
+    free(ints);
+    free(addrs);
+    free(ptrs);
+    return;
+}
+
 JNIEXPORT jlong JNICALL FEC_METHOD(nativeNewFEC)
     (JNIEnv * env, jobject obj, jint k, jint n) {
     // uintptr_t is needed for systems where sizeof(void*) < sizeof(long)
     return (jlong)(uintptr_t)fec_new(k,n);
 }
 
+/*
+ * A Cauchy code (see Cauchy8Code and fec_new_cauchy()), freed with
+ * nativeFreeFEC like any other.
+ */
+JNIEXPORT jlong JNICALL FEC_METHOD(nativeNewCauchyFEC)
+    (JNIEnv * env, jobject obj, jint k, jint n) {
+    return (jlong)(uintptr_t)fec_new_cauchy(k,n);
+}
+
 JNIEXPORT void JNICALL FEC_METHOD(nativeFreeFEC)
     (JNIEnv * env, jobject obj) {
     jlong code = (*env)->GetLongField(env, obj, codeField);
     fec_free((void *)(uintptr_t)code);
 }
+
+/*
+ * The thread pool of a parallel code (see ParallelFECCode).
+ */
+JNIEXPORT jlong JNICALL FEC_METHOD(nativeNewPool)
+    (JNIEnv * env, jobject obj, jint threads) {
+    return (jlong)(uintptr_t)fec_pool_new(threads);
+}
+
+JNIEXPORT void JNICALL FEC_METHOD(nativeFreePool)
+    (JNIEnv * env, jobject obj) {
+    jlong pool = (*env)->GetLongField(env, obj, poolField);
+    fec_pool_free((void *)(uintptr_t)pool);
+}
+
+/*
+ * The counters of fec_get_stats(), or null if the library is built
+ * without them.
+ */
+JNIEXPORT jlongArray JNICALL FEC_METHOD(nativeGetStats)
+    (JNIEnv * env, jobject obj) {
+    jlong code = (*env)->GetLongField(env, obj, codeField);
+    uint64_t stats[FEC_STAT_COUNT];
+    jlongArray ret;
+
+    if (fec_get_stats((void *)(uintptr_t)code, stats)) {
+        return NULL;
+    }
+    ret = (*env)->NewLongArray(env, FEC_STAT_COUNT);
+    if (ret != NULL) {
+        (*env)->SetLongArrayRegion(env, ret, 0, FEC_STAT_COUNT,
+                                   (jlong *)stats);
+    }
+    return ret;
+}
+
+/*
+ * Incremental decoding (see IncrementalDecoder). The address of the
+ * fec_inc lives in the private "inc" field of a NativeXCode.Incremental,
+ * which is passed in rather than the address itself.
+ */
+static struct fec_inc *
+get_inc(JNIEnv *env, jobject dec) {
+    return (struct fec_inc *)(uintptr_t)(*env)->GetLongField(env, dec,
+                                                             incField);
+}
+
+JNIEXPORT jlong JNICALL FEC_METHOD(nativeNewIncremental)
+    (JNIEnv * env, jobject obj, jint packetLength) {
+    jlong code = (*env)->GetLongField(env, obj, codeField);
+    return (jlong)(uintptr_t)fec_inc_new((void *)(uintptr_t)code,
+                                         packetLength);
+}
+
+JNIEXPORT jint JNICALL FEC_METHOD(nativeIncrementalAdd)
+    (JNIEnv * env, jobject obj, jobject dec, jbyteArray pkt, jint off,
+     jint index) {
+    struct fec_inc *inc = get_inc(env, dec);
+    jbyte *p;
+    jint ret;
+
+    p = (*env)->GetPrimitiveArrayCritical(env, pkt, 0);
+    if (p == NULL) {
+        return -1; /* exception OutOfMemoryError */
+    }
+    ret = fec_inc_add(inc, (gf *)(uintptr_t)(p + off), index);
+    (*env)->ReleasePrimitiveArrayCritical(env, pkt, p, JNI_ABORT);
+    return ret;
+}
+
+JNIEXPORT jboolean JNICALL FEC_METHOD(nativeIncrementalPacket)
+    (JNIEnv * env, jobject obj, jobject dec, jint i, jbyteArray dst,
+     jint off, jint packetLength) {
+    gf *p = fec_inc_packet(get_inc(env, dec), i);
+
+    if (p == NULL) {
+        return JNI_FALSE;
+    }
+    (*env)->SetByteArrayRegion(env, dst, off, packetLength,
+                               (jbyte *)(uintptr_t)p);
+    return JNI_TRUE;
+}
+
+JNIEXPORT void JNICALL FEC_METHOD(nativeIncrementalReset)
+    (JNIEnv * env, jobject obj, jobject dec) {
+    fec_inc_reset(get_inc(env, dec));
+}
+
+JNIEXPORT void JNICALL FEC_METHOD(nativeFreeIncremental)
+    (JNIEnv * env, jobject obj, jobject dec) {
+    fec_inc_free(get_inc(env, dec));
+}
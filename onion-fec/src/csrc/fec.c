@@ -59,6 +59,68 @@
 #define bzero(d, siz)       memset((d), '\0', (siz))
 #endif
 
+#if defined(WIN32) || defined(_WIN32)
+#include <windows.h>
+#include <process.h>
+typedef CRITICAL_SECTION fec_mutex_t;
+#define fec_mutex_init(m)       InitializeCriticalSection(m)
+#define fec_mutex_destroy(m)    DeleteCriticalSection(m)
+#define fec_mutex_lock(m)       EnterCriticalSection(m)
+#define fec_mutex_unlock(m)     LeaveCriticalSection(m)
+typedef CONDITION_VARIABLE fec_cond_t;
+#define fec_cond_init(c)        InitializeConditionVariable(c)
+#define fec_cond_destroy(c)
+#define fec_cond_wait(c, m)     SleepConditionVariableCS(c, m, INFINITE)
+#define fec_cond_broadcast(c)   WakeAllConditionVariable(c)
+typedef HANDLE fec_thread_t;
+#define FEC_THREAD_FN(f, arg)   static unsigned __stdcall f(void *arg)
+#define FEC_THREAD_RETURN       return 0
+#define fec_thread_create(t, f, arg) \
+    ((*(t) = (HANDLE)_beginthreadex(NULL, 0, f, arg, 0, NULL)) == 0)
+#define fec_thread_join(t)      (WaitForSingleObject(t, INFINITE), CloseHandle(t))
+#define fec_cas64(p, o, n) \
+    (InterlockedCompareExchange64((volatile LONGLONG *)(p), (n), (o)) == (LONGLONG)(o))
+#define fec_load64(p)   InterlockedCompareExchange64((volatile LONGLONG *)(p), 0, 0)
+#define fec_store64(p, v)       InterlockedExchange64((volatile LONGLONG *)(p), (v))
+#define fec_add64(p, v)         (void)InterlockedExchangeAdd64((volatile LONGLONG *)(p), (v))
+typedef INIT_ONCE fec_once_t;
+#define FEC_ONCE_INIT           INIT_ONCE_STATIC_INIT
+#define fec_once(o, f)          InitOnceExecuteOnce(o, fec_once_fn, (PVOID)(f), NULL)
+#define FEC_THREAD_LOCAL        __declspec(thread)
+static BOOL CALLBACK
+fec_once_fn(PINIT_ONCE o, PVOID f, PVOID *ctx)
+{
+    ((void (*)(void))f)() ;
+    return TRUE ;
+}
+#else
+#include <pthread.h>
+#include <unistd.h>
+typedef pthread_mutex_t fec_mutex_t;
+#define fec_mutex_init(m)       pthread_mutex_init(m, NULL)
+#define fec_mutex_destroy(m)    pthread_mutex_destroy(m)
+#define fec_mutex_lock(m)       pthread_mutex_lock(m)
+#define fec_mutex_unlock(m)     pthread_mutex_unlock(m)
+typedef pthread_cond_t fec_cond_t;
+#define fec_cond_init(c)        pthread_cond_init(c, NULL)
+#define fec_cond_destroy(c)     pthread_cond_destroy(c)
+#define fec_cond_wait(c, m)     pthread_cond_wait(c, m)
+#define fec_cond_broadcast(c)   pthread_cond_broadcast(c)
+typedef pthread_t fec_thread_t;
+#define FEC_THREAD_FN(f, arg)   static void *f(void *arg)
+#define FEC_THREAD_RETURN       return NULL
+#define fec_thread_create(t, f, arg)    pthread_create(t, NULL, f, arg)
+#define fec_thread_join(t)      pthread_join(t, NULL)
+#define fec_cas64(p, o, n)      __sync_bool_compare_and_swap((p), (o), (n))
+#define fec_load64(p)           __sync_fetch_and_add((p), 0)
+#define fec_store64(p, v)       (void)__sync_lock_test_and_set((p), (v))
+#define fec_add64(p, v)         (void)__sync_fetch_and_add((p), (v))
+typedef pthread_once_t fec_once_t;
+#define FEC_ONCE_INIT           PTHREAD_ONCE_INIT
+#define fec_once(o, f)          pthread_once(o, f)
+#define FEC_THREAD_LOCAL        __thread
+#endif
+
 /*
  * stuff used for testing purposes only
  */
@@ -91,7 +153,7 @@ struct timeval {
       else t = t1 - t ; \
       if (t == 0) t = 1 ;}
 
-unsigned long ticks[10];    /* vars for timekeeping */
+static FEC_THREAD_LOCAL unsigned long ticks[10];    /* vars for timekeeping */
 #else
 #define DEB(x)
 #define DDB(x)
@@ -99,6 +161,80 @@ unsigned long ticks[10];    /* vars for timekeeping */
 #define TOCK(x)
 #endif /* TEST */
 
+/*
+ * Counters and latency histograms, see fec_get_stats(). They are kept
+ * per (k, n) and type of code in a process-wide list, not in the codes
+ * themselves, so all the codes of one geometry share them, and they
+ * outlive the codes: a code freed and made again (as the Java side's
+ * cache does) carries on counting where the last one stopped. Entries
+ * are never freed. Without FEC_STATS the macros below expand to
+ * nothing, and the codes have no stats.
+ */
+#ifdef FEC_STATS
+struct fec_stats {
+    uint64_t v[FEC_STAT_COUNT] ;
+    int k, n, type ;
+    struct fec_stats *next ;
+} ;
+
+static struct fec_stats *stats_list ;	/* protected by stats_lock */
+static fec_mutex_t stats_lock ;		/* initialized by init_fec() */
+
+#if defined(WIN32) || defined(_WIN32)
+static uint64_t
+fec_nanotime(void)
+{
+    LARGE_INTEGER t, f ;
+
+    QueryPerformanceCounter(&t) ;
+    QueryPerformanceFrequency(&f) ;
+    return (uint64_t)(t.QuadPart * (1e9 / f.QuadPart)) ;
+}
+#else
+#include <time.h>
+static uint64_t
+fec_nanotime(void)
+{
+    struct timespec t ;
+
+    clock_gettime(CLOCK_MONOTONIC, &t) ;
+    return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec ;
+}
+#endif
+
+/*
+ * one call of the encoder (calls is FEC_STAT_ENCODE_CALLS) or decoder,
+ * started at t0 and producing bytes bytes.
+ */
+static void
+stats_call(struct fec_parms *code, int calls, int hist, uint64_t t0,
+    uint64_t bytes)
+{
+    uint64_t us = (fec_nanotime() - t0) / 1000 ;
+    int b = 0 ;
+
+    while (us != 0 && b < FEC_STAT_BUCKETS - 1) {
+    us >>= 1 ;
+    b++ ;
+    }
+    fec_add64(&code->stats->v[calls], 1) ;
+    fec_add64(&code->stats->v[calls + 1], bytes) ;
+    fec_add64(&code->stats->v[hist + b], 1) ;
+}
+
+#define STATS_START(t0)        uint64_t t0 = fec_nanotime()
+#define STATS_ENCODE(code, t0, bytes) \
+    stats_call(code, FEC_STAT_ENCODE_CALLS, FEC_STAT_ENCODE_HIST, t0, bytes)
+#define STATS_DECODE(code, t0, bytes) \
+    stats_call(code, FEC_STAT_DECODE_CALLS, FEC_STAT_DECODE_HIST, t0, bytes)
+#define STATS_COUNT(code, i)   fec_add64(&(code)->stats->v[i], 1)
+#else
+#define STATS_START(t0)
+#define STATS_ENCODE(code, t0, bytes)
+#define STATS_DECODE(code, t0, bytes)
+#define STATS_COUNT(code, i)
+#endif
+
 /*
  * You should not need to change anything beyond this point.
  * The first part of the file implements linear algebra in GF.
@@ -120,6 +256,7 @@ unsigned long ticks[10];    /* vars for timekeeping */
  * Primitive polynomials - see Lin & Costello, Appendix A,
  * and  Lee & Messerschmitt, p. 453.
  */
+#ifndef FEC_TABLES
 static const char * const allPp[] = {    /* GF_BITS    polynomial        */
     NULL,                   /*  0    no code            */
     NULL,                   /*  1    no code            */
@@ -139,6 +276,7 @@ static const char * const allPp[] = {    /* GF_BITS    polynomial        */
     "1100000000000001",     /* 15    1+x+x^15           */
     "11010000000010001"     /* 16    1+x+x^3+x^12+x^16  */
 };
+#endif
 
 
 /*
@@ -150,10 +288,26 @@ static const char * const allPp[] = {    /* GF_BITS    polynomial        */
  * In any case the macro gf_mul(x,y) takes care of multiplications.
  */
 
+#ifdef FEC_TABLES
+/*
+ * Built with the tables precomputed by fecgen (see fecgen.c and the
+ * Makefile): they are const, so they sit in the read-only data of the
+ * library, shared by every process using it, and init_fec() has nothing
+ * to compute. fec_baked[] holds the encoding matrices of the common
+ * (k, n), which fec_new() copies instead of inverting a Vandermonde
+ * matrix.
+ */
+struct fec_baked {
+    int k, n ;
+    const gf *m ;        /* the n - k rows below the identity */
+} ;
+#include FEC_TABLES
+#else
 static gf gf_exp[2*GF_SIZE];        /* index->poly form conversion table    */
 static int gf_log[GF_SIZE + 1];     /* Poly->index form conversion table    */
 static gf inverse[GF_SIZE+1];       /* inverse of field elem.               */
                                     /* inv[\alpha**i]=\alpha**(GF_SIZE-i-1) */
+#endif
 
 /*
  * modnn(x) computes x % GF_SIZE, where GF_SIZE is 2**GF_BITS - 1,
@@ -182,14 +336,26 @@ modnn(int x)
  * declared with USE_GF_MULC . See usage in addmul1().
  */
 #if (GF_BITS <= 8)
+#ifndef FEC_TABLES
 static gf gf_mul_table[GF_SIZE + 1][GF_SIZE + 1];
+#endif
 
 #define gf_mul(x,y) gf_mul_table[x][y]
 
-#define USE_GF_MULC register gf * __gf_mulc_
+#define USE_GF_MULC register const gf * __gf_mulc_
 #define GF_MULC0(c) __gf_mulc_ = gf_mul_table[c]
 #define GF_ADDMULC(dst, x) dst ^= __gf_mulc_[x]
 
+/*
+ * gf_mul_nib[c][0][x] = c * x and gf_mul_nib[c][1][x] = c * (x << 4)
+ * for x = 0..15, i.e. the products of c with the low and high nibble
+ * of a byte. These are the 16-byte tables used by the pshufb kernels.
+ */
+#ifdef FEC_TABLES
+#define init_mul_table()
+#else
+static gf gf_mul_nib[GF_SIZE + 1][2][16];
+
 static void
 init_mul_table()
 {
@@ -200,7 +366,14 @@ init_mul_table()
 
     for (j=0; j< GF_SIZE+1; j++)
         gf_mul_table[0][j] = gf_mul_table[j][0] = 0;
+
+    for (i=0; i< GF_SIZE+1; i++)
+    for (j=0; j< 16; j++) {
+        gf_mul_nib[i][0][j] = gf_mul_table[i][j & GF_SIZE] ;
+        gf_mul_nib[i][1][j] = gf_mul_table[i][(j << 4) & GF_SIZE] ;
+    }
 }
+#endif
 #else    /* GF_BITS > 8 */
 static inline gf
 gf_mul(int x, int y)
@@ -211,7 +384,7 @@ gf_mul(int x, int y)
 }
 #define init_mul_table()
 
-#define USE_GF_MULC register gf * __gf_mulc_
+#define USE_GF_MULC register const gf * __gf_mulc_
 #define GF_MULC0(c) __gf_mulc_ = &gf_exp[ gf_log[c] ]
 #define GF_ADDMULC(dst, x) { if (x) dst ^= __gf_mulc_[ gf_log[x] ] ; }
 #endif
@@ -248,6 +421,9 @@ my_malloc(int sz, char *err_string)
 /*
  * initialize the data structures used for computations in GF.
  */
+#ifdef FEC_TABLES
+#define generate_gf()
+#else
 static void
 generate_gf(void)
 {
@@ -310,6 +486,7 @@ generate_gf(void)
     for (i=2; i<=GF_SIZE; i++)
     inverse[i] = gf_exp[GF_SIZE-gf_log[i]];
 }
+#endif
 
 /*
  * Various linear algebra operations that i use often.
@@ -328,7 +505,7 @@ generate_gf(void)
     if (c != 0) addmul1(dst, src, c, sz)
 
 static void
-addmul1(gf *dst1, gf *src1, gf c, int sz)
+addmul1_scalar(gf *dst1, gf *src1, gf c, int sz)
 {
     USE_GF_MULC ;
     register gf *dst = dst1, *src = src1 ;
@@ -340,6 +517,555 @@ addmul1(gf *dst1, gf *src1, gf c, int sz)
     GF_ADDMULC( *dst , *src );
 }
 
+/*
+ * addmul4() does addmul() into four outputs at once, with coefficients
+ * c[0..3], loading and splitting each source symbol only once. The
+ * encoder and decoder group their outputs by four. Zero coefficients
+ * are not skipped.
+ */
+#if (GF_BITS <= 8)
+static void
+addmul4_scalar(gf *dst[], gf *src, gf c[], int sz)
+{
+    const gf *m0 = gf_mul_table[c[0]], *m1 = gf_mul_table[c[1]] ;
+    const gf *m2 = gf_mul_table[c[2]], *m3 = gf_mul_table[c[3]] ;
+    gf *d0 = dst[0], *d1 = dst[1], *d2 = dst[2], *d3 = dst[3] ;
+    int i ;
+    gf x ;
+
+    for (i = 0 ; i < sz ; i++) {
+    x = src[i] ;
+    d0[i] ^= m0[x] ;
+    d1[i] ^= m1[x] ;
+    d2[i] ^= m2[x] ;
+    d3[i] ^= m3[x] ;
+    }
+}
+#define ADDMUL4(name)  addmul4_ ## name
+#else
+#define ADDMUL4(name)  NULL     /* four addmul1() calls, see addmul4_any */
+#endif
+
+/*
+ * xor1 computes dst ^= src over len bytes; it is all the Cauchy codes
+ * need. Like addmul1 there are SIMD versions, chosen along with it.
+ */
+static void
+xor1_scalar(uint8_t *dst, const uint8_t *src, int len)
+{
+    uint64_t a, b ;
+    int i ;
+
+    for (i = 0 ; i + 8 <= len ; i += 8) {
+    memcpy(&a, dst + i, 8) ;
+    memcpy(&b, src + i, 8) ;
+    a ^= b ;
+    memcpy(dst + i, &a, 8) ;
+    }
+    for (; i < len ; i++)
+    dst[i] ^= src[i] ;
+}
+
+/*
+ * SIMD versions of addmul1(), using the "split nibble" technique:
+ * c * x = c * (x & 0xf) ^ c * (x & 0xf0), and each part is looked up
+ * in a 16-entry table with pshufb, 16/32/64 bytes at a time.
+ * The kernels are compiled with per-function target attributes, so the
+ * library still runs on any x86; init_fec() picks the best one that the
+ * CPU supports.
+ */
+#if (GF_BITS == 8 || GF_BITS == 16) && \
+    (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define FEC_X86_SIMD
+#include <immintrin.h>
+
+#if defined(__clang__) || __GNUC__ >= 6
+#define FEC_X86_AVX512
+#endif
+
+#if (GF_BITS == 8)
+/*
+ * GF(2^8): two tables per constant, precomputed in gf_mul_nib.
+ * Each kernel hands the tail to the next narrower one.
+ */
+
+__attribute__((target("ssse3"))) static void
+addmul1_ssse3(gf *dst, gf *src, gf c, int sz)
+{
+    const __m128i tlo = _mm_loadu_si128((const __m128i *)gf_mul_nib[c][0]);
+    const __m128i thi = _mm_loadu_si128((const __m128i *)gf_mul_nib[c][1]);
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    int i;
+
+    for (i = 0; i + 16 <= sz; i += 16) {
+    __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+    __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+    __m128i lo = _mm_and_si128(s, mask);
+    __m128i hi = _mm_and_si128(_mm_srli_epi64(s, 4), mask);
+    d = _mm_xor_si128(d, _mm_shuffle_epi8(tlo, lo));
+    d = _mm_xor_si128(d, _mm_shuffle_epi8(thi, hi));
+    _mm_storeu_si128((__m128i *)(dst + i), d);
+    }
+    if (i < sz)
+    addmul1_scalar(dst + i, src + i, c, sz - i);
+}
+
+__attribute__((target("avx2"))) static void
+addmul1_avx2(gf *dst, gf *src, gf c, int sz)
+{
+    const __m256i tlo = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *)gf_mul_nib[c][0]));
+    const __m256i thi = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *)gf_mul_nib[c][1]));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    int i;
+
+    for (i = 0; i + 32 <= sz; i += 32) {
+    __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+    __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+    __m256i lo = _mm256_and_si256(s, mask);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi64(s, 4), mask);
+    d = _mm256_xor_si256(d, _mm256_shuffle_epi8(tlo, lo));
+    d = _mm256_xor_si256(d, _mm256_shuffle_epi8(thi, hi));
+    _mm256_storeu_si256((__m256i *)(dst + i), d);
+    }
+    /*
+     * Leave the upper halves of the vector registers clean. gcc only
+     * does this by itself from -O2 on, and otherwise every later SSE
+     * instruction (in the tail kernel, memcpy, ...) pays a penalty.
+     */
+    _mm256_zeroupper();
+    if (i < sz)
+    addmul1_ssse3(dst + i, src + i, c, sz - i);
+}
+
+#ifdef FEC_X86_AVX512
+__attribute__((target("avx512f,avx512bw"))) static void
+addmul1_avx512(gf *dst, gf *src, gf c, int sz)
+{
+    const __m512i tlo = _mm512_broadcast_i32x4(
+        _mm_loadu_si128((const __m128i *)gf_mul_nib[c][0]));
+    const __m512i thi = _mm512_broadcast_i32x4(
+        _mm_loadu_si128((const __m128i *)gf_mul_nib[c][1]));
+    const __m512i mask = _mm512_set1_epi8(0x0f);
+    int i;
+
+    for (i = 0; i + 64 <= sz; i += 64) {
+    __m512i s = _mm512_loadu_si512((const void *)(src + i));
+    __m512i d = _mm512_loadu_si512((const void *)(dst + i));
+    __m512i lo = _mm512_and_si512(s, mask);
+    __m512i hi = _mm512_and_si512(_mm512_srli_epi64(s, 4), mask);
+    d = _mm512_xor_si512(d, _mm512_shuffle_epi8(tlo, lo));
+    d = _mm512_xor_si512(d, _mm512_shuffle_epi8(thi, hi));
+    _mm512_storeu_si512((void *)(dst + i), d);
+    }
+    _mm256_zeroupper();
+    if (i < sz)
+    addmul1_avx2(dst + i, src + i, c, sz - i);
+}
+#endif /* FEC_X86_AVX512 */
+
+/*
+ * The four output versions keep all eight tables in registers. The
+ * tail goes to the next narrower kernel, as above.
+ */
+#define ADDMUL4_TAIL(fn, i)    do {                                    \
+    gf *t_[4] = { dst[0] + (i), dst[1] + (i), dst[2] + (i), dst[3] + (i) } ; \
+    fn(t_, src + (i), c, sz - (i)) ;                                    \
+} while (0)
+
+__attribute__((target("ssse3"))) static void
+addmul4_ssse3(gf *dst[], gf *src, gf c[], int sz)
+{
+    __m128i tlo[4], thi[4], s, lo, hi, d ;
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    int i, j;
+
+    for (j = 0; j < 4; j++) {
+    tlo[j] = _mm_loadu_si128((const __m128i *)gf_mul_nib[c[j]][0]);
+    thi[j] = _mm_loadu_si128((const __m128i *)gf_mul_nib[c[j]][1]);
+    }
+    for (i = 0; i + 16 <= sz; i += 16) {
+    s = _mm_loadu_si128((const __m128i *)(src + i));
+    lo = _mm_and_si128(s, mask);
+    hi = _mm_and_si128(_mm_srli_epi64(s, 4), mask);
+    for (j = 0; j < 4; j++) {
+        d = _mm_loadu_si128((const __m128i *)(dst[j] + i));
+        d = _mm_xor_si128(d, _mm_shuffle_epi8(tlo[j], lo));
+        d = _mm_xor_si128(d, _mm_shuffle_epi8(thi[j], hi));
+        _mm_storeu_si128((__m128i *)(dst[j] + i), d);
+    }
+    }
+    if (i < sz)
+    ADDMUL4_TAIL(addmul4_scalar, i);
+}
+
+__attribute__((target("avx2"))) static void
+addmul4_avx2(gf *dst[], gf *src, gf c[], int sz)
+{
+    __m256i tlo[4], thi[4], s, lo, hi, d ;
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    int i, j;
+
+    for (j = 0; j < 4; j++) {
+    tlo[j] = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *)gf_mul_nib[c[j]][0]));
+    thi[j] = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *)gf_mul_nib[c[j]][1]));
+    }
+    for (i = 0; i + 32 <= sz; i += 32) {
+    s = _mm256_loadu_si256((const __m256i *)(src + i));
+    lo = _mm256_and_si256(s, mask);
+    hi = _mm256_and_si256(_mm256_srli_epi64(s, 4), mask);
+    for (j = 0; j < 4; j++) {
+        d = _mm256_loadu_si256((const __m256i *)(dst[j] + i));
+        d = _mm256_xor_si256(d, _mm256_shuffle_epi8(tlo[j], lo));
+        d = _mm256_xor_si256(d, _mm256_shuffle_epi8(thi[j], hi));
+        _mm256_storeu_si256((__m256i *)(dst[j] + i), d);
+    }
+    }
+    _mm256_zeroupper();
+    if (i < sz)
+    ADDMUL4_TAIL(addmul4_ssse3, i);
+}
+
+#ifdef FEC_X86_AVX512
+__attribute__((target("avx512f,avx512bw"))) static void
+addmul4_avx512(gf *dst[], gf *src, gf c[], int sz)
+{
+    __m512i tlo[4], thi[4], s, lo, hi, d ;
+    const __m512i mask = _mm512_set1_epi8(0x0f);
+    int i, j;
+
+    for (j = 0; j < 4; j++) {
+    tlo[j] = _mm512_broadcast_i32x4(
+        _mm_loadu_si128((const __m128i *)gf_mul_nib[c[j]][0]));
+    thi[j] = _mm512_broadcast_i32x4(
+        _mm_loadu_si128((const __m128i *)gf_mul_nib[c[j]][1]));
+    }
+    for (i = 0; i + 64 <= sz; i += 64) {
+    s = _mm512_loadu_si512((const void *)(src + i));
+    lo = _mm512_and_si512(s, mask);
+    hi = _mm512_and_si512(_mm512_srli_epi64(s, 4), mask);
+    for (j = 0; j < 4; j++) {
+        d = _mm512_loadu_si512((const void *)(dst[j] + i));
+        d = _mm512_xor_si512(d, _mm512_shuffle_epi8(tlo[j], lo));
+        d = _mm512_xor_si512(d, _mm512_shuffle_epi8(thi[j], hi));
+        _mm512_storeu_si512((void *)(dst[j] + i), d);
+    }
+    }
+    _mm256_zeroupper();
+    if (i < sz)
+    ADDMUL4_TAIL(addmul4_avx2, i);
+}
+#endif /* FEC_X86_AVX512 */
+
+#else /* GF_BITS == 16 */
+/*
+ * GF(2^16): a symbol has four nibbles, and the product of c with each
+ * of them is a 16-bit value, so we need eight tables (low and high byte
+ * of c * (x << 4*j), j = 0..3). They are built on each call, which is
+ * why short vectors are left to the scalar code.
+ * Each iteration loads two vectors of symbols, separates the low and
+ * high bytes with pshufb + unpack, does the lookups, and interleaves the
+ * result bytes again. All of these operate within 128-bit lanes, so the
+ * same sequence works unchanged for the 256 and 512 bit versions.
+ */
+#define GF16_SIMD_MIN 64	/* symbols */
+
+static void
+gf16_nib_tables(gf c, uint8_t t[4][2][16])
+{
+    int j, x ;
+
+    for (j = 0 ; j < 4 ; j++)
+    for (x = 0 ; x < 16 ; x++) {
+        gf p = gf_mul(c, x << (4*j)) ;
+        t[j][0][x] = p & 0xff ;
+        t[j][1][x] = p >> 8 ;
+    }
+}
+
+#define GF16_SPLIT_BYTES \
+    0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15
+
+__attribute__((target("ssse3"))) static void
+addmul1_ssse3(gf *dst, gf *src, gf c, int sz)
+{
+    uint8_t t[4][2][16] ;
+    __m128i tl[4], th[4] ;
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    const __m128i split = _mm_setr_epi8(GF16_SPLIT_BYTES);
+    int i, j ;
+
+    if (sz < GF16_SIMD_MIN) {
+    addmul1_scalar(dst, src, c, sz);
+    return ;
+    }
+    gf16_nib_tables(c, t);
+    for (j = 0 ; j < 4 ; j++) {
+    tl[j] = _mm_loadu_si128((const __m128i *)t[j][0]);
+    th[j] = _mm_loadu_si128((const __m128i *)t[j][1]);
+    }
+    for (i = 0; i + 16 <= sz; i += 16) {
+    __m128i a = _mm_shuffle_epi8(
+        _mm_loadu_si128((const __m128i *)(src + i)), split);
+    __m128i b = _mm_shuffle_epi8(
+        _mm_loadu_si128((const __m128i *)(src + i + 8)), split);
+    __m128i lo = _mm_unpacklo_epi64(a, b);
+    __m128i hi = _mm_unpackhi_epi64(a, b);
+    __m128i n0 = _mm_and_si128(lo, mask);
+    __m128i n1 = _mm_and_si128(_mm_srli_epi64(lo, 4), mask);
+    __m128i n2 = _mm_and_si128(hi, mask);
+    __m128i n3 = _mm_and_si128(_mm_srli_epi64(hi, 4), mask);
+    __m128i rl, rh, d ;
+
+    rl = _mm_xor_si128(
+        _mm_xor_si128(_mm_shuffle_epi8(tl[0], n0), _mm_shuffle_epi8(tl[1], n1)),
+        _mm_xor_si128(_mm_shuffle_epi8(tl[2], n2), _mm_shuffle_epi8(tl[3], n3)));
+    rh = _mm_xor_si128(
+        _mm_xor_si128(_mm_shuffle_epi8(th[0], n0), _mm_shuffle_epi8(th[1], n1)),
+        _mm_xor_si128(_mm_shuffle_epi8(th[2], n2), _mm_shuffle_epi8(th[3], n3)));
+
+    d = _mm_loadu_si128((const __m128i *)(dst + i));
+    _mm_storeu_si128((__m128i *)(dst + i),
+        _mm_xor_si128(d, _mm_unpacklo_epi8(rl, rh)));
+    d = _mm_loadu_si128((const __m128i *)(dst + i + 8));
+    _mm_storeu_si128((__m128i *)(dst + i + 8),
+        _mm_xor_si128(d, _mm_unpackhi_epi8(rl, rh)));
+    }
+    if (i < sz)
+    addmul1_scalar(dst + i, src + i, c, sz - i);
+}
+
+__attribute__((target("avx2"))) static void
+addmul1_avx2(gf *dst, gf *src, gf c, int sz)
+{
+    uint8_t t[4][2][16] ;
+    __m256i tl[4], th[4] ;
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    const __m256i split = _mm256_setr_epi8(GF16_SPLIT_BYTES, GF16_SPLIT_BYTES);
+    int i, j ;
+
+    if (sz < GF16_SIMD_MIN) {
+    addmul1_scalar(dst, src, c, sz);
+    return ;
+    }
+    gf16_nib_tables(c, t);
+    for (j = 0 ; j < 4 ; j++) {
+    tl[j] = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *)t[j][0]));
+    th[j] = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *)t[j][1]));
+    }
+    for (i = 0; i + 32 <= sz; i += 32) {
+    __m256i a = _mm256_shuffle_epi8(
+        _mm256_loadu_si256((const __m256i *)(src + i)), split);
+    __m256i b = _mm256_shuffle_epi8(
+        _mm256_loadu_si256((const __m256i *)(src + i + 16)), split);
+    __m256i lo = _mm256_unpacklo_epi64(a, b);
+    __m256i hi = _mm256_unpackhi_epi64(a, b);
+    __m256i n0 = _mm256_and_si256(lo, mask);
+    __m256i n1 = _mm256_and_si256(_mm256_srli_epi64(lo, 4), mask);
+    __m256i n2 = _mm256_and_si256(hi, mask);
+    __m256i n3 = _mm256_and_si256(_mm256_srli_epi64(hi, 4), mask);
+    __m256i rl, rh, d ;
+
+    rl = _mm256_xor_si256(
+        _mm256_xor_si256(_mm256_shuffle_epi8(tl[0], n0),
+                 _mm256_shuffle_epi8(tl[1], n1)),
+        _mm256_xor_si256(_mm256_shuffle_epi8(tl[2], n2),
+                 _mm256_shuffle_epi8(tl[3], n3)));
+    rh = _mm256_xor_si256(
+        _mm256_xor_si256(_mm256_shuffle_epi8(th[0], n0),
+                 _mm256_shuffle_epi8(th[1], n1)),
+        _mm256_xor_si256(_mm256_shuffle_epi8(th[2], n2),
+                 _mm256_shuffle_epi8(th[3], n3)));
+
+    d = _mm256_loadu_si256((const __m256i *)(dst + i));
+    _mm256_storeu_si256((__m256i *)(dst + i),
+        _mm256_xor_si256(d, _mm256_unpacklo_epi8(rl, rh)));
+    d = _mm256_loadu_si256((const __m256i *)(dst + i + 16));
+    _mm256_storeu_si256((__m256i *)(dst + i + 16),
+        _mm256_xor_si256(d, _mm256_unpackhi_epi8(rl, rh)));
+    }
+    _mm256_zeroupper();
+    if (i < sz)
+    addmul1_scalar(dst + i, src + i, c, sz - i);
+}
+
+#ifdef FEC_X86_AVX512
+__attribute__((target("avx512f,avx512bw"))) static void
+addmul1_avx512(gf *dst, gf *src, gf c, int sz)
+{
+    uint8_t t[4][2][16] ;
+    __m512i tl[4], th[4] ;
+    const __m512i mask = _mm512_set1_epi8(0x0f);
+    const __m512i split = _mm512_broadcast_i32x4(
+        _mm_setr_epi8(GF16_SPLIT_BYTES));
+    int i, j ;
+
+    if (sz < GF16_SIMD_MIN) {
+    addmul1_scalar(dst, src, c, sz);
+    return ;
+    }
+    gf16_nib_tables(c, t);
+    for (j = 0 ; j < 4 ; j++) {
+    tl[j] = _mm512_broadcast_i32x4(
+        _mm_loadu_si128((const __m128i *)t[j][0]));
+    th[j] = _mm512_broadcast_i32x4(
+        _mm_loadu_si128((const __m128i *)t[j][1]));
+    }
+    for (i = 0; i + 64 <= sz; i += 64) {
+    __m512i a = _mm512_shuffle_epi8(
+        _mm512_loadu_si512((const void *)(src + i)), split);
+    __m512i b = _mm512_shuffle_epi8(
+        _mm512_loadu_si512((const void *)(src + i + 32)), split);
+    __m512i lo = _mm512_unpacklo_epi64(a, b);
+    __m512i hi = _mm512_unpackhi_epi64(a, b);
+    __m512i n0 = _mm512_and_si512(lo, mask);
+    __m512i n1 = _mm512_and_si512(_mm512_srli_epi64(lo, 4), mask);
+    __m512i n2 = _mm512_and_si512(hi, mask);
+    __m512i n3 = _mm512_and_si512(_mm512_srli_epi64(hi, 4), mask);
+    __m512i rl, rh, d ;
+
+    rl = _mm512_xor_si512(
+        _mm512_xor_si512(_mm512_shuffle_epi8(tl[0], n0),
+                 _mm512_shuffle_epi8(tl[1], n1)),
+        _mm512_xor_si512(_mm512_shuffle_epi8(tl[2], n2),
+                 _mm512_shuffle_epi8(tl[3], n3)));
+    rh = _mm512_xor_si512(
+        _mm512_xor_si512(_mm512_shuffle_epi8(th[0], n0),
+                 _mm512_shuffle_epi8(th[1], n1)),
+        _mm512_xor_si512(_mm512_shuffle_epi8(th[2], n2),
+                 _mm512_shuffle_epi8(th[3], n3)));
+
+    d = _mm512_loadu_si512((const void *)(dst + i));
+    _mm512_storeu_si512((void *)(dst + i),
+        _mm512_xor_si512(d, _mm512_unpacklo_epi8(rl, rh)));
+    d = _mm512_loadu_si512((const void *)(dst + i + 32));
+    _mm512_storeu_si512((void *)(dst + i + 32),
+        _mm512_xor_si512(d, _mm512_unpackhi_epi8(rl, rh)));
+    }
+    _mm256_zeroupper();
+    if (i < sz)
+    addmul1_scalar(dst + i, src + i, c, sz - i);
+}
+#endif /* FEC_X86_AVX512 */
+#endif /* GF_BITS */
+
+__attribute__((target("sse2"))) static void
+xor1_sse2(uint8_t *dst, const uint8_t *src, int len)
+{
+    int i;
+
+    for (i = 0; i + 16 <= len; i += 16)
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(
+        _mm_loadu_si128((const __m128i *)(dst + i)),
+        _mm_loadu_si128((const __m128i *)(src + i))));
+    if (i < len)
+    xor1_scalar(dst + i, src + i, len - i);
+}
+
+__attribute__((target("avx2"))) static void
+xor1_avx2(uint8_t *dst, const uint8_t *src, int len)
+{
+    int i;
+
+    for (i = 0; i + 32 <= len; i += 32)
+    _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(
+        _mm256_loadu_si256((const __m256i *)(dst + i)),
+        _mm256_loadu_si256((const __m256i *)(src + i))));
+    _mm256_zeroupper();
+    if (i < len)
+    xor1_sse2(dst + i, src + i, len - i);
+}
+#endif /* FEC_X86_SIMD */
+
+/*
+ * The addmul1() kernels, best first, each with the matching addmul4()
+ * and xor1(). The scalar table version is always last and always usable.
+ */
+static const struct addmul_kernel {
+    const char *name ;
+    void (*fn)(gf *dst, gf *src, gf c, int sz) ;
+    void (*fn4)(gf *dst[], gf *src, gf c[], int sz) ;
+    void (*xor_fn)(uint8_t *dst, const uint8_t *src, int len) ;
+} addmul_kernels[] = {
+#ifdef FEC_X86_SIMD
+#ifdef FEC_X86_AVX512
+    { "avx512",	addmul1_avx512,	ADDMUL4(avx512),	xor1_avx2 },
+#endif
+    { "avx2",	addmul1_avx2,	ADDMUL4(avx2),	xor1_avx2 },
+    { "ssse3",	addmul1_ssse3,	ADDMUL4(ssse3),	xor1_sse2 },
+#endif
+    { "scalar",	addmul1_scalar,	ADDMUL4(scalar),	xor1_scalar },
+};
+
+#define N_ADDMUL_KERNELS (sizeof(addmul_kernels) / sizeof(addmul_kernels[0]))
+
+static void (*addmul1)(gf *dst, gf *src, gf c, int sz) = addmul1_scalar ;
+static void (*xor1)(uint8_t *dst, const uint8_t *src, int len) = xor1_scalar ;
+
+/*
+ * addmul4() for kernels without a four output version (GF(2^16), whose
+ * 32 tables would not fit in registers).
+ */
+static void
+addmul4_any(gf *dst[], gf *src, gf c[], int sz)
+{
+    int j ;
+
+    for (j = 0 ; j < 4 ; j++)
+    addmul(dst[j], src, c[j], sz) ;
+}
+
+static void (*addmul4)(gf *dst[], gf *src, gf c[], int sz) = addmul4_any ;
+
+static void
+set_kernel(const struct addmul_kernel *kp)
+{
+    addmul1 = kp->fn ;
+    addmul4 = kp->fn4 != NULL ? kp->fn4 : addmul4_any ;
+    xor1 = kp->xor_fn ;
+}
+
+/*
+ * returns non-zero if the CPU we are running on can execute kernel kp.
+ */
+static int
+kernel_usable(const struct addmul_kernel *kp)
+{
+#ifdef FEC_X86_SIMD
+    __builtin_cpu_init();
+#ifdef FEC_X86_AVX512
+    if (kp->fn == addmul1_avx512)
+    return __builtin_cpu_supports("avx512f") &&
+        __builtin_cpu_supports("avx512bw") ;
+#endif
+    if (kp->fn == addmul1_avx2)
+    return __builtin_cpu_supports("avx2") ;
+    if (kp->fn == addmul1_ssse3)
+    return __builtin_cpu_supports("ssse3") ;
+#endif
+    return kp->fn == addmul1_scalar ;
+}
+
+static void
+select_addmul_kernel(void)
+{
+    unsigned int i ;
+
+    for (i = 0 ; i < N_ADDMUL_KERNELS ; i++)
+    if (kernel_usable(&addmul_kernels[i])) {
+        set_kernel(&addmul_kernels[i]) ;
+        DDB(fprintf(stderr, "using %s addmul kernel\n",
+        addmul_kernels[i].name);)
+        return ;
+    }
+}
+
 /*
  * computes C = AB where A is n*k, B is k*m, C is n*m
  */
@@ -384,29 +1110,32 @@ is_identity(gf *m, int k)
  * invert_mat() takes a matrix and produces its inverse
  * k is the size of the matrix.
  * (Gauss-Jordan, adapted from Numerical Recipes in C)
+ * ws is a work area of INVERT_MAT_WS(k) bytes, aligned for int.
  * Return non-zero if singular.
  */
+#define INVERT_MAT_WS(k) (3*(k)*sizeof(int) + (k)*sizeof(gf))
+
 DEB( int pivloops=0; int pivswaps=0 ; /* diagnostic */)
 static int
-invert_mat(gf *src, int k)
+invert_mat(gf *src, int k, void *ws)
 {
     gf c, *p ;
     int irow, icol, row, col, i, ix ;
 
     int error = 1 ;
-    int *indxc = my_malloc(k*sizeof(int), "indxc");
-    int *indxr = my_malloc(k*sizeof(int), "indxr");
-    int *ipiv = my_malloc(k*sizeof(int), "ipiv");
-    gf *id_row = NEW_GF_MATRIX(1, k);
-    gf *temp_row = NEW_GF_MATRIX(1, k);
+    int *indxc = ws ;
+    int *indxr = indxc + k ;
+    int *ipiv = indxr + k ;
+    gf *id_row = (gf *)(ipiv + k) ;
 
-    bzero(id_row, k*sizeof(gf));
     DEB( pivloops=0; pivswaps=0 ; /* diagnostic */ )
     /*
      * ipiv marks elements already used as pivots.
      */
-    for (i = 0; i < k ; i++)
+    for (i = 0; i < k ; i++) {
     ipiv[i] = 0 ;
+    id_row[i] = 0 ;
+    }
 
     for (col = 0; col < k ; col++) {
     gf *pivot_row ;
@@ -505,11 +1234,6 @@ found_piv:
     }
     error = 0 ;
 fail:
-    free(indxc);
-    free(indxr);
-    free(ipiv);
-    free(id_row);
-    free(temp_row);
     return error ;
 }
 
@@ -581,9 +1305,19 @@ invert_vdm(gf *src, int k)
     return 0 ;
 }
 
-static int fec_initialized = 0 ;
+/*
+ * init_fec() runs the setup below exactly once, however many threads
+ * call it at the same time, and every entry point calls it first, so
+ * that the tables and kernel pointers are never seen half built. After
+ * that they are only read (and are const with FEC_TABLES), so any
+ * number of threads can use the library, and each code, at once: a
+ * code is not modified by encoding or decoding, except for its decode
+ * cache, which has its own lock.
+ */
+static fec_once_t fec_once_ctl = FEC_ONCE_INIT ;
 
-void init_fec()
+static void
+fec_init_once(void)
 {
     TICK(ticks[0]);
     generate_gf();
@@ -593,56 +1327,370 @@ void init_fec()
     init_mul_table();
     TOCK(ticks[0]);
     DDB(fprintf(stderr, "init_mul_table took %ldus\n", ticks[0]);)
-    fec_initialized = 1 ;
+    select_addmul_kernel();
+#ifdef FEC_STATS
+    fec_mutex_init(&stats_lock);
+#endif
+}
+
+void init_fec()
+{
+    fec_once(&fec_once_ctl, fec_init_once);
 }
 
 /*
- * This section contains the proper FEC encoding/decoding routines.
- * The encoding matrix is computed starting with a Vandermonde matrix,
- * and then transforming it into a systematic matrix.
+ * Kernel selection, mostly for benchmarks. fec_kernel_name(i) is the
+ * name of the i-th compiled-in addmul kernel (best first, NULL past the
+ * last one) and fec_get_kernel() the one in use. fec_set_kernel(name)
+ * switches to the named kernel, or back to the best one the CPU
+ * supports if name is NULL; it returns non-zero if the kernel is
+ * unknown or the CPU cannot run it. The setting is global, so do not
+ * change it while other threads are coding.
  */
+const char *
+fec_kernel_name(int i)
+{
+    if (i < 0 || i >= (int)N_ADDMUL_KERNELS)
+    return NULL ;
+    return addmul_kernels[i].name ;
+}
 
-#define FEC_MAGIC    0xFECC0DEC
+const char *
+fec_get_kernel(void)
+{
+    unsigned int i ;
 
-void
-fec_free(struct fec_parms *p)
+    init_fec();
+    for (i = 0 ; i < N_ADDMUL_KERNELS ; i++)
+    if (addmul_kernels[i].fn == addmul1)
+        return addmul_kernels[i].name ;
+    return NULL ;
+}
+
+int
+fec_set_kernel(const char *name)
 {
-    if (p==NULL ||
-       p->magic != ( ( (FEC_MAGIC ^ p->k) ^ p->n) ^ (long)(p->enc_matrix)) ) {
-    fprintf(stderr, "bad parameters to fec_free\n");
-    return ;
+    unsigned int i ;
+
+    init_fec();
+    if (name == NULL) {
+    select_addmul_kernel();
+    return 0 ;
     }
-    free(p->enc_matrix);
-    free(p);
+    for (i = 0 ; i < N_ADDMUL_KERNELS ; i++)
+    if (strcmp(addmul_kernels[i].name, name) == 0) {
+        if (!kernel_usable(&addmul_kernels[i]))
+        return 1 ;
+        set_kernel(&addmul_kernels[i]) ;
+        return 0 ;
+    }
+    return 1 ;
 }
 
 /*
- * create a new encoder, returning a descriptor. This contains k,n and
- * the encoding matrix.
+ * Cache of recently inverted decoding matrices, one per code.
+ * The same loss pattern tends to repeat (e.g. when a peer holding a
+ * fixed set of blocks goes away), and inverting the matrix is O(k^3).
+ * The key is the canonical index vector: source packets in their own
+ * slot, and the repair indexes sorted in increasing order in the free
+ * slots, so it only depends on the set of packets received.
+ * The cache is small, so lookups are a linear scan, and the least
+ * recently used entry is replaced. Matrices are copied in and out under
+ * the lock, so an entry can be replaced while another thread decodes.
  */
-struct fec_parms *
-fec_new(int k, int n)
+#define FEC_DEC_CACHE_SIZE     8            /* entries */
+#define FEC_DEC_CACHE_BYTES    (4*1024*1024)
+
+struct dec_cache_entry {
+    unsigned long hash ;
+    unsigned long stamp ;   /* time of last use, 0 if empty */
+    int *key ;              /* k indexes */
+    gf *matrix ;            /* k*k inverse */
+} ;
+
+struct fec_dec_cache {
+    fec_mutex_t lock ;
+    int k, size ;
+    unsigned long clock, hits, misses ;
+    struct dec_cache_entry *e ;
+} ;
+
+static unsigned long
+dec_cache_hash(int *key, int k)
 {
-    int row, col ;
-    gf *p, *tmp_m ;
+    unsigned long h = 2166136261UL ;    /* FNV-1a */
+    int i ;
 
-    struct fec_parms *retval ;
+    for (i = 0 ; i < k ; i++)
+    h = (h ^ (unsigned long)key[i]) * 16777619UL ;
+    return h ;
+}
 
-    if (fec_initialized == 0)
-    init_fec();
+static void
+dec_cache_resize(struct fec_dec_cache *c, int size)
+{
+    int i ;
 
-    if (k > GF_SIZE + 1 || n > GF_SIZE + 1 || k > n ) {
-    fprintf(stderr, "Invalid parameters k %d n %d GF_SIZE %d\n",
-        k, n, GF_SIZE );
-    return NULL ;
+    for (i = 0 ; i < c->size ; i++) {
+    free(c->e[i].key) ;
+    free(c->e[i].matrix) ;
     }
-    retval = my_malloc(sizeof(struct fec_parms), "new_code");
-    retval->k = k ;
-    retval->n = n ;
-    retval->enc_matrix = NEW_GF_MATRIX(n, k);
-    retval->magic = ( ( FEC_MAGIC ^ k) ^ n) ^ (long)(retval->enc_matrix) ;
-    tmp_m = NEW_GF_MATRIX(n, k);
-    /*
+    free(c->e) ;
+    c->e = NULL ;
+    c->size = size > 0 ? size : 0 ;
+    if (c->size > 0) {
+    c->e = my_malloc(c->size * sizeof(struct dec_cache_entry),
+        "decode cache") ;
+    bzero(c->e, c->size * sizeof(struct dec_cache_entry)) ;
+    }
+}
+
+static struct fec_dec_cache *
+dec_cache_new(int k)
+{
+    struct fec_dec_cache *c = my_malloc(sizeof(*c), "decode cache") ;
+    size_t size = 0 ;
+
+    /*
+     * as many matrices as fit in FEC_DEC_CACHE_BYTES, divided one factor
+     * at a time so that k*k cannot overflow; none (the cache is off) when
+     * k is 0 or a single matrix is larger than that.
+     */
+    if (k > 0)
+    size = FEC_DEC_CACHE_BYTES / sizeof(gf) / k / k ;
+
+    bzero(c, sizeof(*c)) ;
+    c->k = k ;
+    fec_mutex_init(&c->lock) ;
+    dec_cache_resize(c, size < FEC_DEC_CACHE_SIZE ? (int)size : FEC_DEC_CACHE_SIZE) ;
+    return c ;
+}
+
+static void
+dec_cache_free(struct fec_dec_cache *c)
+{
+    dec_cache_resize(c, 0) ;
+    fec_mutex_destroy(&c->lock) ;
+    free(c) ;
+}
+
+/*
+ * copies the matrix for key into m and returns 1 if it is cached.
+ */
+static int
+dec_cache_get(struct fec_dec_cache *c, int *key, unsigned long hash, gf *m)
+{
+    int i, k = c->k, found = 0 ;
+
+    fec_mutex_lock(&c->lock) ;
+    for (i = 0 ; i < c->size ; i++) {
+    struct dec_cache_entry *e = &c->e[i] ;
+
+    if (e->stamp != 0 && e->hash == hash &&
+        !bcmp(e->key, key, k * sizeof(int))) {
+        bcopy(e->matrix, m, (size_t)k * k * sizeof(gf)) ;
+        e->stamp = ++c->clock ;
+        found = 1 ;
+        break ;
+    }
+    }
+    if (found)
+    c->hits++ ;
+    else
+    c->misses++ ;
+    fec_mutex_unlock(&c->lock) ;
+    return found ;
+}
+
+static void
+dec_cache_put(struct fec_dec_cache *c, int *key, unsigned long hash, gf *m)
+{
+    struct dec_cache_entry *e = NULL ;
+    int i, k = c->k ;
+
+    fec_mutex_lock(&c->lock) ;
+    for (i = 0 ; i < c->size ; i++)
+    if (e == NULL || c->e[i].stamp < e->stamp)
+        e = &c->e[i] ;
+    if (e != NULL) {
+    if (e->key == NULL) {
+        e->key = my_malloc(k * sizeof(int), "decode cache key") ;
+        e->matrix = NEW_GF_MATRIX(k, k) ;
+    }
+    bcopy(key, e->key, k * sizeof(int)) ;
+    bcopy(m, e->matrix, (size_t)k * k * sizeof(gf)) ;
+    e->hash = hash ;
+    e->stamp = ++c->clock ;
+    }
+    fec_mutex_unlock(&c->lock) ;
+}
+
+void
+fec_decode_cache_stats(struct fec_parms *code, unsigned long *hits,
+    unsigned long *misses)
+{
+    struct fec_dec_cache *c = code->dec_cache ;
+
+    fec_mutex_lock(&c->lock) ;
+    *hits = c->hits ;
+    *misses = c->misses ;
+    fec_mutex_unlock(&c->lock) ;
+}
+
+/*
+ * fec_get_stats copies the counters of the (k, n) of the code (see
+ * fec.h) to stats, or returns non-zero if the library is built without
+ * FEC_STATS. They are read one at a time while other threads may be
+ * coding, so they need not add up exactly.
+ */
+int
+fec_get_stats(struct fec_parms *code, uint64_t stats[FEC_STAT_COUNT])
+{
+#ifdef FEC_STATS
+    int i ;
+
+    for (i = 0 ; i < FEC_STAT_COUNT ; i++)
+    stats[i] = fec_load64(&code->stats->v[i]) ;
+    return 0 ;
+#else
+    return 1 ;
+#endif
+}
+
+void
+fec_set_decode_cache_size(struct fec_parms *code, int entries)
+{
+    struct fec_dec_cache *c = code->dec_cache ;
+
+    fec_mutex_lock(&c->lock) ;
+    dec_cache_resize(c, entries) ;
+    fec_mutex_unlock(&c->lock) ;
+}
+
+/*
+ * This section contains the proper FEC encoding/decoding routines.
+ * The encoding matrix is computed starting with a Vandermonde matrix,
+ * and then transforming it into a systematic matrix.
+ */
+
+#define FEC_MAGIC    0xFECC0DEC
+
+#ifdef FEC_STATS
+/*
+ * the counters of codes of this geometry and type, added to stats_list
+ * the first time. init_fec() must have been called.
+ */
+static struct fec_stats *
+stats_new(int k, int n, int type)
+{
+    struct fec_stats *st ;
+
+    fec_mutex_lock(&stats_lock) ;
+    for (st = stats_list ; st != NULL ; st = st->next)
+    if (st->k == k && st->n == n && st->type == type)
+        break ;
+    if (st == NULL) {
+    st = my_malloc(sizeof(*st), "stats") ;
+    bzero(st, sizeof(*st)) ;
+    st->k = k ;
+    st->n = n ;
+    st->type = type ;
+    st->next = stats_list ;
+    stats_list = st ;
+    }
+    fec_mutex_unlock(&stats_lock) ;
+    return st ;
+}
+#else
+#define stats_new(k, n, type)    NULL
+#endif
+
+/*
+ * The schedules of the n-k repair rows of a Cauchy code, built once by
+ * fec_new_cauchy(); ops[i] has the nops[i] operations of row k + i.
+ */
+struct fec_sched {
+    int *nops ;
+    struct xor_op **ops ;
+} ;
+
+static void
+sched_free(struct fec_sched *s, int m)
+{
+    int i ;
+
+    if (s == NULL)
+    return ;
+    for (i = 0 ; i < m ; i++)
+    free(s->ops[i]) ;
+    free(s->ops) ;
+    free(s->nops) ;
+    free(s) ;
+}
+
+void
+fec_free(struct fec_parms *p)
+{
+    if (p==NULL ||
+       p->magic != ( ( (FEC_MAGIC ^ p->k) ^ p->n) ^ (long)(p->enc_matrix)) ) {
+    fprintf(stderr, "bad parameters to fec_free\n");
+    return ;
+    }
+    dec_cache_free(p->dec_cache);
+    sched_free(p->sched, p->n - p->k);
+    free(p->enc_matrix);
+    free(p);
+}
+
+/*
+ * create a new encoder, returning a descriptor. This contains k,n and
+ * the encoding matrix.
+ */
+struct fec_parms *
+fec_new(int k, int n)
+{
+    int row, col ;
+    gf *p, *tmp_m ;
+
+    struct fec_parms *retval ;
+
+    init_fec();
+
+    if (k > GF_SIZE + 1 || n > GF_SIZE + 1 || k > n ) {
+    fprintf(stderr, "Invalid parameters k %d n %d GF_SIZE %d\n",
+        k, n, GF_SIZE );
+    return NULL ;
+    }
+    retval = my_malloc(sizeof(struct fec_parms), "new_code");
+    retval->k = k ;
+    retval->n = n ;
+    retval->type = FEC_VANDERMONDE ;
+    retval->sched = NULL ;
+    retval->enc_matrix = NEW_GF_MATRIX(n, k);
+    retval->magic = ( ( FEC_MAGIC ^ k) ^ n) ^ (long)(retval->enc_matrix) ;
+    retval->dec_cache = dec_cache_new(k) ;
+    retval->stats = stats_new(k, n, retval->type) ;
+    /*
+     * the upper matrix is I so do not bother with a slow multiply
+     */
+    bzero(retval->enc_matrix, k*k*sizeof(gf) );
+    for (p = retval->enc_matrix, col = 0 ; col < k ; col++, p += k+1 )
+    *p = 1 ;
+    if (k == 0) /* no source packets, the repair rows are empty too */
+    return retval ;
+#ifdef FEC_TABLES
+    {
+    const struct fec_baked *b ;
+
+    for (b = fec_baked ; b->k != 0 ; b++)
+        if (b->k == k && b->n == n) {
+        bcopy(b->m, retval->enc_matrix + k*k, (n - k)*k*sizeof(gf));
+        return retval ;
+        }
+    }
+#endif
+    tmp_m = NEW_GF_MATRIX(n, k);
+    /*
      * fill the matrix with powers of field elements, starting from 0.
      * The first row is special, cannot be computed with exp. table.
      */
@@ -662,12 +1710,6 @@ fec_new(int k, int n)
     TICK(ticks[3]);
     invert_vdm(tmp_m, k); /* much faster than invert_mat */
     matmul(tmp_m + k*k, tmp_m, retval->enc_matrix + k*k, n - k, k, k);
-    /*
-     * the upper matrix is I so do not bother with a slow multiply
-     */
-    bzero(retval->enc_matrix, k*k*sizeof(gf) );
-    for (p = retval->enc_matrix, col = 0 ; col < k ; col++, p += k+1 )
-    *p = 1 ;
     free(tmp_m);
     TOCK(ticks[3]);
 
@@ -677,6 +1719,259 @@ fec_new(int k, int n)
     return retval ;
 }
 
+/*
+ * Cauchy codes.
+ *
+ * fec_new_cauchy builds a systematic code whose n-k repair rows are a
+ * Cauchy matrix, c[i][j] = 1 / (x_i + y_j) with x_i = i and y_j = n-k+j.
+ * Every square submatrix of a Cauchy matrix is non-singular, and stays
+ * so when rows and columns are scaled, so the code is MDS. The columns
+ * are scaled to make the first repair row all ones, and (for 8 bit
+ * codes) each other row by whichever of its elements leaves the fewest
+ * ones in its bitmatrix.
+ *
+ * A field element e acts on GF_BITS bits as a GF_BITS x GF_BITS binary
+ * matrix, whose column c holds the bits of e * 2^c. Each packet is
+ * split into GF_BITS sub-packets (bit planes) of sz / GF_BITS bytes, and
+ * an output sub-packet is the XOR of the input sub-packets selected by
+ * one row of the bitmatrices of its coefficients. No multiplications
+ * are needed at all, and the fewer ones the bitmatrix has, the fewer
+ * XORs. The packet layout is different from the Vandermonde codes, so
+ * the two do not interoperate, and sz must be a multiple of GF_BITS
+ * bytes.
+ *
+ * Decoding inverts the same k*k matrix as for the Vandermonde codes
+ * (with the same cache); the bitmatrix of a product is the product of
+ * the bitmatrices, so applying the bitmatrix of each row of the
+ * inverse to the received packets recovers the missing ones.
+ */
+static int
+bitmatrix_ones(gf e)
+{
+    int c, ones = 0 ;
+    gf v ;
+
+    for (c = 0 ; c < GF_BITS ; c++)
+    for (v = gf_mul(e, 1 << c) ; v ; v &= v - 1)
+        ones++ ;
+    return ones ;
+}
+
+/*
+ * An XOR schedule is a list of sub-packet operations computing one
+ * output packet. Sources are sub-packets of the input packets, or
+ * (pkt < 0) sub-packets of the output computed earlier.
+ */
+#define XOP_ZERO    0    /* dst = 0 */
+#define XOP_COPY    1    /* dst = src */
+#define XOP_XOR     2    /* dst ^= src */
+
+struct xor_op {
+    int pkt ;
+    uint8_t type, sub, dst ;
+} ;
+
+/* work areas for cauchy_schedule(), for k inputs */
+#define CAUCHY_BITS_WS(k)   ((k) * GF_BITS * GF_BITS)
+#define CAUCHY_OPS_WS(k)    ((k) * GF_BITS * GF_BITS * sizeof(struct xor_op))
+
+/*
+ * cauchy_schedule writes to ops the schedule that computes the output
+ * packet with coefficients coef[0..k-1], and returns its length. Each
+ * output bit row is either built from scratch, or derived from a row
+ * computed before by XORing in the bits where the two differ, whichever
+ * takes fewer operations. bits is a work area of CAUCHY_BITS_WS(k)
+ * bytes, ops must have room for CAUCHY_OPS_WS(k) bytes.
+ */
+static int
+cauchy_schedule(gf *coef, int k, uint8_t *bits, struct xor_op *ops)
+{
+    int r, q, c, j, i, kw = k * GF_BITS ;
+    int best, cost, best_cost, nops = 0 ;
+    uint8_t *row ;
+    gf v ;
+
+    for (j = 0 ; j < k ; j++)
+    for (c = 0 ; c < GF_BITS ; c++) {
+        v = gf_mul(coef[j], 1 << c) ;
+        for (r = 0 ; r < GF_BITS ; r++)
+        bits[r*kw + j*GF_BITS + c] = (v >> r) & 1 ;
+    }
+    for (r = 0 ; r < GF_BITS ; r++) {
+    row = bits + r*kw ;
+    for (best = -1, best_cost = 0, i = 0 ; i < kw ; i++)
+        best_cost += row[i] ;
+    for (q = 0 ; q < r ; q++) {
+        for (cost = 1, i = 0 ; i < kw ; i++)
+        cost += row[i] ^ bits[q*kw + i] ;
+        if (cost < best_cost) {
+        best = q ;
+        best_cost = cost ;
+        }
+    }
+    if (best >= 0) {
+        ops[nops].type = XOP_COPY ;
+        ops[nops].pkt = -1 ;
+        ops[nops].sub = best ;
+        ops[nops++].dst = r ;
+    }
+    for (i = 0 ; i < kw ; i++) {
+        if (best >= 0 ? row[i] == bits[best*kw + i] : !row[i])
+        continue ;
+        ops[nops].type = best < 0 && (nops == 0 || ops[nops-1].dst != r) ?
+        XOP_COPY : XOP_XOR ;
+        ops[nops].pkt = i / GF_BITS ;
+        ops[nops].sub = i % GF_BITS ;
+        ops[nops++].dst = r ;
+    }
+    if (nops == 0 || ops[nops-1].dst != r) {    /* an all zero row */
+        ops[nops].type = XOP_ZERO ;
+        ops[nops++].dst = r ;
+    }
+    }
+    return nops ;
+}
+
+/*
+ * cauchy_run executes a schedule on bytes [off, off + len) of each of
+ * the GF_BITS sub-packets of slice bytes of the inputs. out holds the
+ * same range of the GF_BITS sub-packets of the output, one after the
+ * other.
+ */
+static void
+cauchy_run(struct xor_op *ops, int nops, gf *in[], int slice, int off,
+    uint8_t *out, int len)
+{
+    uint8_t *dst, *src ;
+    int i ;
+
+    for (i = 0 ; i < nops ; i++) {
+    dst = out + ops[i].dst * len ;
+    if (ops[i].type == XOP_ZERO) {
+        bzero(dst, len) ;
+        continue ;
+    }
+    if (ops[i].pkt < 0)
+        src = out + ops[i].sub * len ;
+    else
+        src = (uint8_t *)in[ops[i].pkt] + ops[i].sub * slice + off ;
+    if (ops[i].type == XOP_COPY)
+        bcopy(src, dst, len) ;
+    else
+        xor1(dst, src, len) ;
+    }
+}
+
+/*
+ * sched_new builds the schedules of the repair rows of a Cauchy code,
+ * each in an array of its own length.
+ */
+static struct fec_sched *
+sched_new(struct fec_parms *code)
+{
+    int i, k = code->k, m = code->n - code->k ;
+    struct fec_sched *s = my_malloc(sizeof(*s), "cauchy schedules") ;
+    uint8_t *bits = my_malloc(CAUCHY_BITS_WS(k), "cauchy bits") ;
+    struct xor_op *ops = my_malloc(CAUCHY_OPS_WS(k), "cauchy ops") ;
+
+    s->nops = my_malloc((m > 0 ? m : 1) * sizeof(int), "cauchy schedules") ;
+    s->ops = my_malloc((m > 0 ? m : 1) * sizeof(struct xor_op *),
+    "cauchy schedules") ;
+    for (i = 0 ; i < m ; i++) {
+    s->nops[i] = cauchy_schedule(&code->enc_matrix[(k + i)*k], k, bits, ops) ;
+    s->ops[i] = my_malloc(s->nops[i] * sizeof(struct xor_op),
+        "cauchy schedule") ;
+    bcopy(ops, s->ops[i], s->nops[i] * sizeof(struct xor_op)) ;
+    }
+    free(ops) ;
+    free(bits) ;
+    return s ;
+}
+
+struct fec_parms *
+fec_new_cauchy(int k, int n)
+{
+    int i, j, l, m = n - k ;
+    gf *p, c ;
+    struct fec_parms *retval ;
+
+    init_fec();
+
+    if (k < 1 || n > GF_SIZE + 1 || k > n ) {
+    fprintf(stderr, "Invalid parameters k %d n %d GF_SIZE %d\n",
+        k, n, GF_SIZE );
+    return NULL ;
+    }
+    retval = my_malloc(sizeof(struct fec_parms), "new_code");
+    retval->k = k ;
+    retval->n = n ;
+    retval->type = FEC_CAUCHY ;
+    retval->enc_matrix = NEW_GF_MATRIX(n, k);
+    retval->magic = ( ( FEC_MAGIC ^ k) ^ n) ^ (long)(retval->enc_matrix) ;
+    retval->dec_cache = dec_cache_new(k) ;
+    retval->stats = stats_new(k, n, retval->type) ;
+
+    bzero(retval->enc_matrix, k*k*sizeof(gf) );
+    for (p = retval->enc_matrix, j = 0 ; j < k ; j++, p += k+1 )
+    *p = 1 ;
+    p = retval->enc_matrix + k*k ;
+    for (i = 0 ; i < m ; i++)
+    for (j = 0 ; j < k ; j++)
+        p[i*k + j] = inverse[i ^ (m + j)] ;
+    for (j = 0 ; m > 0 && j < k ; j++) {
+    c = inverse[p[j]] ;
+    for (i = 0 ; i < m ; i++)
+        p[i*k + j] = gf_mul(p[i*k + j], c) ;
+    }
+    if (GF_BITS <= 8) {
+    for (i = 1 ; i < m ; i++) {
+        int ones, best = 0, best_ones = 0 ;
+
+        for (l = 0 ; l < k ; l++)
+        best_ones += bitmatrix_ones(p[i*k + l]) ;
+        for (j = 0 ; j < k ; j++) {
+        c = inverse[p[i*k + j]] ;
+        for (ones = 0, l = 0 ; l < k ; l++)
+            ones += bitmatrix_ones(gf_mul(p[i*k + l], c)) ;
+        if (ones < best_ones) {
+            best_ones = ones ;
+            best = c ;
+        }
+        }
+        if (best)
+        for (l = 0 ; l < k ; l++)
+            p[i*k + l] = gf_mul(p[i*k + l], best) ;
+    }
+    }
+    retval->sched = sched_new(retval) ;
+    DEB(pr_matrix(retval->enc_matrix, n, k, "cauchy encoding_matrix");)
+    return retval ;
+}
+
+/*
+ * cauchy_encode computes the repair packet with index index >= k of a
+ * Cauchy code; bytes is the packet size in bytes.
+ */
+static void
+cauchy_encode(struct fec_parms *code, gf *src[], gf *fec, int index,
+    int bytes)
+{
+    int i = index - code->k ;
+
+    cauchy_run(code->sched->ops[i], code->sched->nops[i], src,
+    bytes / GF_BITS, 0, (uint8_t *)fec, bytes / GF_BITS) ;
+}
+
+static int
+cauchy_size_ok(int bytes)
+{
+    if (bytes % GF_BITS == 0)
+    return 1 ;
+    fprintf(stderr, "Cauchy codes need a size multiple of %d bytes, not %d\n",
+    GF_BITS, bytes) ;
+    return 0 ;
+}
+
 /*
  * fec_encode accepts as input pointers to n data packets of size sz,
  * and produces as output a packet pointed to by fec, computed
@@ -687,12 +1982,17 @@ fec_encode(struct fec_parms *code, gf *src[], gf *fec, int index, int sz)
 {
     int i, k = code->k ;
     gf *p ;
+    STATS_START(t0) ;
 
     if (GF_BITS > 8)
     sz /= 2 ;
 
+    if (code->type == FEC_CAUCHY && !cauchy_size_ok(sz*sizeof(gf)))
+    return ;
     if (index < k)
          bcopy(src[index], fec, sz*sizeof(gf) ) ;
+    else if (code->type == FEC_CAUCHY && index < code->n)
+    cauchy_encode(code, src, fec, index, sz*sizeof(gf)) ;
     else if (index < code->n) {
     p = &(code->enc_matrix[index*k] );
         bzero(fec, sz*sizeof(gf));
@@ -701,81 +2001,645 @@ fec_encode(struct fec_parms *code, gf *src[], gf *fec, int index, int sz)
     } else
     fprintf(stderr, "Invalid index %d (max %d)\n",
         index, code->n - 1 );
+    STATS_ENCODE(code, t0, sz*sizeof(gf)) ;
 }
 
 /*
- * shuffle move src packets in their position
+ * fec_encode_multi produces nidx packets at once, the j-th one with
+ * index index[j] into fec[j]. Rather than making one pass over the
+ * source packets for each output, the packets are processed in strips
+ * small enough that the current strip of all outputs stays in cache,
+ * so each strip of source data is read from memory only once.
  */
+#define FEC_CACHE_BYTES    (128*1024)    /* budget for one strip of outputs */
+#define FEC_STRIP_MIN      256           /* bytes */
+
 static int
-shuffle(gf *pkt[], int index[], int k)
+strip_size(int nbufs, int sz)
 {
-    int i;
+    int strip = FEC_CACHE_BYTES / (nbufs * (int)sizeof(gf)) ;
 
-    for ( i = 0 ; i < k ; ) {
-    if (index[i] >= k || index[i] == i)
-        i++ ;
-    else {
-        /*
-         * put pkt in the right position (first check for conflicts).
-         */
-        int c = index[i] ;
+    strip &= ~63 ;    /* keep strips a multiple of the widest vector */
+    if (strip < FEC_STRIP_MIN / (int)sizeof(gf))
+    strip = FEC_STRIP_MIN / sizeof(gf) ;
+    return strip < sz ? strip : sz ;
+}
 
-        if (index[c] == c) {
-        DEB(fprintf(stderr, "\nshuffle, error at %d\n", i);)
-        return 1 ;
+/*
+ * encode_range does the work of fec_encode_multi for symbols [from, to)
+ * of the outputs with index >= k.
+ */
+static void
+encode_range(struct fec_parms *code, gf *src[], gf *fec[], int index[],
+    int nidx, int from, int to)
+{
+    int i, j, m, pos, len, strip, k = code->k, n = code->n ;
+    gf *p = code->enc_matrix ;
+    gf *d[4], c[4] ;
+
+    strip = strip_size(nidx + 1, to - from) ;
+    for (pos = from ; pos < to ; pos += len) {
+    len = to - pos < strip ? to - pos : strip ;
+    for (j = 0 ; j < nidx ; j++)
+        if (index[j] >= k && index[j] < n)
+        bzero(fec[j] + pos, len*sizeof(gf));
+    for (i = 0 ; i < k ; i++) {
+        for (m = 0, j = 0 ; j < nidx ; j++) {
+        if (index[j] < k || index[j] >= n)
+            continue ;
+        d[m] = fec[j] + pos ;
+        c[m] = p[index[j]*k + i] ;
+        if (++m == 4) {
+            addmul4(d, src[i] + pos, c, len) ;
+            m = 0 ;
         }
-        SWAP(index[i], index[c], int) ;
-        SWAP(pkt[i], pkt[c], gf *) ;
-    }
-    }
-    DEB( /* just test that it works... */
-    for ( i = 0 ; i < k ; i++ ) {
-    if (index[i] < k && index[i] != i) {
-        fprintf(stderr, "shuffle: after\n");
-        for (i=0; i<k ; i++) fprintf(stderr, "%3d ", index[i]);
-        fprintf(stderr, "\n");
-        return 1 ;
+        }
+        while (m-- > 0)
+        addmul(d[m], src[i] + pos, c[m], len) ;
     }
     }
-    )
-    return 0 ;
 }
 
 /*
- * build_decode_matrix constructs the encoding matrix given the
- * indexes. The matrix must be already allocated as
- * a vector of k*k elements, in row-major order
+ * copy_sources handles the outputs with index < k, and complains
+ * about invalid ones.
  */
-static gf *
-build_decode_matrix(struct fec_parms *code, gf *pkt[], int index[])
+static void
+copy_sources(struct fec_parms *code, gf *src[], gf *fec[], int index[],
+    int nidx, int sz)
 {
-    int i , k = code->k ;
-    gf *p, *matrix = NEW_GF_MATRIX(k, k);
+    int j ;
 
-    TICK(ticks[9]);
-    for (i = 0, p = matrix ; i < k ; i++, p += k ) {
-#if 1 /* this is simply an optimization, not very useful indeed */
-    if (index[i] < k) {
-        bzero(p, k*sizeof(gf) );
-        p[i] = 1 ;
-    } else
-#endif
-    if (index[i] < code->n )
-        bcopy( &(code->enc_matrix[index[i]*k]), p, k*sizeof(gf) );
+    for (j = 0 ; j < nidx ; j++) {
+    if (index[j] < code->k)
+        bcopy(src[index[j]], fec[j], sz*sizeof(gf) ) ;
+    else if (index[j] >= code->n)
+        fprintf(stderr, "Invalid index %d (max %d)\n", index[j], code->n - 1 );
+    }
+}
+
+/*
+ * encode_multi is fec_encode_multi without the counters. Returns
+ * non-zero if sz does not suit the code.
+ */
+static int
+encode_multi(struct fec_parms *code, gf *src[], gf *fec[], int index[],
+    int nidx, int sz)
+{
+    int j ;
+
+    if (GF_BITS > 8)
+    sz /= 2 ;
+
+    if (code->type == FEC_CAUCHY) {
+    if (!cauchy_size_ok(sz*sizeof(gf)))
+        return 1 ;
+    copy_sources(code, src, fec, index, nidx, sz) ;
+    for (j = 0 ; j < nidx ; j++)
+        if (index[j] >= code->k && index[j] < code->n)
+        cauchy_encode(code, src, fec[j], index[j], sz*sizeof(gf)) ;
+    } else {
+    copy_sources(code, src, fec, index, nidx, sz) ;
+    encode_range(code, src, fec, index, nidx, 0, sz) ;
+    }
+    return 0 ;
+}
+
+void
+fec_encode_multi(struct fec_parms *code, gf *src[], gf *fec[], int index[],
+    int nidx, int sz)
+{
+    STATS_START(t0) ;
+
+    if (encode_multi(code, src, fec, index, nidx, sz) == 0)
+    STATS_ENCODE(code, t0, (uint64_t)nidx*sz) ;
+}
+
+/*
+ * shuffle move src packets in their position
+ */
+static int
+shuffle(gf *pkt[], int index[], int k)
+{
+    int i;
+
+    for ( i = 0 ; i < k ; ) {
+    if (index[i] >= k || index[i] == i)
+        i++ ;
+    else {
+        /*
+         * put pkt in the right position (first check for conflicts).
+         */
+        int c = index[i] ;
+
+        if (index[c] == c) {
+        DEB(fprintf(stderr, "\nshuffle, error at %d\n", i);)
+        return 1 ;
+        }
+        SWAP(index[i], index[c], int) ;
+        SWAP(pkt[i], pkt[c], gf *) ;
+    }
+    }
+    DEB( /* just test that it works... */
+    for ( i = 0 ; i < k ; i++ ) {
+    if (index[i] < k && index[i] != i) {
+        fprintf(stderr, "shuffle: after\n");
+        for (i=0; i<k ; i++) fprintf(stderr, "%3d ", index[i]);
+        fprintf(stderr, "\n");
+        return 1 ;
+    }
+    }
+    )
+    return 0 ;
+}
+
+/*
+ * build_decode_matrix constructs the decoding matrix given the
+ * indexes, into matrix, a vector of k*k elements in row-major order.
+ * The source packets that were received are in their own slot, so
+ * their rows are those of the identity, and only the rows of the m
+ * missing ones are needed. With B the m*m submatrix of the encoding
+ * matrix made of the rows of the repair packets received and the
+ * columns of the missing source packets, x the missing packets, r the
+ * repair packets and s the source packets received, r = B x + A s,
+ * hence x = inv(B) r + inv(B) A s: so only B is inverted, O(m^3)
+ * rather than O(k^3) for the whole matrix, and the rest is m*m row
+ * operations.
+ * ws is a work area of DECODE_MAT_WS(k) bytes, aligned for int.
+ * Returns non-zero on error.
+ */
+#define DECODE_MAT_WS(k) ((k)*sizeof(int) + INVERT_MAT_WS(k) + (k)*(k)*sizeof(gf))
+
+static int
+build_decode_matrix(struct fec_parms *code, int index[], gf *matrix, void *ws)
+{
+    int i, a, c, m, k = code->k ;
+    int *miss = ws ;
+    void *inv_ws = miss + k ;
+    gf *b = (gf *)((char *)inv_ws + INVERT_MAT_WS(k)), *p ;
+
+    TICK(ticks[9]);
+    bzero(matrix, k*k*sizeof(gf)) ;
+    for (i = 0, m = 0 ; i < k ; i++) {
+    if (index[i] < k)
+        matrix[i*k + i] = 1 ;
+    else if (index[i] < code->n)
+        miss[m++] = i ;
     else {
         fprintf(stderr, "decode: invalid index %d (max %d)\n",
         index[i], code->n - 1 );
-        free(matrix) ;
-        return NULL ;
+        return 1 ;
     }
     }
-    TICK(ticks[9]);
-    if (invert_mat(matrix, k)) {
-    free(matrix);
-    matrix = NULL ;
+    for (a = 0 ; a < m ; a++)
+    for (c = 0 ; c < m ; c++)
+        b[a*m + c] = code->enc_matrix[index[miss[a]]*k + miss[c]] ;
+    if (invert_mat(b, m, inv_ws))
+    return 1 ;
+    for (a = 0 ; a < m ; a++) {
+    p = matrix + miss[a]*k ;
+    for (c = 0 ; c < m ; c++)
+        addmul(p, &code->enc_matrix[index[miss[c]]*k], b[a*m + c], k) ;
+    for (c = 0 ; c < m ; c++)
+        p[miss[c]] = b[a*m + c] ;
     }
     TOCK(ticks[9]);
-    return matrix ;
+    return 0 ;
+}
+
+/*
+ * canonical_order fills key[] with the canonical index vector (see
+ * above) for the shuffled index[], and in[] with the packets in the
+ * same order, and slot[] (unless it is NULL) with the position in
+ * pkt[] of each of them. pairs is a work area of k index/slot pairs.
+ */
+struct index_slot {
+    int index, slot ;
+} ;
+
+static int
+index_slot_cmp(const void *a, const void *b)
+{
+    return ((const struct index_slot *)a)->index -
+    ((const struct index_slot *)b)->index ;
+}
+
+static void
+canonical_order(gf *pkt[], int index[], int k, int key[], gf *in[],
+    int slot[], struct index_slot *pairs)
+{
+    int i, nrep = 0 ;
+
+    for (i = 0 ; i < k ; i++) {
+    key[i] = index[i] ;
+    in[i] = pkt[i] ;
+    if (slot != NULL)
+        slot[i] = i ;
+    if (index[i] >= k) {
+        pairs[nrep].index = index[i] ;
+        pairs[nrep].slot = i ;
+        nrep++ ;
+    }
+    }
+    qsort(pairs, nrep, sizeof(*pairs), index_slot_cmp) ;
+    for (nrep = 0, i = 0 ; i < k ; i++) {
+    if (index[i] >= k) {
+        key[i] = pairs[nrep].index ;
+        in[i] = pkt[pairs[nrep].slot] ;
+        if (slot != NULL)
+        slot[i] = pairs[nrep].slot ;
+        nrep++ ;
+    }
+    }
+}
+
+/*
+ * Layout of the scratch area used by fec_decode_with_scratch():
+ * the build_decode_matrix() work area, the k*k decoding matrix, the canonical
+ * key and packet order, and room for one strip of each of the (at
+ * most nmiss) packets being reconstructed. As in encode_range() the
+ * strips are sized for the outputs and one input to share the cache.
+ * Each part is rounded up to 64 bytes.
+ */
+#define SCRATCH_ROUND(x)    (((x) + 63) & ~(size_t)63)
+
+static int
+decode_strip_size(int nmiss, int sz)
+{
+    return strip_size(nmiss + 1, sz) ;
+}
+
+static int
+decode_setup_size(int k)
+{
+    return SCRATCH_ROUND(DECODE_MAT_WS(k)) +
+    SCRATCH_ROUND(k * k * sizeof(gf)) +
+    SCRATCH_ROUND(k * sizeof(int)) +
+    SCRATCH_ROUND(k * sizeof(gf *)) +
+    SCRATCH_ROUND(k * sizeof(struct index_slot)) ;
+}
+
+/*
+ * Cauchy codes reconstruct a strip of the same bytes of each of the
+ * GF_BITS sub-packets of every missing packet at a time. The schedules
+ * of the missing rows are built once per decode, packed one after the
+ * other into CAUCHY_SCHED_WS bytes of scratch (or less, if that is
+ * enough for nmiss schedules of any length). Rows whose schedule does
+ * not fit are rescheduled for each strip in a spare CAUCHY_OPS_WS(k)
+ * at the end, so strips are no shorter than CAUCHY_STRIP_MIN bytes for
+ * that cost to stay small next to the XORs.
+ */
+#define CAUCHY_STRIP_MIN    2048    /* bytes of each sub-packet */
+#define CAUCHY_SCHED_WS     (8 << 20)
+
+struct cauchy_row {
+    struct xor_op *ops ;    /* NULL to schedule for each strip */
+    int nops ;
+} ;
+
+/*
+ * the bytes of scratch for the schedules of nmiss rows, spare included
+ */
+static int
+cauchy_sched_room(int k, int nmiss)
+{
+    int ws = CAUCHY_OPS_WS(k) ;
+
+    if (nmiss < CAUCHY_SCHED_WS / ws)
+    return (nmiss + 1) * ws ;
+    return CAUCHY_SCHED_WS > 2 * ws ? CAUCHY_SCHED_WS : 2 * ws ;
+}
+
+static int
+cauchy_strip_size(int nmiss, int slice)
+{
+    int strip = FEC_CACHE_BYTES / (nmiss * GF_BITS) ;
+
+    strip &= ~63 ;
+    if (strip < CAUCHY_STRIP_MIN)
+    strip = CAUCHY_STRIP_MIN ;
+    return strip < slice ? strip : slice ;
+}
+
+/*
+ * the most packets a decode can reconstruct: those it received in place
+ * of them are repair packets, and there are n - k of those.
+ */
+static int
+max_missing(struct fec_parms *code)
+{
+    return code->n - code->k < code->k ? code->n - code->k : code->k ;
+}
+
+static int
+count_missing(int index[], int k)
+{
+    int i, nmiss = 0 ;
+
+    for (i = 0 ; i < k ; i++)
+    if (index[i] >= k)
+        nmiss++ ;
+    return nmiss ;
+}
+
+/*
+ * the scratch size for a decode of at most nmiss missing packets
+ */
+static int
+decode_scratch_size(struct fec_parms *code, int sz, int nmiss)
+{
+    if (GF_BITS > 8)
+    sz /= 2 ;
+    if (nmiss < 1)
+    nmiss = 1 ;
+    if (code->type == FEC_CAUCHY)    /* schedules, and a strip per output */
+    return decode_setup_size(code->k) +
+        SCRATCH_ROUND(CAUCHY_BITS_WS(code->k)) +
+        SCRATCH_ROUND(nmiss * sizeof(struct cauchy_row)) +
+        SCRATCH_ROUND(cauchy_sched_room(code->k, nmiss)) +
+        SCRATCH_ROUND(nmiss * GF_BITS *
+        cauchy_strip_size(nmiss, sz * sizeof(gf) / GF_BITS)) ;
+    return decode_setup_size(code->k) +
+    SCRATCH_ROUND(nmiss * decode_strip_size(nmiss, sz) * sizeof(gf)) ;
+}
+
+int
+fec_decode_scratch_size(struct fec_parms *code, int sz)
+{
+    return decode_scratch_size(code, sz, max_missing(code)) ;
+}
+
+/*
+ * nothing_missing tells if index[] holds only source packets, in which
+ * case decoding is just shuffling them into place.
+ */
+static int
+nothing_missing(int index[], int k)
+{
+    int i ;
+
+    for (i = 0 ; i < k ; i++)
+    if (index[i] >= k)
+        return 0 ;
+    return 1 ;
+}
+
+/*
+ * decode_setup shuffles the packets, and fetches (or builds) the
+ * decoding matrix, using the first decode_setup_size(k) bytes of
+ * scratch. On return *m_dec is the matrix and *in the received packets
+ * in the order of its columns, which come from the slots of pkt[] in
+ * slot[] if that is not NULL; *m_dec is NULL if all the source packets
+ * were received, and there is nothing more to do.
+ */
+static int
+decode_setup(struct fec_parms *code, gf *pkt[], int index[], char *base,
+    gf **m_dec, gf ***in, int slot[])
+{
+    int *key ;
+    struct index_slot *pairs ;
+    unsigned long hash ;
+    int k = code->k ;
+
+    if (shuffle(pkt, index, k))    /* error if true */
+    return 1 ;
+    if (nothing_missing(index, k)) {
+    *m_dec = NULL ;
+    return 0 ;
+    }
+
+    *m_dec = (gf *)(base + SCRATCH_ROUND(DECODE_MAT_WS(k))) ;
+    key = (int *)((char *)*m_dec + SCRATCH_ROUND(k * k * sizeof(gf))) ;
+    *in = (gf **)((char *)key + SCRATCH_ROUND(k * sizeof(int))) ;
+    pairs = (struct index_slot *)((char *)*in + SCRATCH_ROUND(k * sizeof(gf *))) ;
+
+    canonical_order(pkt, index, k, key, *in, slot, pairs) ;
+    hash = dec_cache_hash(key, k) ;
+    if (!dec_cache_get(code->dec_cache, key, hash, *m_dec)) {
+    if (build_decode_matrix(code, key, *m_dec, base))
+        return 1 ; /* error */
+    dec_cache_put(code->dec_cache, key, hash, *m_dec) ;
+    STATS_COUNT(code, FEC_STAT_INVERSIONS) ;
+    } else
+    STATS_COUNT(code, FEC_STAT_CACHE_HITS) ;
+    return 0 ;
+}
+
+/*
+ * decode_range reconstructs symbols [from, to) of the missing packets,
+ * strip by strip, using strips (room for a strip of strip symbols for
+ * each of them).
+ * Only that range of the repair packets is overwritten, so disjoint
+ * ranges can be decoded concurrently.
+ */
+static void
+decode_range(struct fec_parms *code, gf *m_dec, gf *in[], gf *pkt[],
+    int index[], int from, int to, gf *strips, int strip)
+{
+    gf *out, *d[4], c[4] ;
+    int row, col, m, pos, len, k = code->k ;
+
+    for (pos = from ; pos < to ; pos += len) {
+    len = to - pos < strip ? to - pos : strip ;
+    for (out = strips, row = 0 ; row < k ; row++ ) {
+        if (index[row] >= k) {
+        bzero(out, len * sizeof(gf) ) ;
+        out += strip ;
+        }
+    }
+    for (col = 0 ; col < k ; col++ ) {
+        for (m = 0, out = strips, row = 0 ; row < k ; row++ ) {
+        if (index[row] < k)
+            continue ;
+        d[m] = out ;
+        c[m] = m_dec[row*k + col] ;
+        out += strip ;
+        if (++m == 4) {
+            addmul4(d, in[col] + pos, c, len) ;
+            m = 0 ;
+        }
+        }
+        while (m-- > 0)
+        addmul(d[m], in[col] + pos, c[m], len) ;
+    }
+    /*
+     * move this strip of the pkts to their final destination
+     */
+    for (out = strips, row = 0 ; row < k ; row++ ) {
+        if (index[row] >= k) {
+        bcopy(out, pkt[row] + pos, len*sizeof(gf));
+        out += strip ;
+        }
+    }
+    }
+}
+
+/*
+ * cauchy_plan builds the schedules of the missing rows of a Cauchy code
+ * once decode_setup() is done, in ws, the scratch of decode_scratch_size()
+ * for nmiss missing packets. cauchy_decode() can then run them on any
+ * number of sets of packets with the same index[], such as the chunks of
+ * fec_decode_sg().
+ */
+static void
+cauchy_plan(struct fec_parms *code, gf *m_dec, int index[], char *ws,
+    int nmiss)
+{
+    int k = code->k, room = cauchy_sched_room(k, nmiss) ;
+    uint8_t *bits = (uint8_t *)ws ;
+    struct cauchy_row *rows = (struct cauchy_row *)(ws +
+    SCRATCH_ROUND(CAUCHY_BITS_WS(k))) ;
+    char *sched = (char *)rows + SCRATCH_ROUND(nmiss * sizeof(*rows)) ;
+    struct xor_op *spare = (struct xor_op *)(sched + room - CAUCHY_OPS_WS(k)) ;
+    struct xor_op *ops = (struct xor_op *)sched ;
+    int i, row ;
+
+    for (i = 0, row = 0 ; row < k ; row++)
+    if (index[row] >= k) {
+        if (ops + CAUCHY_OPS_WS(k) / sizeof(*ops) <= spare) {
+        rows[i].ops = ops ;
+        rows[i].nops = cauchy_schedule(&m_dec[row*k], k, bits, ops) ;
+        ops += rows[i].nops ;
+        } else
+        rows[i].ops = NULL ;
+        i++ ;
+    }
+}
+
+/*
+ * cauchy_decode reconstructs the missing packets of a Cauchy code once
+ * cauchy_plan() is done on ws. The repair packets being overwritten are
+ * inputs to the other missing packets, so as in decode_range() each
+ * strip of all of them is computed into ws before it is copied into
+ * place; the outputs are in ws in the order of the missing rows.
+ */
+static void
+cauchy_decode(struct fec_parms *code, gf *m_dec, gf *in[], gf *pkt[],
+    int index[], int bytes, char *ws, int nmiss)
+{
+    int k = code->k, room = cauchy_sched_room(k, nmiss) ;
+    uint8_t *bits = (uint8_t *)ws ;
+    struct cauchy_row *rows = (struct cauchy_row *)(ws +
+    SCRATCH_ROUND(CAUCHY_BITS_WS(k))) ;
+    char *sched = (char *)rows + SCRATCH_ROUND(nmiss * sizeof(*rows)) ;
+    struct xor_op *spare = (struct xor_op *)(sched + room - CAUCHY_OPS_WS(k)) ;
+    uint8_t *strips = (uint8_t *)sched + SCRATCH_ROUND(room) ;
+    uint8_t *out ;
+    int i, row, sub, nops, off, len ;
+    int slice = bytes / GF_BITS, strip = cauchy_strip_size(nmiss, slice) ;
+
+    for (off = 0 ; off < slice ; off += len) {
+    len = slice - off < strip ? slice - off : strip ;
+    for (i = 0, out = strips, row = 0 ; row < k ; row++)
+        if (index[row] >= k) {
+        if (rows[i].ops != NULL)
+            cauchy_run(rows[i].ops, rows[i].nops, in, slice, off, out, len) ;
+        else {
+            nops = cauchy_schedule(&m_dec[row*k], k, bits, spare) ;
+            cauchy_run(spare, nops, in, slice, off, out, len) ;
+        }
+        out += GF_BITS * strip ;
+        i++ ;
+        }
+    for (out = strips, row = 0 ; row < k ; row++)
+        if (index[row] >= k) {
+        for (sub = 0 ; sub < GF_BITS ; sub++)
+            bcopy(out + sub * len, (uint8_t *)pkt[row] + sub * slice + off,
+            len) ;
+        out += GF_BITS * strip ;
+        }
+    }
+}
+
+/*
+ * decode_run reconstructs the packets of the rows of sel[] that are
+ * >= k, of sz symbols, once decode_setup() (and for a Cauchy code
+ * cauchy_plan()) is done on base, which has the room of
+ * decode_scratch_size() for nmiss missing packets.
+ */
+static void
+decode_run(struct fec_parms *code, gf *m_dec, gf *in[], gf *pkt[],
+    int sel[], int sz, char *base, int nmiss)
+{
+    char *ws = base + decode_setup_size(code->k) ;
+
+    if (code->type == FEC_CAUCHY)
+    cauchy_decode(code, m_dec, in, pkt, sel, sz*sizeof(gf), ws, nmiss) ;
+    else
+    decode_range(code, m_dec, in, pkt, sel, 0, sz, (gf *)ws,
+        decode_strip_size(nmiss, sz)) ;
+}
+
+/*
+ * decode_rows is fec_decode_with_scratch, reconstructing only the
+ * missing packets listed in want[] if it is not NULL. rows is then a
+ * work area of k ints, where the rows not wanted are marked as present
+ * so that cauchy_decode() and decode_range() skip them. base has the
+ * room of decode_scratch_size() for nmiss missing packets.
+ */
+static int
+decode_rows(struct fec_parms *code, gf *pkt[], int index[], int sz,
+    char *base, int nmiss, int want[], int nwant, int rows[])
+{
+    gf *m_dec, **in ;
+    int i, row, *sel = index, k = code->k ;
+
+    if (GF_BITS > 8)
+    sz /= 2 ;
+
+    if (code->type == FEC_CAUCHY && !cauchy_size_ok(sz*sizeof(gf)))
+    return 1 ;
+    for (i = 0 ; want != NULL && i < nwant ; i++)
+    if (want[i] < 0 || want[i] >= k) {
+        fprintf(stderr, "decode: invalid wanted index %d (max %d)\n",
+        want[i], k - 1 );
+        return 1 ;
+    }
+    if (decode_setup(code, pkt, index, base, &m_dec, &in, NULL))
+    return 1 ;
+    if (m_dec == NULL)
+    return 0 ;    /* all source packets are there */
+    if (want != NULL) {
+    for (row = 0 ; row < k ; row++)
+        rows[row] = row ;
+    for (i = 0 ; i < nwant ; i++)
+        rows[want[i]] = index[want[i]] ;
+    sel = rows ;
+    }
+    if (code->type == FEC_CAUCHY)
+    cauchy_plan(code, m_dec, sel, base + decode_setup_size(k), nmiss) ;
+    decode_run(code, m_dec, in, pkt, sel, sz, base, nmiss) ;
+    for (row = 0 ; row < k ; row++ )
+    if (sel[row] >= k)
+        index[row] = row;
+    return 0;
+}
+
+/*
+ * fec_decode_with_scratch is fec_decode without any memory allocation:
+ * all temporary storage comes from the caller-supplied scratch area of
+ * fec_decode_scratch_size(code, sz) bytes (at least pointer aligned, 64
+ * byte aligned for best performance), so it can be reused across calls
+ * and threads do not contend in malloc.
+ * The decoding matrix is looked up in the code's cache first, and is
+ * only inverted on a miss.
+ * The matrix-vector product is done in strips: one strip of every
+ * missing packet is computed into the scratch area while the matching
+ * strip of the received packets is in cache, and then copied to its
+ * final place. At that point the strip of the repair packets that it
+ * overwrites is no longer needed.
+ */
+int
+fec_decode_with_scratch(struct fec_parms *code, gf *pkt[], int index[],
+    int sz, void *scratch)
+{
+    STATS_START(t0) ;
+
+    if (decode_rows(code, pkt, index, sz, scratch, max_missing(code),
+        NULL, 0, NULL))
+    return 1 ;
+    STATS_DECODE(code, t0, (uint64_t)code->k*sz) ;
+    return 0 ;
 }
 
 /*
@@ -792,45 +2656,710 @@ build_decode_matrix(struct fec_parms *code, gf *pkt[], int index[])
 int
 fec_decode(struct fec_parms *code, gf *pkt[], int index[], int sz)
 {
-    gf *m_dec ;
-    gf **new_pkt ;
-    int row, col , k = code->k ;
+    int ret, nmiss = count_missing(index, code->k) ;
+    void *scratch = NULL ;
+    STATS_START(t0) ;
+
+    /* room for the packets that are actually missing */
+    if (nmiss > 0)
+    scratch = my_malloc(decode_scratch_size(code, sz, nmiss),
+        "decode scratch") ;
+    ret = decode_rows(code, pkt, index, sz, scratch, nmiss, NULL, 0, NULL) ;
+    free(scratch) ;
+    if (ret == 0)
+    STATS_DECODE(code, t0, (uint64_t)code->k*sz) ;
+    return ret ;
+}
+
+/*
+ * fec_decode_subset is fec_decode for readers that need only some of
+ * the source packets, say the one block of a file being served: want[]
+ * holds the nwant source indexes needed, and only those that are
+ * missing are reconstructed, in their slot of pkt[] (with their index
+ * set as fec_decode does). The other repair packets are left alone,
+ * with their index, so the cost is O(k * wanted * sz) rather than
+ * O(k * missing * sz).
+ */
+int
+fec_decode_subset(struct fec_parms *code, gf *pkt[], int index[], int sz,
+    int want[], int nwant)
+{
+    int size, ret, *rows = NULL, nmiss = count_missing(index, code->k) ;
+    char *scratch = NULL ;
+    STATS_START(t0) ;
+
+    if (nmiss > 0) {
+    size = decode_scratch_size(code, sz, nmiss) ;
+    scratch = my_malloc(size + code->k * sizeof(int), "decode scratch") ;
+    rows = (int *)(scratch + size) ;
+    }
+    ret = decode_rows(code, pkt, index, sz, scratch, nmiss, want, nwant,
+    rows) ;
+    free(scratch) ;
+    if (ret == 0)
+    STATS_DECODE(code, t0, (uint64_t)code->k*sz) ;
+    return ret ;
+}
+
+/*
+ * Packets in chunks (see struct fec_sg in fec.h). The chunks at the
+ * same position in all packets are coded together, as packets of their
+ * own: the code is linear, so that is the same as coding the whole
+ * packets, and each round works on k chunks that fit in the cache. The
+ * decoding matrix (and for a Cauchy code the XOR schedules) is set up
+ * once, for all the chunks.
+ */
+static gf *
+sg_chunk(struct fec_sg *p, int c)
+{
+    if (p->chunks != NULL)
+    return p->chunks[c] ;
+    return (gf *)((char *)p->base + c * p->stride) ;
+}
+
+void
+fec_encode_sg(struct fec_parms *code, struct fec_sg src[],
+    struct fec_sg fec[], int index[], int nidx, int chunk, int nchunks)
+{
+    gf **s = my_malloc(code->k * sizeof(gf *), "sg src") ;
+    gf **f = my_malloc(nidx * sizeof(gf *), "sg fec") ;
+    int i, c ;
+    STATS_START(t0) ;
+
+    for (c = 0 ; c < nchunks ; c++) {
+    for (i = 0 ; i < code->k ; i++)
+        s[i] = sg_chunk(&src[i], c) ;
+    for (i = 0 ; i < nidx ; i++)
+        f[i] = sg_chunk(&fec[i], c) ;
+    if (encode_multi(code, s, f, index, nidx, chunk))
+        break ;
+    }
+    if (c == nchunks)
+    STATS_ENCODE(code, t0, (uint64_t)nidx*chunk*nchunks) ;
+    free(s) ;
+    free(f) ;
+}
+
+/*
+ * fec_decode_sg is fec_decode for packets in chunks. Like fec_decode it
+ * shuffles pkt[] and index[], here moving the descriptors.
+ */
+int
+fec_decode_sg(struct fec_parms *code, struct fec_sg pkt[], int index[],
+    int chunk, int nchunks)
+{
+    gf **p, **in, **inc, *m_dec ;
+    int *slot, i, c, nmiss, ret = 0, sz = chunk, k = code->k ;
+    char *scratch ;
+    STATS_START(t0) ;
 
     if (GF_BITS > 8)
     sz /= 2 ;
+    if (code->type == FEC_CAUCHY && !cauchy_size_ok(sz*sizeof(gf)))
+    return 1 ;
 
-    if (shuffle(pkt, index, k))    /* error if true */
+    for (i = 0 ; i < k ; ) {    /* shuffle(), on the descriptors */
+    if (index[i] >= k || index[i] == i)
+        i++ ;
+    else if (index[index[i]] == index[i])
+        return 1 ;
+    else {
+        c = index[i] ;
+        SWAP(index[i], index[c], int) ;
+        SWAP(pkt[i], pkt[c], struct fec_sg) ;
+    }
+    }
+    if (nothing_missing(index, k))
+    return 0 ;
+
+    p = my_malloc(k * sizeof(gf *), "sg pkt") ;
+    inc = my_malloc(k * sizeof(gf *), "sg in") ;
+    slot = my_malloc(k * sizeof(int), "sg slot") ;
+    nmiss = count_missing(index, k) ;
+    scratch = my_malloc(decode_scratch_size(code, chunk, nmiss),
+    "decode scratch") ;
+    /* the chunks of packet i are all at slot i of pkt[] */
+    for (i = 0 ; i < k ; i++)
+    p[i] = nchunks > 0 ? sg_chunk(&pkt[i], 0) : NULL ;
+    if (decode_setup(code, p, index, scratch, &m_dec, &in, slot)) {
+    ret = 1 ;
+    goto done ;
+    }
+    if (code->type == FEC_CAUCHY)
+    cauchy_plan(code, m_dec, index, scratch + decode_setup_size(k), nmiss) ;
+    for (c = 0 ; c < nchunks ; c++) {
+    for (i = 0 ; i < k ; i++) {
+        p[i] = sg_chunk(&pkt[i], c) ;
+        inc[i] = sg_chunk(&pkt[slot[i]], c) ;
+    }
+    decode_run(code, m_dec, inc, p, index, sz, scratch, nmiss) ;
+    }
+    for (i = 0 ; i < k ; i++)
+    if (index[i] >= k)
+        index[i] = i ;
+    STATS_DECODE(code, t0, (uint64_t)k*chunk*nchunks) ;
+done:
+    free(scratch) ;
+    free(slot) ;
+    free(inc) ;
+    free(p) ;
+    return ret ;
+}
+
+/*
+ * Incremental decoding.
+ *
+ * A fec_inc takes the packets of one segment as they arrive, and keeps
+ * the ones received so far in reduced row echelon form: each useful
+ * packet is stored as a row of coefficients (over the source packets)
+ * plus its payload, every row has a 1 in its own pivot column and no
+ * other row has anything there. A new packet is reduced against the
+ * rows there are, scaled so its pivot is 1, and then eliminated from
+ * the other rows. That is O(rank * sz) work per packet, so by the time
+ * the k-th packet arrives the rest is done already and completing the
+ * segment costs O(k * sz) instead of an inversion plus O(k^2 * sz).
+ * A packet that depends on the ones before (a duplicate, say) reduces
+ * to zero and is dropped.
+ *
+ * Row p is kept in rows[p*k] and its payload in data[p]. data[p] is
+ * unused while column p is not a pivot, which is where a new packet is
+ * scaled into; spare holds the packet being reduced.
+ */
+struct fec_inc {
+    struct fec_parms *code ;
+    int k, sz ;                 /* sz in symbols */
+    int rank ;
+    int *pivots ;               /* the first rank entries are pivot columns */
+    char *have ;                /* have[p]: column p is a pivot */
+    gf *rows ;                  /* k*k */
+    gf **data ;                 /* k payloads */
+    gf *spare ;
+    gf *v ;                     /* k, the row being reduced */
+} ;
+
+struct fec_inc *
+fec_inc_new(struct fec_parms *code, int sz)
+{
+    struct fec_inc *inc ;
+    int i, k = code->k ;
+
+    if (GF_BITS > 8)
+    sz /= 2 ;
+    if (code->type != FEC_VANDERMONDE) {
+    fprintf(stderr, "fec_inc_new: only Vandermonde codes are supported\n");
+    return NULL ;
+    }
+    inc = my_malloc(sizeof(struct fec_inc), "fec_inc") ;
+    inc->code = code ;
+    inc->k = k ;
+    inc->sz = sz ;
+    inc->pivots = my_malloc(k * sizeof(int), "fec_inc pivots") ;
+    inc->have = my_malloc(k, "fec_inc have") ;
+    inc->rows = NEW_GF_MATRIX(k, k) ;
+    inc->v = NEW_GF_MATRIX(1, k) ;
+    inc->data = my_malloc(k * sizeof(gf *), "fec_inc data") ;
+    for (i = 0 ; i < k ; i++)
+    inc->data[i] = my_malloc(sz * sizeof(gf), "fec_inc payload") ;
+    inc->spare = my_malloc(sz * sizeof(gf), "fec_inc payload") ;
+    fec_inc_reset(inc) ;
+    return inc ;
+}
+
+void
+fec_inc_reset(struct fec_inc *inc)
+{
+    inc->rank = 0 ;
+    bzero(inc->have, inc->k) ;
+}
+
+void
+fec_inc_free(struct fec_inc *inc)
+{
+    int i ;
+
+    if (inc == NULL)
+    return ;
+    for (i = 0 ; i < inc->k ; i++)
+    free(inc->data[i]) ;
+    free(inc->data) ;
+    free(inc->spare) ;
+    free(inc->v) ;
+    free(inc->rows) ;
+    free(inc->have) ;
+    free(inc->pivots) ;
+    free(inc) ;
+}
+
+/*
+ * fec_inc_add absorbs packet index. Returns 1 if it was useful, 0 if it
+ * was not (it depends on the packets before, or the segment is already
+ * complete) and -1 if the index is out of range.
+ */
+int
+fec_inc_add(struct fec_inc *inc, gf *pkt, int index)
+{
+    int i, p, q, k = inc->k, sz = inc->sz ;
+    gf *v = inc->v, *row, *x = inc->spare, c ;
+
+    if (index < 0 || index >= inc->code->n)
+    return -1 ;
+    if (inc->rank == k)
+    return 0 ;
+    bcopy(&inc->code->enc_matrix[index*k], v, k*sizeof(gf)) ;
+    bcopy(pkt, x, sz*sizeof(gf)) ;
+
+    /* reduce against the rows there are */
+    for (i = 0 ; i < inc->rank ; i++) {
+    q = inc->pivots[i] ;
+    c = v[q] ;
+    if (c == 0)
+        continue ;
+    addmul1(v, &inc->rows[q*k], c, k) ;
+    addmul1(x, inc->data[q], c, sz) ;
+    }
+    for (p = 0 ; p < k && v[p] == 0 ; p++)
+    ;
+    if (p == k)
+    return 0 ;
+
+    /* scale into row p, so that its pivot is 1 */
+    row = &inc->rows[p*k] ;
+    c = inverse[v[p]] ;
+    bzero(row, k*sizeof(gf)) ;
+    addmul1(row, v, c, k) ;
+    if (c == 1) {
+    inc->spare = inc->data[p] ;
+    inc->data[p] = x ;
+    } else {
+    bzero(inc->data[p], sz*sizeof(gf)) ;
+    addmul1(inc->data[p], x, c, sz) ;
+    }
+
+    /* and clear column p in the other rows */
+    for (i = 0 ; i < inc->rank ; i++) {
+    q = inc->pivots[i] ;
+    c = inc->rows[q*k + p] ;
+    if (c == 0)
+        continue ;
+    addmul1(&inc->rows[q*k], row, c, k) ;
+    addmul1(inc->data[q], inc->data[p], c, sz) ;
+    }
+    inc->have[p] = 1 ;
+    inc->pivots[inc->rank++] = p ;
     return 1 ;
-    m_dec = build_decode_matrix(code, pkt, index);
+}
 
-    if (m_dec == NULL)
-    return 1 ; /* error */
-    /*
-     * do the actual decoding
-     */
-    new_pkt = my_malloc (k * sizeof (gf * ), "new pkt pointers" );
-    for (row = 0 ; row < k ; row++ ) {
-    if (index[row] >= k) {
-        new_pkt[row] = my_malloc (sz * sizeof (gf), "new pkt buffer" );
-        bzero(new_pkt[row], sz * sizeof(gf) ) ;
-        for (col = 0 ; col < k ; col++ )
-        addmul(new_pkt[row], pkt[col], m_dec[row*k + col], sz) ;
+/*
+ * fec_inc_rank returns the number of useful packets so far; the
+ * segment is complete when it reaches k.
+ */
+int
+fec_inc_rank(struct fec_inc *inc)
+{
+    return inc->rank ;
+}
+
+/*
+ * fec_inc_packet returns source packet i if it is known, which it is
+ * once the segment is complete, or earlier if its row has nothing but
+ * the pivot left (it arrived itself, or enough repair packets did).
+ * Otherwise it returns NULL. The packet belongs to inc, and is valid
+ * until the next fec_inc_add, fec_inc_reset or fec_inc_free.
+ */
+gf *
+fec_inc_packet(struct fec_inc *inc, int i)
+{
+    int j, k = inc->k ;
+
+    if (i < 0 || i >= k || !inc->have[i])
+    return NULL ;
+    if (inc->rank < k)
+    for (j = 0 ; j < k ; j++)
+        if (j != i && inc->rows[i*k + j] != 0)
+        return NULL ;
+    return inc->data[i] ;
+}
+
+/*
+ * Parallel engine.
+ *
+ * A fec_pool runs one encode or decode at a time on nthreads threads
+ * (the caller plus nthreads - 1 workers). The packets are cut into
+ * chunks of symbols, and each chunk is a task that runs encode_range()
+ * or decode_range() on its part of every packet. The tasks are dealt
+ * out as one contiguous range per thread; a thread takes tasks from the
+ * bottom of its own range, and when that is empty it steals the top
+ * half of another thread's range. Ranges are (lo, hi) pairs packed in a
+ * 64 bit word and updated with compare-and-swap. A range only shrinks
+ * until it is empty, and a task once taken is never returned, so a
+ * non-empty value can not reappear (no ABA).
+ *
+ * Latency rather than throughput is the goal: a single large segment
+ * gets all the threads.
+ */
+#define FEC_TASKS_PER_THREAD    4
+#define RANGE(lo, hi)   ((uint64_t)(uint32_t)(lo) | ((uint64_t)(hi) << 32))
+#define RANGE_LO(r)     ((int)(uint32_t)(r))
+#define RANGE_HI(r)     ((int)((r) >> 32))
+
+struct fec_job {
+    void (*fn)(struct fec_pool *pool, int worker, int task) ;
+    int ntasks, chunk, sz ;     /* chunks of chunk symbols out of sz */
+    struct fec_parms *code ;
+    gf **src, **dst ;           /* encode: src, fec. decode: in, pkt */
+    int *index, nidx ;          /* decode: nidx is the missing count */
+    gf *m_dec ;                 /* decode only */
+    int strip ;
+} ;
+
+struct fec_range {
+    volatile uint64_t r ;
+    char pad[64 - sizeof(uint64_t)] ;   /* one cache line each */
+} ;
+
+struct fec_worker {
+    struct fec_pool *pool ;
+    int id ;
+} ;
+
+struct fec_pool {
+    int nthreads ;
+    fec_thread_t *threads ;
+    struct fec_worker *workers ;
+    struct fec_range *ranges ;
+    fec_mutex_t submit ;        /* one job at a time */
+    fec_mutex_t lock ;          /* protects the fields below */
+    fec_cond_t wake, done ;
+    unsigned long generation ;
+    int active, shutdown ;
+    struct fec_job job ;
+    char *scratch ;             /* decode work area, grown on demand */
+    int scratch_size ;
+} ;
+
+static int
+range_pop(struct fec_pool *pool, int self)
+{
+    volatile uint64_t *p = &pool->ranges[self].r ;
+    uint64_t r ;
+    int lo, hi ;
+
+    for (;;) {
+    r = fec_load64(p) ;
+    lo = RANGE_LO(r) ;
+    hi = RANGE_HI(r) ;
+    if (lo >= hi)
+        return -1 ;
+    if (fec_cas64(p, r, RANGE(lo + 1, hi)))
+        return lo ;
     }
+}
+
+static int
+range_steal(struct fec_pool *pool, int self)
+{
+    volatile uint64_t *p ;
+    uint64_t r ;
+    int i, lo, hi, take, n = pool->nthreads ;
+
+    for (i = 1 ; i < n ; i++) {
+    p = &pool->ranges[(self + i) % n].r ;
+    for (;;) {
+        r = fec_load64(p) ;
+        lo = RANGE_LO(r) ;
+        hi = RANGE_HI(r) ;
+        if (lo >= hi)
+        break ;
+        take = (hi - lo + 1) / 2 ;
+        if (fec_cas64(p, r, RANGE(lo, hi - take))) {
+        /* run the first stolen task, leave the rest to be stolen */
+        fec_store64(&pool->ranges[self].r, RANGE(hi - take + 1, hi)) ;
+        return hi - take ;
+        }
     }
-    /*
-     * move pkts to their final destination
-     */
-    for (row = 0 ; row < k ; row++ ) {
-    if (index[row] >= k) {
-        bcopy(new_pkt[row], pkt[row], sz*sizeof(gf));
-        free(new_pkt[row]);
-            index[row] = row;
     }
+    return -1 ;
+}
+
+static void
+pool_run(struct fec_pool *pool, int self)
+{
+    int task ;
+
+    while ((task = range_pop(pool, self)) >= 0 ||
+        (task = range_steal(pool, self)) >= 0)
+    pool->job.fn(pool, self, task) ;
+}
+
+FEC_THREAD_FN(pool_worker, arg)
+{
+    struct fec_worker *w = arg ;
+    struct fec_pool *pool = w->pool ;
+    unsigned long seen = 0 ;
+
+    fec_mutex_lock(&pool->lock) ;
+    for (;;) {
+    while (!pool->shutdown && pool->generation == seen)
+        fec_cond_wait(&pool->wake, &pool->lock) ;
+    if (pool->shutdown)
+        break ;
+    seen = pool->generation ;
+    fec_mutex_unlock(&pool->lock) ;
+    pool_run(pool, w->id) ;
+    fec_mutex_lock(&pool->lock) ;
+    if (--pool->active == 0)
+        fec_cond_broadcast(&pool->done) ;
+    }
+    fec_mutex_unlock(&pool->lock) ;
+    FEC_THREAD_RETURN ;
+}
+
+/*
+ * pool_execute runs pool->job to completion. The caller holds
+ * pool->submit, and works on the job too.
+ */
+static void
+pool_execute(struct fec_pool *pool)
+{
+    int w, n = pool->nthreads, ntasks = pool->job.ntasks ;
+
+    if (n == 1 || ntasks == 1) {
+    for (w = 0 ; w < ntasks ; w++)
+        pool->job.fn(pool, 0, w) ;
+    return ;
     }
-    free(new_pkt);
-    free(m_dec);
+    for (w = 0 ; w < n ; w++)
+    fec_store64(&pool->ranges[w].r,
+        RANGE((long)ntasks * w / n, (long)ntasks * (w + 1) / n)) ;
+    fec_mutex_lock(&pool->lock) ;
+    pool->active = n - 1 ;
+    pool->generation++ ;
+    fec_cond_broadcast(&pool->wake) ;
+    fec_mutex_unlock(&pool->lock) ;
+
+    pool_run(pool, 0) ;
+
+    fec_mutex_lock(&pool->lock) ;
+    while (pool->active > 0)
+    fec_cond_wait(&pool->done, &pool->lock) ;
+    fec_mutex_unlock(&pool->lock) ;
+}
 
-    return 0;
+/*
+ * Size of the tasks sz symbols are cut into: enough tasks for
+ * stealing to even out the load, but not so small that they stop
+ * amortizing the per-task overhead.
+ */
+static int
+pool_chunk(struct fec_pool *pool, int sz)
+{
+    int n = pool->nthreads * FEC_TASKS_PER_THREAD ;
+    int chunk = ((sz + n - 1) / n + 63) & ~63 ;
+
+    if (chunk < FEC_STRIP_MIN / (int)sizeof(gf))
+    chunk = FEC_STRIP_MIN / sizeof(gf) ;
+    return chunk ;
+}
+
+static int
+cpu_count(void)
+{
+#if defined(WIN32) || defined(_WIN32)
+    SYSTEM_INFO si ;
+
+    GetSystemInfo(&si) ;
+    return si.dwNumberOfProcessors ;
+#elif defined(_SC_NPROCESSORS_ONLN)
+    return sysconf(_SC_NPROCESSORS_ONLN) ;
+#else
+    return 1 ;
+#endif
+}
+
+/*
+ * fec_pool_new creates a pool of nthreads threads, counting the
+ * calling thread; nthreads <= 0 means one per online CPU.
+ * Returns NULL if no thread could be started.
+ */
+struct fec_pool *
+fec_pool_new(int nthreads)
+{
+    struct fec_pool *pool ;
+    int i ;
+
+    if (nthreads <= 0)
+    nthreads = cpu_count() ;
+    if (nthreads < 1)
+    nthreads = 1 ;
+    pool = my_malloc(sizeof(*pool), "new pool") ;
+    bzero(pool, sizeof(*pool)) ;
+    pool->nthreads = nthreads ;
+    pool->threads = my_malloc(nthreads * sizeof(fec_thread_t), "pool threads") ;
+    pool->workers = my_malloc(nthreads * sizeof(struct fec_worker), "pool workers") ;
+    pool->ranges = my_malloc(nthreads * sizeof(struct fec_range), "pool ranges") ;
+    bzero(pool->ranges, nthreads * sizeof(struct fec_range)) ;
+    fec_mutex_init(&pool->submit) ;
+    fec_mutex_init(&pool->lock) ;
+    fec_cond_init(&pool->wake) ;
+    fec_cond_init(&pool->done) ;
+    for (i = 1 ; i < nthreads ; i++) {
+    pool->workers[i].pool = pool ;
+    pool->workers[i].id = i ;
+    if (fec_thread_create(&pool->threads[i], pool_worker, &pool->workers[i])) {
+        fprintf(stderr, "fec_pool_new: only %d of %d threads started\n",
+        i, nthreads) ;
+        break ;
+    }
+    }
+    pool->nthreads = i ;
+    return pool ;
+}
+
+void
+fec_pool_free(struct fec_pool *pool)
+{
+    int i ;
+
+    if (pool == NULL)
+    return ;
+    fec_mutex_lock(&pool->lock) ;
+    pool->shutdown = 1 ;
+    fec_cond_broadcast(&pool->wake) ;
+    fec_mutex_unlock(&pool->lock) ;
+    for (i = 1 ; i < pool->nthreads ; i++)
+    fec_thread_join(pool->threads[i]) ;
+    fec_cond_destroy(&pool->done) ;
+    fec_cond_destroy(&pool->wake) ;
+    fec_mutex_destroy(&pool->lock) ;
+    fec_mutex_destroy(&pool->submit) ;
+    free(pool->scratch) ;
+    free(pool->ranges) ;
+    free(pool->workers) ;
+    free(pool->threads) ;
+    free(pool) ;
+}
+
+int
+fec_pool_threads(struct fec_pool *pool)
+{
+    return pool->nthreads ;
+}
+
+static void
+encode_task(struct fec_pool *pool, int worker, int task)
+{
+    struct fec_job *j = &pool->job ;
+    int from = task * j->chunk ;
+    int to = from + j->chunk < j->sz ? from + j->chunk : j->sz ;
+
+    encode_range(j->code, j->src, j->dst, j->index, j->nidx, from, to) ;
+}
+
+/*
+ * fec_encode_parallel is fec_encode_multi spread over the pool.
+ */
+void
+fec_encode_parallel(struct fec_pool *pool, struct fec_parms *code,
+    gf *src[], gf *fec[], int index[], int nidx, int sz)
+{
+    struct fec_job *j = &pool->job ;
+    STATS_START(t0) ;
+
+    if (code->type != FEC_VANDERMONDE) {    /* not striped (yet) */
+    fec_encode_multi(code, src, fec, index, nidx, sz) ;
+    return ;
+    }
+    if (GF_BITS > 8)
+    sz /= 2 ;
+
+    fec_mutex_lock(&pool->submit) ;
+    copy_sources(code, src, fec, index, nidx, sz) ;
+    j->fn = encode_task ;
+    j->code = code ;
+    j->src = src ;
+    j->dst = fec ;
+    j->index = index ;
+    j->nidx = nidx ;
+    j->sz = sz ;
+    j->chunk = pool_chunk(pool, sz) ;
+    j->ntasks = (sz + j->chunk - 1) / j->chunk ;
+    pool_execute(pool) ;
+    fec_mutex_unlock(&pool->submit) ;
+    STATS_ENCODE(code, t0, (uint64_t)nidx*sz*sizeof(gf)) ;
+}
+
+static void
+decode_task(struct fec_pool *pool, int worker, int task)
+{
+    struct fec_job *j = &pool->job ;
+    int from = task * j->chunk ;
+    int to = from + j->chunk < j->sz ? from + j->chunk : j->sz ;
+    gf *strips = (gf *)(pool->scratch + decode_setup_size(j->code->k) +
+    worker * SCRATCH_ROUND(j->nidx * j->strip * sizeof(gf))) ;
+
+    decode_range(j->code, j->m_dec, j->src, j->dst, j->index, from, to,
+    strips, j->strip) ;
+}
+
+/*
+ * fec_decode_parallel is fec_decode spread over the pool. The decoding
+ * matrix is set up once by the calling thread, then each thread
+ * reconstructs its chunks of the missing packets in its own strip
+ * buffers from the pool's work area.
+ */
+int
+fec_decode_parallel(struct fec_pool *pool, struct fec_parms *code,
+    gf *pkt[], int index[], int sz)
+{
+    struct fec_job *j = &pool->job ;
+    gf *m_dec, **in ;
+    int row, need, chunk, strip, nmiss, k = code->k ;
+    STATS_START(t0) ;
+
+    if (code->type != FEC_VANDERMONDE)
+    return fec_decode(code, pkt, index, sz) ;
+    if (GF_BITS > 8)
+    sz /= 2 ;
+
+    fec_mutex_lock(&pool->submit) ;
+    nmiss = count_missing(index, k) ;
+    chunk = pool_chunk(pool, sz) ;
+    strip = decode_strip_size(nmiss, chunk) ;
+    need = decode_setup_size(k) +
+    pool->nthreads * SCRATCH_ROUND(nmiss * strip * sizeof(gf)) ;
+    if (need > pool->scratch_size) {
+    free(pool->scratch) ;
+    pool->scratch = my_malloc(need, "pool scratch") ;
+    pool->scratch_size = need ;
+    }
+    if (decode_setup(code, pkt, index, pool->scratch, &m_dec, &in, NULL)) {
+    fec_mutex_unlock(&pool->submit) ;
+    return 1 ;
+    }
+    if (m_dec == NULL) {    /* all source packets are there */
+    fec_mutex_unlock(&pool->submit) ;
+    STATS_DECODE(code, t0, (uint64_t)k*sz*sizeof(gf)) ;
+    return 0 ;
+    }
+    j->fn = decode_task ;
+    j->code = code ;
+    j->src = in ;
+    j->dst = pkt ;
+    j->index = index ;
+    j->m_dec = m_dec ;
+    j->nidx = nmiss ;
+    j->sz = sz ;
+    j->chunk = chunk ;
+    j->strip = strip ;
+    j->ntasks = (sz + chunk - 1) / chunk ;
+    pool_execute(pool) ;
+    fec_mutex_unlock(&pool->submit) ;
+
+    for (row = 0 ; row < k ; row++ )
+    if (index[row] >= k)
+        index[row] = row;
+    STATS_DECODE(code, t0, (uint64_t)k*sz*sizeof(gf)) ;
+    return 0 ;
 }
 
 /*********** end of FEC code -- beginning of test code ************/
@@ -45,6 +45,7 @@
 #error GF_BITS NOT DEFINED!
 #endif
 
+#include <stddef.h>
 #if defined(__GNUC__) || !defined(_WIN32)
 #include <stdint.h>
 #else
@@ -57,6 +58,9 @@
 #ifndef uint32_t
 #define uint32_t unsigned int
 #endif
+#ifndef uint64_t
+#define uint64_t unsigned __int64
+#endif
 #endif
 
 #if (GF_BITS <= 8)
@@ -65,17 +69,107 @@ typedef uint8_t gf;
 typedef uint16_t gf;
 #endif
 
+struct fec_dec_cache ;
+struct fec_stats ;
+struct fec_sched ;
+
+#define FEC_VANDERMONDE	0
+#define FEC_CAUCHY	1	/* see fec_new_cauchy() */
+
 struct fec_parms {
     unsigned long magic ;
     int k, n ;		/* parameters of the code */
     gf *enc_matrix ;
+    struct fec_dec_cache *dec_cache ;	/* recently inverted decode matrices */
+    int type ;		/* FEC_VANDERMONDE or FEC_CAUCHY */
+    struct fec_stats *stats ;	/* of its (k, n), NULL without FEC_STATS */
+    struct fec_sched *sched ;	/* XOR schedules, NULL unless FEC_CAUCHY */
 } ;
 
+/*
+ * The counters filled in by fec_get_stats(), if the library is built
+ * with -DFEC_STATS. They are shared by all the codes of the same
+ * (k, n) and type, and outlive them. Bytes are those of the packets
+ * produced by the encoder, and of the k source packets of each decoded
+ * block. Bucket i of a latency histogram counts the calls that took
+ * less than 2^i microseconds (and at least 2^(i-1)); the last bucket
+ * has all the longer ones.
+ */
+#define FEC_STAT_ENCODE_CALLS	0
+#define FEC_STAT_ENCODE_BYTES	1
+#define FEC_STAT_DECODE_CALLS	2
+#define FEC_STAT_DECODE_BYTES	3
+#define FEC_STAT_INVERSIONS	4	/* decoding matrices built */
+#define FEC_STAT_CACHE_HITS	5	/* decoding matrices found cached */
+#define FEC_STAT_BUCKETS	24
+#define FEC_STAT_ENCODE_HIST	6
+#define FEC_STAT_DECODE_HIST	(FEC_STAT_ENCODE_HIST + FEC_STAT_BUCKETS)
+#define FEC_STAT_COUNT		(FEC_STAT_DECODE_HIST + FEC_STAT_BUCKETS)
+
 #define	GF_SIZE ((1 << GF_BITS) - 1)	/* powers of \alpha */
+
+/*
+ * The library is thread safe: init_fec() (called by fec_new()) runs
+ * once however many threads race on it, and a code may be used to
+ * encode and decode by any number of threads at once. Only fec_free()
+ * and fec_set_kernel() must not overlap with coding, and a struct
+ * fec_inc belongs to one thread at a time.
+ */
 void fec_free(struct fec_parms *p);
 struct fec_parms * fec_new(int k, int n);
+struct fec_parms * fec_new_cauchy(int k, int n);
 void init_fec();
 void fec_encode(struct fec_parms *code, gf *src[], gf *fec, int index, int sz);
+void fec_encode_multi(struct fec_parms *code, gf *src[], gf *fec[], int index[],
+    int nidx, int sz);
 int fec_decode(struct fec_parms *code, gf *pkt[], int index[], int sz);
+int fec_decode_scratch_size(struct fec_parms *code, int sz);
+int fec_decode_with_scratch(struct fec_parms *code, gf *pkt[], int index[],
+    int sz, void *scratch);
+int fec_decode_subset(struct fec_parms *code, gf *pkt[], int index[], int sz,
+    int want[], int nwant);
+
+/*
+ * A packet that is not in one piece of memory, such as one spread over
+ * the pages of a mapped file, as nchunks chunks of the same length:
+ * chunk c starts at chunks[c], or at base + c * stride if chunks is
+ * NULL. Chunks must be 16 bit aligned for GF(2^16) codes. Cauchy codes
+ * slice each chunk as a packet of its own, so chunks must be a multiple
+ * of GF_BITS bytes long, and the repair packets depend on their length.
+ */
+struct fec_sg {
+    void *base ;
+    size_t stride ;
+    void **chunks ;
+} ;
+
+void fec_encode_sg(struct fec_parms *code, struct fec_sg src[],
+    struct fec_sg fec[], int index[], int nidx, int chunk, int nchunks);
+int fec_decode_sg(struct fec_parms *code, struct fec_sg pkt[], int index[],
+    int chunk, int nchunks);
+void fec_decode_cache_stats(struct fec_parms *code, unsigned long *hits,
+    unsigned long *misses);
+void fec_set_decode_cache_size(struct fec_parms *code, int entries);
+int fec_get_stats(struct fec_parms *code, uint64_t stats[FEC_STAT_COUNT]);
+const char *fec_kernel_name(int i);
+const char *fec_get_kernel(void);
+int fec_set_kernel(const char *name);
+
+struct fec_inc ;
+struct fec_inc *fec_inc_new(struct fec_parms *code, int sz);
+void fec_inc_free(struct fec_inc *inc);
+void fec_inc_reset(struct fec_inc *inc);
+int fec_inc_add(struct fec_inc *inc, gf *pkt, int index);
+int fec_inc_rank(struct fec_inc *inc);
+gf *fec_inc_packet(struct fec_inc *inc, int i);
+
+struct fec_pool ;
+struct fec_pool *fec_pool_new(int nthreads);
+void fec_pool_free(struct fec_pool *pool);
+int fec_pool_threads(struct fec_pool *pool);
+void fec_encode_parallel(struct fec_pool *pool, struct fec_parms *code,
+    gf *src[], gf *fec[], int index[], int nidx, int sz);
+int fec_decode_parallel(struct fec_pool *pool, struct fec_parms *code,
+    gf *pkt[], int index[], int sz);
 
 /* end of file */
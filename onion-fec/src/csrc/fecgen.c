@@ -0,0 +1,88 @@
+/*
+ * fecgen.c -- generates the constant tables for fec.c
+ *
+ * Builds the GF tables the way init_fec() does, and the encoding
+ * matrices of the (k, n) pairs given as arguments the way fec_new()
+ * does, and prints them as C initializers. fec.c includes the output
+ * when compiled with -DFEC_TABLES='"fec_tables8.h"' (see the Makefile),
+ * so that the tables are in the read-only data of the library: there
+ * is nothing to compute at startup, and every process that maps the
+ * library shares one copy of them.
+ *
+ * usage: fec8gen [k,n ...] > fec_tables8.h
+ */
+
+#undef FEC_TABLES
+#include "fec.c"
+
+static void
+print_row(const gf *v, int len)
+{
+    int i ;
+
+    for (i = 0 ; i < len ; i++)
+	printf("%s%d,", i % 16 ? " " : "\n    ", v[i]) ;
+}
+
+static void
+print_table(const char *decl, const gf *v, int len)
+{
+    printf("%s = {", decl) ;
+    print_row(v, len) ;
+    printf("\n} ;\n\n") ;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct fec_parms *code ;
+    int i, j, k, n ;
+
+    init_fec() ;
+    printf("/* generated by fec%dgen, do not edit */\n\n", GF_BITS) ;
+    print_table("static const gf gf_exp[2*GF_SIZE]", gf_exp, 2*GF_SIZE) ;
+    printf("static const int gf_log[GF_SIZE + 1] = {") ;
+    for (i = 0 ; i <= GF_SIZE ; i++)
+	printf("%s%d,", i % 16 ? " " : "\n    ", gf_log[i]) ;
+    printf("\n} ;\n\n") ;
+    print_table("static const gf inverse[GF_SIZE+1]", inverse, GF_SIZE + 1) ;
+#if (GF_BITS <= 8)
+    printf("static const gf gf_mul_table[GF_SIZE + 1][GF_SIZE + 1] = {\n") ;
+    for (i = 0 ; i <= GF_SIZE ; i++) {
+	printf("  {") ;
+	print_row(gf_mul_table[i], GF_SIZE + 1) ;
+	printf("\n  },\n") ;
+    }
+    printf("} ;\n\n") ;
+    printf("static const gf gf_mul_nib[GF_SIZE + 1][2][16] = {\n") ;
+    for (i = 0 ; i <= GF_SIZE ; i++) {
+	printf("  {{") ;
+	print_row(gf_mul_nib[i][0], 16) ;
+	printf("\n  }, {") ;
+	print_row(gf_mul_nib[i][1], 16) ;
+	printf("\n  }},\n") ;
+    }
+    printf("} ;\n\n") ;
+#endif
+
+    /* the rows below the identity of each encoding matrix */
+    for (i = 1 ; i < argc ; i++) {
+	char decl[64] ;
+
+	if (sscanf(argv[i], "%d,%d", &k, &n) != 2 ||
+		(code = fec_new(k, n)) == NULL) {
+	    fprintf(stderr, "fecgen: bad geometry %s\n", argv[i]) ;
+	    return 1 ;
+	}
+	sprintf(decl, "static const gf fec_matrix_%d_%d[]", k, n) ;
+	print_table(decl, code->enc_matrix + k*k, (n - k) * k) ;
+	fec_free(code) ;
+    }
+    printf("static const struct fec_baked fec_baked[] = {\n") ;
+    for (j = 1 ; j < argc ; j++) {
+	sscanf(argv[j], "%d,%d", &k, &n) ;
+	printf("    { %d, %d, fec_matrix_%d_%d },\n", k, n, k, n) ;
+    }
+    printf("    { 0, 0, NULL }\n} ;\n") ;
+    return 0 ;
+}
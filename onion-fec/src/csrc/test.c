@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include "fec.h"
 
 /*
@@ -22,41 +23,6 @@
 #define bzero(d, siz)   memset((d), '\0', (siz))
 #endif
 
-/*
- * stuff used for testing purposes only
- */
-
-#define DEB(x)
-#define DDB(x) x
-#define	DEBUG	0	/* minimal debugging */
-#ifdef	MSDOS
-#include <time.h>
-struct timeval {
-    unsigned long ticks;
-};
-#define gettimeofday(x, dummy) { (x)->ticks = clock() ; }
-#define DIFF_T(a,b) (1+ 1000000*(a.ticks - b.ticks) / CLOCKS_PER_SEC )
-typedef unsigned long u_long ;
-typedef unsigned short u_short ;
-#else /* typically, unix systems */
-#include <sys/time.h>
-#define DIFF_T(a,b) \
-	(1+ 1000000*(a.tv_sec - b.tv_sec) + (a.tv_usec - b.tv_usec) )
-#endif
-
-#define TICK(t) \
-	{struct timeval x ; \
-	gettimeofday(&x, NULL) ; \
-	t = x.tv_usec + 1000000* (x.tv_sec & 0xff ) ; \
-	}
-#define TOCK(t) \
-	{ u_long t1 ; TICK(t1) ; \
-	  if (t1 < t) t = 256000000 + t1 - t ; \
-	  else t = t1 - t ; \
-	  if (t == 0) t = 1 ;}
-
-u_long ticks[10];	/* vars for timekeeping */
-
 void *
 my_malloc(int sz, char *s)
 {
@@ -146,17 +112,25 @@ test_decode(void *code, int k, int index[], int sz, char *s)
     for( i = 0 ; i < k ; i++ )
 	if (index[i] >= k ) reconstruct ++ ;
 
-    TICK(ticks[2]);
-    for( i = 0 ; i < k ; i++ )
-	fec_encode(code, d_original, d_src[i], index[i], sz );
-    TOCK(ticks[2]);
+    fec_encode_multi(code, d_original, d_src, index, k, sz );
+
+    /* fec_encode must agree with fec_encode_multi */
+    for( i = 0 ; i < k ; i++ ) {
+	gf *one = my_malloc(sz * sizeof(gf), "one");
+
+	fec_encode(code, d_original, one, index[i], sz );
+	if (bcmp(one, d_src[i], sz)) {
+	    errors++;
+	    fprintf(stderr, "error: fec_encode differs for index %d\n",
+		index[i]);
+	}
+	free(one);
+    }
 
-    TICK(ticks[1]);
     if (fec_decode(code, d_src, index, sz)) {
 	fprintf(stderr, "detected singular matrix for %s  \n", s);
 	return 1 ;
     }
-    TOCK(ticks[1]);
 
     for (i=0; i<k; i++)
 	if (bcmp(d_original[i], d_src[i], sz )) {
@@ -167,11 +141,622 @@ test_decode(void *code, int k, int index[], int sz, char *s)
 	fprintf(stderr, "Errors reconstructing %d blocks out of %d\n",
 	    errors, k);
 
-    fprintf(stderr,
-	"  k %3d, l %3d  c_enc %10.6f MB/s c_dec %10.6f MB/s     \r",
-	k, reconstruct,
-	(double)(k * sz * reconstruct)/(double)ticks[2],
-	(double)(k * sz * reconstruct)/(double)ticks[1]);
+    fprintf(stderr, "  k %3d, l %3d  ok     \r", k, reconstruct);
+    return errors ;
+}
+
+/*
+ * fec_encode_parallel and fec_decode_parallel must agree with the
+ * serial code. The packets are large enough to be cut into many tasks.
+ */
+int
+test_parallel(void *pool, void *code, int k, int index[], int sz)
+{
+    int errors = 0 ;
+    int i, item ;
+    gf **orig, **ref, **par ;
+
+    orig = my_malloc(k * sizeof(gf *), "orig ptr");
+    ref = my_malloc(k * sizeof(gf *), "ref ptr");
+    par = my_malloc(k * sizeof(gf *), "par ptr");
+    for (i = 0 ; i < k ; i++ ) {
+	orig[i] = my_malloc(sz * sizeof(gf), "orig data");
+	ref[i] = my_malloc(sz * sizeof(gf), "ref data");
+	par[i] = my_malloc(sz * sizeof(gf), "par data");
+	for (item=0; item < sz; item++)
+	    orig[i][item] = ((item * 7) ^ i) & GF_SIZE;
+    }
+
+    fec_encode_multi(code, orig, ref, index, k, sz );
+    fec_encode_parallel(pool, code, orig, par, index, k, sz );
+    for (i = 0 ; i < k ; i++ )
+	if (bcmp(ref[i], par[i], sz)) {
+	    errors++;
+	    fprintf(stderr, "error: parallel encode differs for index %d\n",
+		index[i]);
+	}
+
+    if (fec_decode_parallel(pool, code, par, index, sz)) {
+	fprintf(stderr, "error: parallel decode failed for k=%d\n", k);
+	errors++;
+    } else {
+	for (i = 0 ; i < k ; i++ )
+	    if (bcmp(orig[i], par[i], sz)) {
+		errors++;
+		fprintf(stderr, "error: parallel decode of block %d\n", i);
+	    }
+    }
+
+    for (i = 0 ; i < k ; i++ ) {
+	free(orig[i]);
+	free(ref[i]);
+	free(par[i]);
+    }
+    free(orig);
+    free(ref);
+    free(par);
+    return errors ;
+}
+
+/*
+ * fec_decode_subset must reconstruct every third source packet, and
+ * leave the other missing ones as the repair packets they were.
+ */
+int
+test_subset(void *code, int k, int index[], int sz)
+{
+    int errors = 0 ;
+    int i, j, item, nwant = 0, left = 0 ;
+    int *ix, *want ;
+    gf **orig, **enc, *one ;
+
+    ix = my_malloc(k * sizeof(int), "ix");
+    want = my_malloc(k * sizeof(int), "want");
+    orig = my_malloc(k * sizeof(gf *), "orig ptr");
+    enc = my_malloc(k * sizeof(gf *), "enc ptr");
+    one = my_malloc(sz * sizeof(gf), "one");
+    for (i = 0 ; i < k ; i++ ) {
+	orig[i] = my_malloc(sz * sizeof(gf), "orig data");
+	enc[i] = my_malloc(sz * sizeof(gf), "enc data");
+	for (item=0; item < sz; item++)
+	    orig[i][item] = ((item * 5) ^ i) & GF_SIZE;
+	ix[i] = index[i] ;
+	if (i % 3 == 0)
+	    want[nwant++] = i ;
+    }
+    /* the repair packets that must be left: one per source not wanted */
+    for (i = 0 ; i < k ; i++ ) {
+	for (j = 0 ; j < k && index[j] != i ; j++ )
+	    ;
+	if (j == k && i % 3 != 0)
+	    left++ ;
+    }
+
+    fec_encode_multi(code, orig, enc, ix, k, sz );
+    if (fec_decode_subset(code, enc, ix, sz, want, nwant)) {
+	fprintf(stderr, "error: subset decode failed for k=%d\n", k);
+	errors++;
+    } else {
+	for (i = 0 ; i < k ; i++ ) {
+	    if (ix[i] >= k)
+		left-- ;
+	    if (i % 3 == 0 && ix[i] != i) {
+		errors++;
+		fprintf(stderr, "error: subset decode skipped block %d\n", i);
+	    }
+	    if (ix[i] < k)
+		bcopy(orig[ix[i]], one, sz) ;
+	    else
+		fec_encode(code, orig, one, ix[i], sz) ;
+	    if (bcmp(one, enc[i], sz)) {
+		errors++;
+		fprintf(stderr, "error: subset decode of block %d (index %d)\n",
+		    i, ix[i]);
+	    }
+	}
+	if (left != 0) {
+	    errors++;
+	    fprintf(stderr, "error: subset decode did %d too many\n", left);
+	}
+    }
+
+    for (i = 0 ; i < k ; i++ ) {
+	free(orig[i]);
+	free(enc[i]);
+    }
+    free(orig);
+    free(enc);
+    free(one);
+    free(want);
+    free(ix);
+    return errors ;
+}
+
+/*
+ * fec_encode_sg and fec_decode_sg on packets cut into nchunks chunks:
+ * the sources are interleaved chunk by chunk in one buffer (a stride),
+ * the repair packets have their chunks in reverse order in another (a
+ * chunk list). They must get the sources back, and if whole is set
+ * agree with fec_encode_multi on the whole packets (Cauchy codes slice
+ * each chunk on its own, so there they do not).
+ */
+int
+test_sg(void *code, int k, int index[], int chunk, int nchunks, int whole)
+{
+    int errors = 0 ;
+    int i, c, item, sz = chunk * nchunks ;
+    int *ix ;
+    gf **orig, **ref ;
+    char *file, *rep ;
+    struct fec_sg *src, *pkt ;
+
+    ix = my_malloc(k * sizeof(int), "ix");
+    orig = my_malloc(k * sizeof(gf *), "orig ptr");
+    ref = my_malloc(k * sizeof(gf *), "ref ptr");
+    file = my_malloc(k * sz, "file");
+    rep = my_malloc(k * sz, "rep");
+    src = my_malloc(k * sizeof(*src), "src sg");
+    pkt = my_malloc(k * sizeof(*pkt), "pkt sg");
+    for (i = 0 ; i < k ; i++ ) {
+	orig[i] = my_malloc(sz, "orig data");
+	ref[i] = my_malloc(sz, "ref data");
+	for (item=0; item < sz / (int)sizeof(gf); item++)
+	    orig[i][item] = ((item * 3) ^ i) & GF_SIZE;
+	for (c = 0 ; c < nchunks ; c++)
+	    bcopy((char *)orig[i] + c * chunk, file + (c * k + i) * chunk,
+		chunk) ;
+	src[i].base = file + i * chunk ;
+	src[i].stride = k * chunk ;
+	src[i].chunks = NULL ;
+	pkt[i].chunks = my_malloc(nchunks * sizeof(void *), "chunks");
+	for (c = 0 ; c < nchunks ; c++)
+	    pkt[i].chunks[c] = rep + ((nchunks - 1 - c) * k + i) * chunk ;
+	ix[i] = index[i] ;
+    }
+
+    fec_encode_multi(code, orig, ref, index, k, sz );
+    fec_encode_sg(code, src, pkt, index, k, chunk, nchunks );
+    for (i = 0 ; i < k && whole ; i++ )
+	for (c = 0 ; c < nchunks ; c++)
+	    if (bcmp((char *)ref[i] + c * chunk, pkt[i].chunks[c], chunk)) {
+		errors++;
+		fprintf(stderr, "error: sg encode of index %d, chunk %d\n",
+		    index[i], c);
+	    }
+
+    if (fec_decode_sg(code, pkt, ix, chunk, nchunks)) {
+	fprintf(stderr, "error: sg decode failed for k=%d\n", k);
+	errors++;
+    } else {
+	for (i = 0 ; i < k ; i++ )
+	    for (c = 0 ; c < nchunks ; c++)
+		if (ix[i] != i || bcmp((char *)orig[i] + c * chunk,
+			pkt[i].chunks[c], chunk)) {
+		    errors++;
+		    fprintf(stderr, "error: sg decode of block %d, chunk %d\n",
+			i, c);
+		}
+    }
+
+    for (i = 0 ; i < k ; i++ ) {
+	free(orig[i]);
+	free(ref[i]);
+	free(pkt[i].chunks);
+    }
+    free(orig);
+    free(ref);
+    free(file);
+    free(rep);
+    free(src);
+    free(pkt);
+    free(ix);
+    return errors ;
+}
+
+/*
+ * The incremental decoder is fed the packets in index[] one at a time,
+ * with every other one sent twice, and must end up with the source
+ * packets. A source packet received as such is available right away.
+ */
+int
+test_incremental(void *code, int k, int index[], int sz)
+{
+    int errors = 0 ;
+    int i, item, rank ;
+    gf **orig, **enc, *p ;
+    void *inc ;
+
+    orig = my_malloc(k * sizeof(gf *), "orig ptr");
+    enc = my_malloc(k * sizeof(gf *), "enc ptr");
+    for (i = 0 ; i < k ; i++ ) {
+	orig[i] = my_malloc(sz * sizeof(gf), "orig data");
+	enc[i] = my_malloc(sz * sizeof(gf), "enc data");
+	for (item=0; item < sz; item++)
+	    orig[i][item] = ((item * 3) ^ (i * 5)) & GF_SIZE;
+    }
+    fec_encode_multi(code, orig, enc, index, k, sz );
+
+    inc = fec_inc_new(code, sz);
+    for (i = 0 ; i < k ; i++ ) {
+	rank = fec_inc_rank(inc);
+	if (fec_inc_add(inc, enc[i], index[i]) != 1 ||
+		(i & 1 && fec_inc_add(inc, enc[i], index[i]) != 0) ||
+		fec_inc_rank(inc) != rank + 1) {
+	    errors++;
+	    fprintf(stderr, "error: incremental add of index %d\n", index[i]);
+	}
+	if (index[i] < k && ((p = fec_inc_packet(inc, index[i])) == NULL ||
+		bcmp(p, orig[index[i]], sz))) {
+	    errors++;
+	    fprintf(stderr, "error: source packet %d not available\n",
+		index[i]);
+	}
+    }
+    if (fec_inc_add(inc, enc[0], index[0]) != 0) {
+	errors++;
+	fprintf(stderr, "error: incremental add past k\n");
+    }
+    for (i = 0 ; i < k ; i++ )
+	if ((p = fec_inc_packet(inc, i)) == NULL || bcmp(p, orig[i], sz)) {
+	    errors++;
+	    fprintf(stderr, "error: incremental decode of block %d\n", i);
+	}
+
+    fec_inc_free(inc);
+    for (i = 0 ; i < k ; i++ ) {
+	free(orig[i]);
+	free(enc[i]);
+    }
+    free(orig);
+    free(enc);
+    return errors ;
+}
+
+/*
+ * With the tables built in (see fecgen.c), fec_new(k, n) copies the
+ * encoding matrix for some (k, n). The rows do not depend on n, so
+ * the matrix must give the same repair packets as the one computed
+ * for (k, n + 1), which is never baked.
+ */
+int
+test_baked(int k, int n, int sz)
+{
+    int errors = 0 ;
+    int i, item ;
+    gf **orig, *p1, *p2 ;
+    void *baked = fec_new(k, n), *computed = fec_new(k, n + 1) ;
+
+    orig = my_malloc(k * sizeof(gf *), "orig ptr");
+    for (i = 0 ; i < k ; i++ ) {
+	orig[i] = my_malloc(sz * sizeof(gf), "orig data");
+	for (item=0; item < sz; item++)
+	    orig[i][item] = ((item * 7) ^ (i * 3)) & GF_SIZE;
+    }
+    p1 = my_malloc(sz * sizeof(gf), "p1");
+    p2 = my_malloc(sz * sizeof(gf), "p2");
+    for (i = k ; i < n ; i++) {
+	fec_encode(baked, orig, p1, i, sz);
+	fec_encode(computed, orig, p2, i, sz);
+	if (bcmp(p1, p2, sz)) {
+	    errors++;
+	    fprintf(stderr, "error: k %d n %d, repair packet %d differs\n",
+		k, n, i);
+	}
+    }
+    fec_free(baked);
+    fec_free(computed);
+    for (i = 0 ; i < k ; i++ )
+	free(orig[i]);
+    free(orig);
+    free(p1);
+    free(p2);
+    return errors ;
+}
+
+/*
+ * Several threads at once first create their own codes, racing on the
+ * initialization of the library, then all encode and decode with one
+ * shared code, with loss patterns that repeat so that they also meet
+ * in its decode cache.
+ */
+#define TEST_THREADS	8
+
+struct thread_arg {
+    void *code ;	/* shared code, or NULL to make one */
+    int id ;
+    int errors ;
+} ;
+
+static void *
+thread_worker(void *p)
+{
+    struct thread_arg *a = p ;
+    void *code = a->code ? a->code : fec_new(32, 64) ;
+    int k = 32, sz = 512 ;
+    int i, item, iter ;
+    int index[32] ;
+    gf *orig[32], *pkt[32] ;
+
+    for (i = 0 ; i < k ; i++ ) {
+	orig[i] = my_malloc(sz * sizeof(gf), "orig data");
+	pkt[i] = my_malloc(sz * sizeof(gf), "pkt data");
+	for (item=0; item < sz; item++)
+	    orig[i][item] = ((item * 5) ^ (i + a->id)) & GF_SIZE;
+    }
+    for (iter = 0 ; iter < 30 ; iter++) {
+	for (i = 0 ; i < k ; i++ )
+	    index[i] = (i + a->id + iter) % 3 ? i : k + i ;
+	fec_encode_multi(code, orig, pkt, index, k, sz);
+	if (fec_decode(code, pkt, index, sz))
+	    a->errors++ ;
+	for (i = 0 ; i < k ; i++ )
+	    if (bcmp(pkt[i], orig[i], sz))
+		a->errors++ ;
+    }
+    for (i = 0 ; i < k ; i++ ) {
+	free(orig[i]);
+	free(pkt[i]);
+    }
+    if (a->code == NULL)
+	fec_free(code);
+    return NULL ;
+}
+
+int
+test_threads(void)
+{
+    pthread_t th[TEST_THREADS] ;
+    struct thread_arg arg[TEST_THREADS] ;
+    void *shared = fec_new(32, 64) ;
+    int pass, i, n, errors = 0 ;
+
+    /* first each thread on a code of its own, then all on one */
+    for (pass = 0 ; pass < 2 ; pass++) {
+	n = 0 ;
+	for (i = 0 ; i < TEST_THREADS ; i++) {
+	    arg[i].code = pass ? shared : NULL ;
+	    arg[i].id = i ;
+	    arg[i].errors = 0 ;
+	    pthread_create(&th[i], NULL, thread_worker, &arg[i]);
+	}
+	for (i = 0 ; i < TEST_THREADS ; i++) {
+	    pthread_join(th[i], NULL);
+	    n += arg[i].errors ;
+	}
+	if (n)
+	    fprintf(stderr, "error: %d concurrent %s decodes failed\n",
+		n, pass ? "shared" : "private");
+	errors += n ;
+    }
+    fec_free(shared);
+    return errors ;
+}
+
+/*
+ * Cauchy packets long enough to be decoded in several strips, the last
+ * one short: through fec_decode(), with scratch for the lost packets
+ * only, then fec_decode_with_scratch(), with scratch for n - k of them.
+ */
+int
+test_cauchy_strips(void)
+{
+    int errors = 0 ;
+    int i, j, pass, k = 16, n = 24 ;
+    int sz = GF_BITS * (2 * 2048 + 72) ;
+    int index[16] ;
+    gf *orig[16], *pkt[16] ;
+    void *code = fec_new_cauchy(k, n), *scratch ;
+
+    for (i = 0 ; i < k ; i++ ) {
+	orig[i] = my_malloc(sz, "orig data");
+	pkt[i] = my_malloc(sz, "pkt data");
+	for (j = 0 ; j < sz ; j++)
+	    ((unsigned char *)orig[i])[j] = (j * 7) ^ (i * 13) ;
+    }
+    for (pass = 0 ; pass < 2 ; pass++) {
+	int ret ;
+
+	for (i = 0 ; i < k ; i++)
+	    index[i] = i % 3 ? i : n - 1 - i / 3 ;
+	fec_encode_multi(code, orig, pkt, index, k, sz);
+	if (pass == 0)
+	    ret = fec_decode(code, pkt, index, sz);
+	else {
+	    scratch = my_malloc(fec_decode_scratch_size(code, sz), "scratch");
+	    ret = fec_decode_with_scratch(code, pkt, index, sz, scratch);
+	    free(scratch);
+	}
+	for (i = 0 ; i < k ; i++)
+	    if (ret || bcmp(orig[i], pkt[i], sz)) {
+		fprintf(stderr, "error: cauchy strips, pass %d, packet %d\n",
+		    pass, i);
+		errors++;
+		break ;
+	    }
+    }
+    for (i = 0 ; i < k ; i++ ) {
+	free(orig[i]);
+	free(pkt[i]);
+    }
+    fec_free(code);
+    return errors ;
+}
+
+/*
+ * The decode cache is sized from k: a code with k = 0 has nothing to
+ * cache, and one whose matrix is larger than the cache budget (only
+ * possible in GF(2^16)) decodes without it.
+ */
+int
+test_cache_size(void)
+{
+    int errors = 0 ;
+    int i, k ;
+    int *ixs ;
+    unsigned long hits, misses ;
+    void *code = fec_new(0, 10) ;
+
+    if (code == NULL) {
+	fprintf(stderr, "error: fec_new(0, 10) failed\n");
+	return 1 ;
+    }
+    if (fec_decode(code, NULL, NULL, 64)) {
+	fprintf(stderr, "error: decode with k = 0 failed\n");
+	errors++;
+    }
+    fec_free(code);
+#if GF_BITS > 8
+    k = 1500 ;
+    code = fec_new(k, k + 1);
+    ixs = my_malloc(k * sizeof(int), "ixs");
+    for (i = 0 ; i < 2 ; i++) {
+	int j ;
+
+	for (j = 0 ; j < k ; j++) ixs[j] = j ;
+	ixs[k / 2] = k ;
+	errors += test_decode(code, k, ixs, 64, "k 1500, no cache");
+    }
+    fec_decode_cache_stats(code, &hits, &misses);
+    if (hits != 0) {
+	fprintf(stderr, "error: %lu cache hits for k=%d\n", hits, k);
+	errors++;
+    }
+    free(ixs);
+    fec_free(code);
+#else
+    (void)i ; (void)k ; (void)ixs ; (void)hits ; (void)misses ;
+#endif
+    return errors ;
+}
+
+/*
+ * A Cauchy code that loses every source packet it can. In GF(2^16) the
+ * schedules of that many rows do not all fit in the decode scratch, so
+ * some are rebuilt for each strip.
+ */
+int
+test_cauchy_all_lost(int k, int n)
+{
+    int errors = 0 ;
+    int i, j, sz = GF_BITS * (2048 + 40) ;
+    int *index = my_malloc(k * sizeof(int), "index") ;
+    gf **orig = my_malloc(k * sizeof(gf *), "orig") ;
+    gf **pkt = my_malloc(k * sizeof(gf *), "pkt") ;
+    void *code = fec_new_cauchy(k, n) ;
+
+    for (i = 0 ; i < k ; i++ ) {
+	orig[i] = my_malloc(sz, "orig data");
+	pkt[i] = my_malloc(sz, "pkt data");
+	for (j = 0 ; j < sz ; j++)
+	    ((unsigned char *)orig[i])[j] = (j * 11) ^ (i * 5) ;
+	index[i] = i < n - k ? n - 1 - i : i ;
+    }
+    fec_encode_multi(code, orig, pkt, index, k, sz);
+    if (fec_decode(code, pkt, index, sz))
+	errors++;
+    for (i = 0 ; i < k && errors == 0 ; i++)
+	if (index[i] != i || bcmp(orig[i], pkt[i], sz)) {
+	    fprintf(stderr, "error: cauchy (%d, %d) all lost, packet %d\n",
+		k, n, i);
+	    errors++;
+	}
+    for (i = 0 ; i < k ; i++ ) {
+	free(orig[i]);
+	free(pkt[i]);
+    }
+    free(orig);
+    free(pkt);
+    free(index);
+    fec_free(code);
+    return errors ;
+}
+
+/*
+ * The counters of a code, if the library keeps them (make FEC_STATS=1):
+ * two blocks with the same loss pattern, the second one decoded with
+ * the matrix from the cache. They belong to the (k, n), so they are
+ * read before and after, the second time from a new code made after
+ * the first one is freed, and a Cauchy code of the same (k, n) must
+ * not see them. A decode of packets in chunks sets up its matrix once,
+ * not once per chunk.
+ */
+int
+test_stats(int sz)
+{
+    int errors = 0 ;
+    int i, item, k = 16, calls, hist ;
+    int index[16] ;
+    uint64_t st0[FEC_STAT_COUNT], st[FEC_STAT_COUNT], stc[FEC_STAT_COUNT] ;
+    gf *orig[16], *pkt[16] ;
+    void *code = fec_new(k, 2 * k) ;
+    void *cauchy ;
+
+    if (fec_get_stats(code, st0)) {
+	fec_free(code);
+	return 0 ;	/* not built in */
+    }
+    cauchy = fec_new_cauchy(k, 2 * k) ;
+    fec_get_stats(cauchy, stc);
+    for (i = 0 ; i < k ; i++ ) {
+	orig[i] = my_malloc(sz * sizeof(gf), "orig data");
+	pkt[i] = my_malloc(sz * sizeof(gf), "pkt data");
+	for (item=0; item < sz; item++)
+	    orig[i][item] = ((item * 3) ^ i) & GF_SIZE;
+	index[i] = i % 4 ? i : k + i ;
+    }
+    fec_encode_multi(code, orig, pkt, index, k, sz);
+    fec_decode(code, pkt, index, sz);
+    for (i = 0 ; i < k ; i++ )
+	index[i] = i % 4 ? i : k + i ;
+    fec_encode_multi(code, orig, pkt, index, k, sz);
+    fec_decode(code, pkt, index, sz);
+    fec_free(code);
+    code = fec_new(k, 2 * k) ;
+    fec_get_stats(code, st);
+    for (i = 0 ; i < FEC_STAT_COUNT ; i++)
+	st[i] -= st0[i] ;
+    if (st[FEC_STAT_ENCODE_CALLS] != 2 ||
+	    st[FEC_STAT_ENCODE_BYTES] != (uint64_t)2 * k * sz ||
+	    st[FEC_STAT_DECODE_CALLS] != 2 ||
+	    st[FEC_STAT_DECODE_BYTES] != (uint64_t)2 * k * sz ||
+	    st[FEC_STAT_INVERSIONS] != 1 || st[FEC_STAT_CACHE_HITS] != 1) {
+	errors++;
+	fprintf(stderr, "error: bad stats %lu %lu %lu %lu %lu %lu\n",
+	    (unsigned long)st[0], (unsigned long)st[1],
+	    (unsigned long)st[2], (unsigned long)st[3],
+	    (unsigned long)st[4], (unsigned long)st[5]);
+    }
+    for (calls = 0, hist = FEC_STAT_ENCODE_HIST ; hist < FEC_STAT_COUNT ;
+	    hist++)
+	calls += st[hist] ;
+    if (calls != 4) {
+	errors++;
+	fprintf(stderr, "error: %d calls in the latency histograms\n", calls);
+    }
+    fec_get_stats(cauchy, st);
+    if (memcmp(st, stc, sizeof(st))) {
+	errors++;
+	fprintf(stderr, "error: the Cauchy code counted the Vandermonde one\n");
+    }
+    fec_free(cauchy);
+
+    fec_get_stats(code, st0);
+    for (i = 0 ; i < k ; i++ )
+	index[i] = i % 3 ? i : k + i ;
+    errors += test_sg(code, k, index, 64, 4, 1);
+    fec_get_stats(code, st);
+    if (st[FEC_STAT_INVERSIONS] - st0[FEC_STAT_INVERSIONS] != 1 ||
+	    st[FEC_STAT_CACHE_HITS] != st0[FEC_STAT_CACHE_HITS]) {
+	errors++;
+	fprintf(stderr, "error: sg decode set up its matrix %lu times\n",
+	    (unsigned long)(st[FEC_STAT_INVERSIONS] - st0[FEC_STAT_INVERSIONS] +
+	    st[FEC_STAT_CACHE_HITS] - st0[FEC_STAT_CACHE_HITS]));
+    }
+    for (i = 0 ; i < k ; i++ ) {
+	free(orig[i]);
+	free(pkt[i]);
+    }
+    fec_free(code);
     return errors ;
 }
 
@@ -206,11 +791,14 @@ main(int argc, char *argv[])
 {
     char buf[256];
     void *code ;
+    void *pool ;
 
     int kk ;
     int i ;
+    int errors = 0 ;
 
     int *ixs ;
+    unsigned long hits, misses, hits1, misses1 ;
 
     int lim = GF_SIZE + 1 ;
 
@@ -219,16 +807,67 @@ main(int argc, char *argv[])
 #if 0
     test_gf();
 #endif
+    /* first, so that the threads race on the initialization */
+    errors += test_threads();
+    pool = fec_pool_new(4);
     for ( kk = KK ; kk > 2 ; kk-- ) {
 	code = fec_new(kk, lim);
 	ixs = my_malloc(kk * sizeof(int), "ixs" );
 
 	for (i=0; i<kk; i++) ixs[i] = kk - i ;
 	sprintf(buf, "kk=%d, kk - i", kk);
-	test_decode(code, kk, ixs, SZ, buf);
+	errors += test_decode(code, kk, ixs, SZ, buf);
 
 	for (i=0; i<kk; i++) ixs[i] = i ;
-	test_decode(code, kk, ixs, SZ, "i");
+	errors += test_decode(code, kk, ixs, SZ, "i");
+
+	/*
+	 * all the sources, out of order: only a shuffle, which must not
+	 * get near the decode cache. Then a single one missing.
+	 */
+	fec_decode_cache_stats(code, &hits, &misses);
+	for (i=0; i<kk; i++) ixs[i] = kk - 1 - i ;
+	errors += test_decode(code, kk, ixs, SZ, "kk - 1 - i");
+	fec_decode_cache_stats(code, &hits1, &misses1);
+	if (hits1 != hits || misses1 != misses) {
+	    fprintf(stderr, "error: decode cache used for kk=%d\n", kk);
+	    errors++;
+	}
+	for (i=0; i<kk; i++) ixs[i] = i ;
+	ixs[kk / 2] = lim - 1 ;
+	errors += test_decode(code, kk, ixs, SZ, "one missing");
+	for (i=0; i<kk; i++) ixs[i] = (i & 1) ? lim - 1 - i : i ;
+	errors += test_subset(code, kk, ixs, SZ);
+	errors += test_sg(code, kk, ixs, 64, 5, 1);
+
+	/*
+	 * the same set of packets in two orders, the second time with a
+	 * size that is not a multiple of the SIMD width. The second
+	 * decode must find the matrix in the cache.
+	 */
+	for (i=0; i<kk; i++) ixs[i] = kk + 1 - i ;
+	errors += test_decode(code, kk, ixs, SZ, "kk + 1 - i");
+	fec_decode_cache_stats(code, &hits, &misses);
+	for (i=0; i<kk; i++) ixs[i] = i + 2 ;
+	errors += test_decode(code, kk, ixs, SZ - 2, "i + 2, odd size");
+	fec_decode_cache_stats(code, &hits1, &misses1);
+	if (hits1 != hits + 1) {
+	    fprintf(stderr, "error: decode cache miss for kk=%d\n", kk);
+	    errors++;
+	}
+
+	for (i=0; i<kk; i++) ixs[i] = (i % 3) ? i : lim - 1 - i ;
+	errors += test_incremental(code, kk, ixs, SZ - 2);
+	/* repair packets first, then the sources whose columns they took */
+	for (i=0; i<kk; i++) ixs[i] = i < kk / 2 ? lim - 1 - i : i - kk / 2 ;
+	errors += test_incremental(code, kk, ixs, SZ);
+
+	if (kk % 16 == 0) {
+	    for (i=0; i<kk; i++) ixs[i] = (i & 1) ? kk + i : i ;
+	    errors += test_parallel(pool, code, kk, ixs, 16 * SZ);
+	    for (i=0; i<kk; i++) ixs[i] = lim - 1 - i ;
+	    errors += test_parallel(pool, code, kk, ixs, 16 * SZ - 2);
+	}
 
 if (0) {
 	for (i=0; i<kk; i++) ixs[i] = i ;
@@ -241,7 +880,7 @@ if (0)
 	    int j ;
 	    for (j=0; j<KK; j++) ixs[j] = kk - j ;
 	    ixs[0] = i ;
-	    test_decode(code, kk, ixs, SZ, "0 = big");
+	    errors += test_decode(code, kk, ixs, SZ, "0 = big");
 	}
 
 if (0)
@@ -249,7 +888,7 @@ if (0)
 	    int j ;
 	    for (j=0; j<kk; j++)
 		ixs[j] = kk -1 - j + i ;
-	    test_decode(code, kk, ixs, SZ, "shifted j");
+	    errors += test_decode(code, kk, ixs, SZ, "shifted j");
 	}
 if (1)  {
 	int j, max_i0 = KK/2 ;
@@ -258,12 +897,43 @@ if (1)  {
 	for (i= 0 ; i <= max_i0 ; i++) {
 	    for (j=0; j<kk; j++)
 		ixs[j] = j + i ;
-	    test_decode(code, kk, ixs, SZ, "shifted j");
+	    errors += test_decode(code, kk, ixs, SZ, "shifted j");
 	}
 	}
 	fprintf(stderr, "\n");
 	free(ixs);
 	fec_free(code);
     }
-    return 0;
+
+    /*
+     * Cauchy codes, which need a size multiple of GF_BITS bytes.
+     */
+    for ( kk = 2 ; kk <= KK ; kk += kk < 8 ? 1 : 7 ) {
+	code = fec_new_cauchy(kk, 2 * kk);
+	ixs = my_malloc(kk * sizeof(int), "ixs" );
+
+	for (i=0; i<kk; i++) ixs[i] = kk + i ;
+	errors += test_decode(code, kk, ixs, SZ, "cauchy, all repair");
+	for (i=0; i<kk; i++) ixs[i] = (i & 1) ? 2 * kk - 1 - i : i ;
+	errors += test_subset(code, kk, ixs, 2 * GF_BITS);
+	errors += test_sg(code, kk, ixs, 2 * GF_BITS, 3, 0);
+	errors += test_decode(code, kk, ixs, SZ / 2 + GF_BITS, "cauchy, half");
+	if (kk % 16 == 0)
+	    errors += test_parallel(pool, code, kk, ixs, 4 * SZ);
+	fprintf(stderr, "\n");
+	free(ixs);
+	fec_free(code);
+    }
+    fec_pool_free(pool);
+
+    /* the geometries in FEC_GEOMETRIES of the Makefile */
+    errors += test_baked(16, 32, SZ);
+    errors += test_baked(32, 64, SZ);
+    errors += test_baked(64, 128, SZ);
+    errors += test_baked(128, 255, SZ);
+    errors += test_stats(SZ);
+    errors += test_cache_size();
+    errors += test_cauchy_strips();
+    errors += test_cauchy_all_lost(128, 256);
+    return errors != 0;
 }
@@ -0,0 +1,166 @@
+package com.onionnetworks.fec;
+
+import com.onionnetworks.util.*;
+import java.nio.ByteBuffer;
+import java.util.*;
+import junit.framework.*;
+
+public class ChunkedPacketTest extends TestCase {
+
+    static final int K = 4;
+    static final int N = 7;
+    static final int CHUNK_LENGTH = 8;
+    static final int COUNT = 5;
+    static final int PACKET_LENGTH = CHUNK_LENGTH*COUNT;
+    static final int[] REPAIRS = new int[] {4,5,6};
+
+    static final FECCode[] CODES = new FECCode[] {
+	new PureCode(K,N),new Pure16Code(K,N)
+    };
+
+    Random rand = new Random(1);
+
+    public ChunkedPacketTest(String name) {
+	super(name);
+    }
+
+    static Buffer[] buffers(byte[] b, int count) {
+	Buffer[] r = new Buffer[count];
+	for (int i=0;i<count;i++) {
+	    r[i] = new Buffer(b,i*PACKET_LENGTH,PACKET_LENGTH);
+	}
+	return r;
+    }
+
+    /**
+     * count packets interleaved chunk by chunk in b, as in the
+     * ChunkedPacket Javadoc.
+     */
+    static ChunkedPacket[] strided(ByteBuffer b, int count) {
+	ChunkedPacket[] r = new ChunkedPacket[count];
+	for (int i=0;i<count;i++) {
+	    r[i] = new ChunkedPacket(b,i*CHUNK_LENGTH,count*CHUNK_LENGTH,
+				     CHUNK_LENGTH,COUNT);
+	}
+	return r;
+    }
+
+    /**
+     * The whole of packet p, in order.
+     */
+    static byte[] read(ChunkedPacket p) {
+	byte[] r = new byte[(int) p.getLength()];
+	for (int c=0;c<p.getChunkCount();c++) {
+	    p.getChunk(c).duplicate().get(r,c*CHUNK_LENGTH,CHUNK_LENGTH);
+	}
+	return r;
+    }
+
+    /**
+     * Strided direct buffers must give the same repair packets as the
+     * packets in one piece.
+     */
+    public void testEncodeStrided() {
+	for (int n=0;n<CODES.length;n++) {
+	    FECCode code = CODES[n];
+	    byte[] src = new byte[K*PACKET_LENGTH];
+	    rand.nextBytes(src);
+	    byte[] want = new byte[REPAIRS.length*PACKET_LENGTH];
+	    code.encode(buffers(src,K),buffers(want,REPAIRS.length),REPAIRS);
+
+	    ByteBuffer block = ByteBuffer.allocateDirect(src.length);
+	    for (int c=0;c<COUNT;c++) {
+		for (int i=0;i<K;i++) {
+		    block.put(src,i*PACKET_LENGTH+c*CHUNK_LENGTH,CHUNK_LENGTH);
+		}
+	    }
+	    ByteBuffer repair = ByteBuffer.allocateDirect(want.length);
+	    ChunkedPacket[] r = strided(repair,REPAIRS.length);
+	    code.encode(strided(block,K),r,REPAIRS);
+
+	    for (int i=0;i<r.length;i++) {
+		byte[] got = read(r[i]);
+		for (int j=0;j<PACKET_LENGTH;j++) {
+		    assertEquals(code+" repair "+i+" byte "+j,
+				 want[i*PACKET_LENGTH+j],got[j]);
+		}
+	    }
+	}
+    }
+
+    /**
+     * Decodes packets whose chunks are separate heap buffers, starting
+     * past their positions, from two source and two repair packets out
+     * of order.
+     */
+    public void testRoundTrip() {
+	for (int n=0;n<CODES.length;n++) {
+	    FECCode code = CODES[n];
+	    byte[] src = new byte[K*PACKET_LENGTH];
+	    rand.nextBytes(src);
+	    byte[] repair = new byte[REPAIRS.length*PACKET_LENGTH];
+	    code.encode(buffers(src,K),buffers(repair,REPAIRS.length),
+			REPAIRS);
+
+	    int[] index = new int[] {3,5,1,4};
+	    ChunkedPacket[] pkts = new ChunkedPacket[K];
+	    for (int i=0;i<K;i++) {
+		byte[] b = index[i] < K ? src : repair;
+		int off = (index[i] < K ? index[i] : index[i]-K)*PACKET_LENGTH;
+		ByteBuffer[] chunks = new ByteBuffer[COUNT];
+		for (int c=0;c<COUNT;c++) {
+		    chunks[c] = ByteBuffer.allocate(CHUNK_LENGTH+3);
+		    chunks[c].position(3);
+		    chunks[c].duplicate().put(b,off+c*CHUNK_LENGTH,
+					      CHUNK_LENGTH);
+		}
+		pkts[i] = new ChunkedPacket(chunks,CHUNK_LENGTH);
+	    }
+
+	    code.decode(pkts,index);
+	    for (int i=0;i<K;i++) {
+		assertEquals(code+" index "+i,i,index[i]);
+		byte[] got = read(pkts[i]);
+		for (int j=0;j<PACKET_LENGTH;j++) {
+		    assertEquals(code+" packet "+i+" byte "+j,
+				 src[i*PACKET_LENGTH+j],got[j]);
+		}
+	    }
+	}
+    }
+
+    public void testDifferentChunks() {
+	ByteBuffer b = ByteBuffer.allocate((K+1)*PACKET_LENGTH);
+	ChunkedPacket[] src = strided(b,K);
+	ChunkedPacket[] repair = new ChunkedPacket[] {
+	    new ChunkedPacket(b,K*PACKET_LENGTH,CHUNK_LENGTH,CHUNK_LENGTH,
+			      COUNT-1)
+	};
+	try {
+	    CODES[0].encode(src,repair,new int[] {4});
+	    fail("Should have thrown exception");
+	} catch (IllegalArgumentException e) {
+	}
+    }
+
+    public void testBadStride() {
+	ByteBuffer b = ByteBuffer.allocate(PACKET_LENGTH);
+	try {
+	    new ChunkedPacket(b,0,CHUNK_LENGTH-1,CHUNK_LENGTH,2);
+	    fail("Should have thrown exception");
+	} catch (IllegalArgumentException e) {
+	}
+	// chunk 1 would be at 2^31-1, not at a negative int
+	try {
+	    new ChunkedPacket(b,0,Integer.MAX_VALUE,CHUNK_LENGTH,2);
+	    fail("Should have thrown exception");
+	} catch (IndexOutOfBoundsException e) {
+	}
+	try {
+	    new ChunkedPacket(b,PACKET_LENGTH-CHUNK_LENGTH+1,CHUNK_LENGTH,
+			      CHUNK_LENGTH,1);
+	    fail("Should have thrown exception");
+	} catch (IndexOutOfBoundsException e) {
+	}
+    }
+}
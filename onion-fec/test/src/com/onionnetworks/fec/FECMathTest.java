@@ -0,0 +1,120 @@
+package com.onionnetworks.fec;
+
+import java.util.*;
+import junit.framework.*;
+
+public class FECMathTest extends TestCase {
+
+    static final int MIN = FECMath.SPLIT_TABLE_MIN;
+    // just below, at and just above the threshold
+    static final int[] LENGTHS = new int[] {MIN-1,MIN,MIN+1};
+
+    FECMath math = new FECMath(16);
+    Random rand = new Random(1);
+
+    public FECMathTest(String name) {
+	super(name);
+    }
+
+    // c * y through gf_log and gf_exp
+    char mul(int c, int y) {
+	if (c == 0 || y == 0) {
+	    return 0;
+	}
+	return math.gf_exp[math.gf_log[c]+math.gf_log[y]];
+    }
+
+    /**
+     * Constants that share slots of splitCache, taken in turns so that
+     * each one throws the last one out, and some that do not.
+     */
+    int[] constants() {
+	int[] c = new int[40];
+	for (int i=0;i<32;i++) {
+	    c[i] = 5 + (i % 4)*FECMath.SPLIT_CACHE_SIZE;
+	}
+	c[32] = 0;
+	c[33] = 1;
+	c[34] = 0xff;
+	c[35] = 0x100;
+	c[36] = 0xffff;
+	for (int i=37;i<c.length;i++) {
+	    c[i] = rand.nextInt(65536);
+	}
+	return c;
+    }
+
+    // random symbols, with some 0's and symbols with one byte clear
+    char[] symbols(int len) {
+	char[] s = new char[len];
+	for (int i=0;i<len;i++) {
+	    switch (rand.nextInt(8)) {
+	    case 0: s[i] = 0; break;
+	    case 1: s[i] = (char) rand.nextInt(256); break;
+	    case 2: s[i] = (char) (rand.nextInt(256) << 8); break;
+	    default: s[i] = (char) rand.nextInt(65536);
+	    }
+	}
+	return s;
+    }
+
+    public void testBuildSplit() {
+	// not 0, which addMul() never looks up
+	for (int c=1;c<65536;c+=97) {
+	    char[] t = math.buildSplit((char) c);
+	    assertEquals(512,t.length);
+	    for (int x=0;x<256;x++) {
+		assertEquals("c="+c+" x="+x,mul(c,x),t[x]);
+		assertEquals("c="+c+" x="+(x << 8),mul(c,x << 8),t[256+x]);
+	    }
+	}
+    }
+
+    public void testAddMul() {
+	int[] c = constants();
+	for (int l=0;l<LENGTHS.length;l++) {
+	    int len = LENGTHS[l];
+	    for (int n=0;n<c.length;n++) {
+		char[] src = symbols(len+3);
+		char[] dst = symbols(len+5);
+		char[] want = (char[]) dst.clone();
+		for (int i=0;i<len;i++) {
+		    want[2+i] ^= mul(c[n],src[3+i]);
+		}
+		math.addMul(dst,2,src,3,(char) c[n],len);
+		for (int i=0;i<dst.length;i++) {
+		    assertEquals("len="+len+" c="+c[n]+" i="+i,want[i],dst[i]);
+		}
+	    }
+	}
+    }
+
+    public void testAddMul16() {
+	int[] c = constants();
+	for (int l=0;l<LENGTHS.length;l++) {
+	    int len = LENGTHS[l];
+	    for (int n=0;n<c.length;n++) {
+		char[] s = symbols(len);
+		// high byte first, at an odd offset
+		byte[] src = new byte[2*len+1];
+		for (int i=0;i<len;i++) {
+		    src[1+2*i] = (byte) (s[i] >>> 8);
+		    src[2+2*i] = (byte) s[i];
+		}
+		byte[] dst = new byte[2*len+4];
+		rand.nextBytes(dst);
+		byte[] want = (byte[]) dst.clone();
+		for (int i=0;i<len;i++) {
+		    char p = mul(c[n],s[i]);
+		    want[4+2*i] ^= (byte) (p >>> 8);
+		    want[5+2*i] ^= (byte) p;
+		}
+		math.addMul16(dst,4,src,1,(char) c[n],2*len);
+		for (int i=0;i<dst.length;i++) {
+		    assertEquals("len="+2*len+" c="+c[n]+" i="+i,want[i],
+				 dst[i]);
+		}
+	    }
+	}
+    }
+}
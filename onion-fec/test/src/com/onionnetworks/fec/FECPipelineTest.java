@@ -0,0 +1,250 @@
+package com.onionnetworks.fec;
+
+import com.onionnetworks.io.*;
+import com.onionnetworks.util.*;
+import java.io.*;
+import java.util.*;
+import junit.framework.*;
+
+public class FECPipelineTest extends TestCase {
+
+    static final int K = 4;
+    static final int N = 8;
+    static final int PACKET_LENGTH = 16;
+    static final int SEG_LEN = K*PACKET_LENGTH;
+    static final int[] REPAIRS = new int[] {4,5,6,7};
+
+    // three whole segments and a short one
+    static final int LEN = 3*SEG_LEN + 5;
+
+    FECCode code = new PureCode(K,N);
+    byte[] b = new byte[LEN];
+    Random rand = new Random(1);
+
+    public FECPipelineTest(String name) {
+	super(name);
+	rand.nextBytes(b);
+    }
+
+    /**
+     * Fails with e on the call after the first okCalls reads or writes.
+     */
+    static class FailingRAF extends FilterRAF {
+
+	int okCalls;
+	IOException e;
+
+	FailingRAF(RAF raf, int okCalls, IOException e) {
+	    super(raf);
+	    this.okCalls = okCalls;
+	    this.e = e;
+	}
+
+	void call() throws IOException {
+	    if (okCalls-- <= 0) {
+		throw e;
+	    }
+	}
+
+	public synchronized void seekAndWrite(long pos, byte[] b, int off,
+					      int len) throws IOException {
+	    call();
+	    super.seekAndWrite(pos,b,off,len);
+	}
+
+	public synchronized void seekAndReadFully(long pos, byte[] b, int off,
+						  int len) throws IOException {
+	    call();
+	    super.seekAndReadFully(pos,b,off,len);
+	}
+    }
+
+    /**
+     * Takes a while over each read and does not stop for interrupts,
+     * like a read stuck in the disk.
+     */
+    static class SlowRAF extends FilterRAF {
+
+	int active;
+
+	SlowRAF(RAF raf) {
+	    super(raf);
+	}
+
+	public void seekAndReadFully(long pos, byte[] b, int off, int len)
+	    throws IOException {
+	    synchronized (this) {
+		active++;
+	    }
+	    boolean interrupted = false;
+	    long end = System.currentTimeMillis()+50;
+	    for (long t;(t = end-System.currentTimeMillis()) > 0;) {
+		try {
+		    Thread.sleep(t);
+		} catch (InterruptedException e) {
+		    interrupted = true;
+		}
+	    }
+	    try {
+		super.seekAndReadFully(pos,b,off,len);
+	    } finally {
+		synchronized (this) {
+		    active--;
+		}
+		if (interrupted) {
+		    Thread.currentThread().interrupt();
+		}
+	    }
+	}
+    }
+
+    RAF source() throws IOException {
+	RAF raf = new TempRaf();
+	raf.seekAndWrite(0,b,0,b.length);
+	// past the end of the data, so that padding with it would show
+	byte[] junk = new byte[SEG_LEN];
+	Arrays.fill(junk,(byte) 0xa5);
+	raf.seekAndWrite(b.length,junk,0,junk.length);
+	return raf;
+    }
+
+    static byte[] readAll(RAF raf) throws IOException {
+	byte[] r = new byte[(int) raf.length()];
+	raf.seekAndReadFully(0,r,0,r.length);
+	return r;
+    }
+
+    // The repair packets of segment s, encoded without the pipeline.
+    byte[] repairs(int s) {
+	byte[] seg = new byte[SEG_LEN];
+	System.arraycopy(b,s*SEG_LEN,seg,0,Math.min(SEG_LEN,LEN-s*SEG_LEN));
+	Buffer[] src = new Buffer[K];
+	for (int i=0;i<K;i++) {
+	    src[i] = new Buffer(seg,i*PACKET_LENGTH,PACKET_LENGTH);
+	}
+	byte[] r = new byte[REPAIRS.length*PACKET_LENGTH];
+	Buffer[] repair = new Buffer[REPAIRS.length];
+	for (int i=0;i<repair.length;i++) {
+	    repair[i] = new Buffer(r,i*PACKET_LENGTH,PACKET_LENGTH);
+	}
+	code.encode(src,repair,REPAIRS);
+	return r;
+    }
+
+    public void testEncode() throws IOException {
+	RAF out = new TempRaf();
+	FECPipeline p = new FECPipeline(code,K,PACKET_LENGTH);
+	assertEquals(4,p.encode(source(),0,LEN,out,0,REPAIRS));
+	byte[] r = readAll(out);
+	assertEquals(4*REPAIRS.length*PACKET_LENGTH,r.length);
+	for (int s=0;s<4;s++) {
+	    byte[] want = repairs(s);
+	    for (int i=0;i<want.length;i++) {
+		assertEquals("segment "+s+" byte "+i,want[i],
+			     r[s*want.length+i]);
+	    }
+	}
+    }
+
+    public void testRoundTrip() throws IOException {
+	RAF rep = new TempRaf();
+	FECPipeline p = new FECPipeline(code,K,PACKET_LENGTH,1);
+	p.encode(source(),0,LEN,rep,0,REPAIRS);
+
+	// Each segment loses source packets 0 and 2, which are replaced by
+	// two of its repair packets, a different pair each time.
+	RAF in = new TempRaf();
+	int[][] indexes = new int[4][];
+	byte[] pkt = new byte[PACKET_LENGTH];
+	for (int s=0;s<4;s++) {
+	    indexes[s] = new int[] {K+s,1,K+(s+1)%REPAIRS.length,3};
+	    for (int i=0;i<K;i++) {
+		int ix = indexes[s][i];
+		if (ix < K) {
+		    Arrays.fill(pkt,(byte) 0);
+		    int off = s*SEG_LEN+ix*PACKET_LENGTH;
+		    System.arraycopy(b,off,pkt,0,
+				     Math.max(0,Math.min(PACKET_LENGTH,LEN-off)));
+		} else {
+		    rep.seekAndReadFully((s*REPAIRS.length+ix-K)*PACKET_LENGTH,
+					 pkt,0,PACKET_LENGTH);
+		}
+		in.seekAndWrite(s*SEG_LEN+i*PACKET_LENGTH,pkt,0,PACKET_LENGTH);
+	    }
+	}
+
+	RAF out = new TempRaf();
+	assertEquals(4,p.decode(in,0,indexes,out,0,LEN));
+	byte[] r = readAll(out);
+	assertEquals(LEN,r.length);
+	for (int i=0;i<LEN;i++) {
+	    assertEquals("byte "+i,b[i],r[i]);
+	}
+    }
+
+    public void testReadException() {
+	IOException e = new IOException("read");
+	FECPipeline p = new FECPipeline(code,K,PACKET_LENGTH);
+	try {
+	    p.encode(new FailingRAF(source(),2,e),0,LEN,new TempRaf(),0,
+		     REPAIRS);
+	    fail("Should have thrown exception");
+	} catch (IOException e2) {
+	    assertSame(e,e2);
+	}
+    }
+
+    public void testCodeException() throws IOException {
+	final RuntimeException e = new IllegalStateException("code");
+	FECCode failing = new PureCode(K,N) {
+		int calls;
+		public void encode(Buffer[] src, Buffer[] repair,
+				   int[] index) {
+		    if (++calls == 2) {
+			throw e;
+		    }
+		    super.encode(src,repair,index);
+		}
+	    };
+	// The coding stage cannot throw IOExceptions, but its
+	// RuntimeExceptions come out the same way.
+	FECPipeline p = new FECPipeline(failing,K,PACKET_LENGTH);
+	try {
+	    p.encode(source(),0,LEN,new TempRaf(),0,REPAIRS);
+	    fail("Should have thrown exception");
+	} catch (RuntimeException e2) {
+	    assertSame(e,e2);
+	}
+    }
+
+    public void testWriteException() {
+	IOException e = new IOException("write");
+	FECPipeline p = new FECPipeline(code,K,PACKET_LENGTH);
+	try {
+	    p.encode(source(),0,LEN,new FailingRAF(new TempRaf(),1,e),0,
+		     REPAIRS);
+	    fail("Should have thrown exception");
+	} catch (IOException e2) {
+	    assertSame(e,e2);
+	}
+    }
+
+    /**
+     * The exception must not come out while the reader is still using
+     * the source.
+     */
+    public void testStagesStopped() throws IOException {
+	IOException e = new IOException("write");
+	SlowRAF in = new SlowRAF(source());
+	FECPipeline p = new FECPipeline(code,K,PACKET_LENGTH);
+	try {
+	    p.encode(in,0,LEN,new FailingRAF(new TempRaf(),0,e),0,REPAIRS);
+	    fail("Should have thrown exception");
+	} catch (IOException e2) {
+	    assertSame(e,e2);
+	}
+	synchronized (in) {
+	    assertEquals(0,in.active);
+	}
+    }
+}
@@ -0,0 +1,53 @@
+package com.onionnetworks.fec;
+
+/**
+ * PureCodeTest's round trips on the 16 bit code, and its repair packets
+ * against ones encoded before Pure16Code stopped copying to char[]'s.
+ */
+public class Pure16CodeTest extends PureCodeTest {
+
+    /**
+     * Repair packets 4..7 of the (4,8) code for the 32 source bytes
+     * (byte) (i*29+7), from the char[] Pure16Code (high byte first).
+     * fec.c built with GF_BITS=16 gives the same.
+     */
+    static final String REFERENCE =
+	"387d9e9e0fe3960c"+
+	"fc78bc4d1e91f362"+
+	"dd60ce24e41b48f9"+
+	"0ab3231d21141d6d";
+
+    public Pure16CodeTest(String name) {
+	super(name);
+    }
+
+    FECCode createCode(int k, int n) {
+	return new Pure16Code(k,n);
+    }
+
+    public void testReference() {
+	byte[] src = new byte[32];
+	for (int i=0;i<src.length;i++) {
+	    src[i] = (byte) (i*29+7);
+	}
+	byte[] r = encode(createCode(4,8),src,4,8,8);
+	assertEquals(REFERENCE.length()/2,r.length);
+	for (int i=0;i<r.length;i++) {
+	    assertEquals("byte "+i,
+			 (byte) Integer.parseInt(REFERENCE.substring(2*i,2*i+2),
+						 16),
+			 r[i]);
+	}
+    }
+
+    public void testOddLength() {
+	FECCode code = createCode(4,8);
+	byte[] b = new byte[4*7];
+	try {
+	    code.encode(buffers(b,4,7),buffers(new byte[7],1,7),
+			new int[] {4});
+	    fail("Should have thrown exception");
+	} catch (IllegalArgumentException e) {
+	}
+    }
+}
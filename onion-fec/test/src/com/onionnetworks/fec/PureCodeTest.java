@@ -0,0 +1,148 @@
+package com.onionnetworks.fec;
+
+import com.onionnetworks.util.*;
+import java.nio.ByteBuffer;
+import java.util.*;
+import junit.framework.*;
+
+public class PureCodeTest extends TestCase {
+
+    static final int K = 8;
+    static final int N = 14;
+    static final int PACKET_LENGTH = 32;
+
+    Random rand = new Random(1);
+
+    public PureCodeTest(String name) {
+	super(name);
+    }
+
+    FECCode createCode(int k, int n) {
+	return new PureCode(k,n);
+    }
+
+    static Buffer[] buffers(byte[] b, int count, int packetLength) {
+	Buffer[] r = new Buffer[count];
+	for (int i=0;i<count;i++) {
+	    r[i] = new Buffer(b,i*packetLength,packetLength);
+	}
+	return r;
+    }
+
+    // the numbers 0..n-1 in random order
+    int[] shuffled(int n) {
+	List l = new ArrayList();
+	for (int i=0;i<n;i++) {
+	    l.add(Integer.valueOf(i));
+	}
+	Collections.shuffle(l,rand);
+	int[] r = new int[n];
+	for (int i=0;i<n;i++) {
+	    r[i] = ((Integer) l.get(i)).intValue();
+	}
+	return r;
+    }
+
+    /**
+     * @return packets k..n-1 of src, one after the other.
+     */
+    static byte[] encode(FECCode code, byte[] src, int k, int n,
+			 int packetLength) {
+	int[] index = new int[n-k];
+	for (int i=0;i<index.length;i++) {
+	    index[i] = k+i;
+	}
+	byte[] r = new byte[(n-k)*packetLength];
+	code.encode(buffers(src,k,packetLength),
+		    buffers(r,n-k,packetLength),index);
+	return r;
+    }
+
+    /**
+     * Loses m = 0..n-k source packets at random, and decodes the others
+     * with as many repair packets, all in random order.
+     */
+    void roundTrip(int k, int n, int packetLength) {
+	FECCode code = createCode(k,n);
+	byte[] src = new byte[k*packetLength];
+	rand.nextBytes(src);
+	byte[] repair = encode(code,src,k,n,packetLength);
+
+	for (int m=0;m<=Math.min(k,n-k);m++) {
+	    int[] lost = shuffled(k);
+	    int[] repairs = shuffled(n-k);
+	    // what each slot gets, before shuffling
+	    int[] got = new int[k];
+	    for (int i=0;i<k;i++) {
+		got[i] = i;
+	    }
+	    for (int i=0;i<m;i++) {
+		got[lost[i]] = k+repairs[i];
+	    }
+
+	    int[] order = shuffled(k);
+	    byte[] b = new byte[k*packetLength];
+	    int[] index = new int[k];
+	    for (int i=0;i<k;i++) {
+		index[i] = got[order[i]];
+		if (index[i] < k) {
+		    System.arraycopy(src,index[i]*packetLength,b,
+				     i*packetLength,packetLength);
+		} else {
+		    System.arraycopy(repair,(index[i]-k)*packetLength,b,
+				     i*packetLength,packetLength);
+		}
+	    }
+
+	    code.decode(buffers(b,k,packetLength),index);
+	    for (int i=0;i<k;i++) {
+		assertEquals("k="+k+" n="+n+" m="+m,i,index[i]);
+	    }
+	    for (int i=0;i<b.length;i++) {
+		assertEquals("k="+k+" n="+n+" m="+m+" byte "+i,src[i],b[i]);
+	    }
+	}
+    }
+
+    public void testRoundTrip() {
+	roundTrip(K,N,PACKET_LENGTH);
+    }
+
+    public void testMoreRepairThanSource() {
+	roundTrip(3,10,PACKET_LENGTH);
+    }
+
+    public void testOneSource() {
+	roundTrip(1,4,PACKET_LENGTH);
+    }
+
+    /**
+     * A short buffer must be refused before any packet is moved.
+     */
+    public void testShortBuffer() {
+	FECCode code = createCode(K,N);
+	ByteBuffer[] pkts = new ByteBuffer[K];
+	byte[][] data = new byte[K][PACKET_LENGTH];
+	int[] index = new int[K];
+	for (int i=0;i<K;i++) {
+	    rand.nextBytes(data[i]);
+	    pkts[i] = ByteBuffer.wrap((byte[]) data[i].clone());
+	    // reversed, so that every packet would have to move
+	    index[i] = K-1-i;
+	}
+	pkts[K-1].limit(PACKET_LENGTH-1);
+	int[] before = (int[]) index.clone();
+	try {
+	    code.decode(pkts,index);
+	    fail("Should have thrown exception");
+	} catch (IllegalArgumentException e) {
+	}
+	for (int i=0;i<K;i++) {
+	    assertEquals("index "+i,before[i],index[i]);
+	    for (int j=0;j<PACKET_LENGTH;j++) {
+		assertEquals("packet "+i+" byte "+j,data[i][j],
+			     pkts[i].array()[j]);
+	    }
+	}
+    }
+}
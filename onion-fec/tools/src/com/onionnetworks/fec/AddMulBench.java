@@ -0,0 +1,133 @@
+package com.onionnetworks.fec;
+
+import java.util.Random;
+
+/**
+ * Times FECMath.addMul() in GF(2^16), which Pure16Code spends its time
+ * in, and the two loops it chooses between: the one through gf_log and
+ * gf_exp, and the one through split tables (here built beforehand, as
+ * they are once in splitCache), over packet lengths on either side of
+ * FECMath.SPLIT_TABLE_MIN chars.  Where split_mbps overtakes old_mbps is
+ * where SPLIT_TABLE_MIN belongs.  addMul() is checked against the old
+ * loop before anything is timed.  Run with "ant bench", or
+ *
+ *   java -cp classes:tools/classes com.onionnetworks.fec.AddMulBench [ms]
+ *
+ * where ms is how long to run each case for (default 500).
+ */
+public class AddMulBench {
+
+    // in bytes, two per char
+    public static final int[] LENGTHS =
+        new int[] {64,128,256,384,512,768,1024,16384};
+
+    private static final FECMath math16 = new FECMath(16);
+    private static final Random rand = new Random(1);
+
+    private static long sink;
+
+    // FECMath.addMul(char[]...) in GF(2^16) as it was, with logarithms.
+    private static void oldAddMul16(char[] dst, int dstPos, char[] src,
+                                    int srcPos, char c, int len) {
+        if (c == 0) {
+            return;
+        }
+        int mulcPos = math16.gf_log[c];
+        int y;
+        for (int i=0;i<len;i++) {
+            if ((y=src[srcPos+i]) != 0) {
+                dst[dstPos+i] ^= math16.gf_exp[mulcPos+math16.gf_log[y]];
+            }
+        }
+    }
+
+    public static final int OLD = 0;
+    public static final int SPLIT = 1;
+    public static final int ADDMUL = 2;
+
+    // the split tables of the constants run16() uses, as splitCache has
+    private static final char[][] splits = new char[256][];
+
+    // The split table loop of FECMath.addMul(char[]...), at any length.
+    private static void splitAddMul16(char[] dst, int dstPos, char[] src,
+                                      int srcPos, char[] t, int len) {
+        for (int i=0;i<len;i++) {
+            int y = src[srcPos+i];
+            dst[dstPos+i] ^= t[y & 0xff] ^ t[256 + (y >>> 8)];
+        }
+    }
+
+    private static double run16(int how, int len, long ms) {
+        char[] src = new char[len];
+        char[] dst = new char[len];
+        for (int i=0;i<len;i++) {
+            src[i] = (char) rand.nextInt(65536);
+        }
+        long bytes = 0;
+        long end = System.currentTimeMillis() + ms;
+        long start = System.nanoTime();
+        while (System.currentTimeMillis() < end) {
+            for (int c=1;c<65536;c+=257) {
+                if (how == OLD) {
+                    oldAddMul16(dst,0,src,0,(char) c,len);
+                } else if (how == SPLIT) {
+                    splitAddMul16(dst,0,src,0,splits[c/257],len);
+                } else {
+                    math16.addMul(dst,0,src,0,(char) c,len);
+                }
+            }
+            bytes += 255L * 2 * len;
+        }
+        sink += dst[0];
+        return bytes * 1000.0 / (System.nanoTime() - start);
+    }
+
+    private static void check() {
+        int len = 16384+7;
+        char[] src16 = new char[len];
+        char[] a16 = new char[len];
+        char[] b16 = new char[len];
+        for (int i=0;i<len;i++) {
+            src16[i] = (char) rand.nextInt(65536);
+        }
+        for (int n=0;n<100;n++) {
+            int l = rand.nextInt(len);
+            int off = rand.nextInt(len-l+1);
+            char c16 = (char) rand.nextInt(65536);
+            oldAddMul16(a16,off,src16,len-l-off,c16,l);
+            math16.addMul(b16,off,src16,len-l-off,c16,l);
+        }
+        for (int i=0;i<len;i++) {
+            if (a16[i] != b16[i]) {
+                throw new IllegalStateException("addMul differs at "+i);
+            }
+        }
+    }
+
+    public static void main(String[] args) {
+        long ms = args.length > 0 ? Long.parseLong(args[0]) : 500;
+        check();
+        for (int c=1;c<65536;c+=257) {
+            splits[c/257] = math16.buildSplit((char) c);
+        }
+        // once to warm up, then for real
+        for (int pass=0;pass<2;pass++) {
+            if (pass == 1) {
+                System.out.println("len,old_mbps,split_mbps,new_mbps");
+            }
+            for (int i=0;i<LENGTHS.length;i++) {
+                long t = pass == 0 ? ms/5 : ms;
+                double o = run16(OLD,LENGTHS[i]/2,t);
+                double sp = run16(SPLIT,LENGTHS[i]/2,t);
+                double n = run16(ADDMUL,LENGTHS[i]/2,t);
+                if (pass == 1) {
+                    System.out.println(LENGTHS[i]+","+(int) o+","+(int) sp+
+                                       ","+(int) n);
+                }
+            }
+        }
+        if (sink == 42) {
+            System.out.println();
+        }
+    }
+}